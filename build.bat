@@ -6,28 +6,28 @@ if not exist build mkdir build
 
 REM Compile source files
 echo Compiling allocator.c...
-gcc -Wall -Wextra -std=c99 -g -O2 -Iinclude -c src/allocator.c -o build/allocator.o
+gcc -Wall -Wextra -std=c99 -g -O2 -pthread -Iinclude -c src/allocator.c -o build/allocator.o
 if %ERRORLEVEL% NEQ 0 (
     echo Error compiling allocator.c
     exit /b 1
 )
 
 echo Compiling test.c...
-gcc -Wall -Wextra -std=c99 -g -O2 -Iinclude -c src/test.c -o build/test.o
+gcc -Wall -Wextra -std=c99 -g -O2 -pthread -Iinclude -c src/test.c -o build/test.o
 if %ERRORLEVEL% NEQ 0 (
     echo Error compiling test.c
     exit /b 1
 )
 
 echo Compiling demo.c...
-gcc -Wall -Wextra -std=c99 -g -O2 -Iinclude -c src/demo.c -o build/demo.o
+gcc -Wall -Wextra -std=c99 -g -O2 -pthread -Iinclude -c src/demo.c -o build/demo.o
 if %ERRORLEVEL% NEQ 0 (
     echo Error compiling demo.c
     exit /b 1
 )
 
 echo Compiling gui.c...
-gcc -Wall -Wextra -std=c99 -g -O2 -Iinclude -c src/gui.c -o build/gui.o
+gcc -Wall -Wextra -std=c99 -g -O2 -pthread -Iinclude -c src/gui.c -o build/gui.o
 if %ERRORLEVEL% NEQ 0 (
     echo Error compiling gui.c
     exit /b 1
@@ -35,21 +35,21 @@ if %ERRORLEVEL% NEQ 0 (
 
 REM Link executables
 echo Linking test executable...
-gcc build/allocator.o build/test.o -o build/memory_allocator_test.exe
+gcc build/allocator.o build/test.o -pthread -o build/memory_allocator_test.exe
 if %ERRORLEVEL% NEQ 0 (
     echo Error linking test executable
     exit /b 1
 )
 
 echo Linking demo executable...
-gcc build/allocator.o build/demo.o -o build/demo.exe
+gcc build/allocator.o build/demo.o -pthread -o build/demo.exe
 if %ERRORLEVEL% NEQ 0 (
     echo Error linking demo executable
     exit /b 1
 )
 
 echo Linking GUI executable...
-gcc build/allocator.o build/gui.o -o build/gui.exe -lgdi32 -luser32 -lkernel32 -lcomctl32
+gcc build/allocator.o build/gui.o -pthread -o build/gui.exe -lgdi32 -luser32 -lkernel32 -lcomctl32
 if %ERRORLEVEL% NEQ 0 (
     echo Error linking GUI executable
     exit /b 1
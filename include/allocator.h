@@ -4,22 +4,208 @@
 #include <stddef.h>
 #include <stdint.h>
 
-// Memory block header structure
+// Memory block header structure. Only the size word precedes an allocated
+// block; a free block keeps its list links at the start of its payload and
+// a copy of its size (the boundary tag) in its last word.
 typedef struct block_header {
-    size_t size;                    // Size of the block (excluding header)
-    int is_free;                    // 1 if block is free, 0 if allocated
-    struct block_header* next;      // Next block in the free list
-    struct block_header* prev;      // Previous block in the free list
+    size_t size;                    // Size of the block (excluding header), plus BLOCK_* flags
+    struct block_header* next;      // Next block in the free list (free blocks only)
+    struct block_header* prev;      // Previous block in the free list (free blocks only)
 } block_header_t;
 
+// Flags kept in the low bits of the size word
+#define BLOCK_FREE 1                // The block is free
+#define BLOCK_PREV_FREE 2           // The preceding block is free and has a boundary tag
+#define BLOCK_PURGED 4              // A free block's whole pages were returned to the OS
+#define BLOCK_FLAGS 7
+#define BLOCK_SIZE(block) ((block)->size & ~(size_t)BLOCK_FLAGS)
+#define BLOCK_IS_FREE(block) (((block)->size & BLOCK_FREE) != 0)
+
 // Constants
-#define HEAP_SIZE (1024 * 1024)     // 1MB heap size
-#define MIN_BLOCK_SIZE 16           // Minimum allocation size
-#define HEADER_SIZE sizeof(block_header_t)
-#define ALIGNMENT 8                 // Memory alignment requirement
+#define REGION_SIZE (1024 * 1024)   // Default size of a heap region mapped from the OS
+#define REGION_SHIFT 20             // Regions are aligned to and sized in 1MB units
+#define REGION_ALIGN ((size_t)1 << REGION_SHIFT)
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024) // Requests this large get a mapping of their own
+
+// Purging: whole pages inside large free blocks are returned to the OS
+#define PURGE_THRESHOLD (64 * 1024) // Smallest free span purged automatically
+#define DEFAULT_PURGE_DECAY_MS 1000 // Default delay before dirty spans are purged
+#define PURGE_IMMEDIATE -1          // purge_decay_ms: purge as soon as a span is freed
+#define PURGE_NEVER -2              // purge_decay_ms: purge only in my_trim()
+#define MIN_BLOCK_SIZE 24           // Minimum allocation size: list links plus boundary tag
+#define HEADER_SIZE sizeof(size_t)
+#define ALIGNMENT 16                // Payload alignment, alignof(max_align_t) as malloc promises
+
+// Block sizes are ALIGNMENT multiples less HEADER_SIZE, so header and payload
+// keep an ALIGNMENT stride and every payload of a heap region stays aligned
+
+// Segregated free lists: exact-size small bins, then power-of-two large bins
+#define SMALL_BIN_LIMIT 512         // Blocks below this size use exact bins
+#define NUM_SMALL_BINS ((SMALL_BIN_LIMIT - MIN_BLOCK_SIZE + ALIGNMENT - 1) / ALIGNMENT)
+#define NUM_LARGE_BINS 55           // One bin per power of two from 2^9 to 2^63
+#define NUM_BINS (NUM_SMALL_BINS + NUM_LARGE_BINS)
+
+// Free list engines, chosen at initialization
+#define ENGINE_SEGREGATED 0         // Bins above; may search within a large bin (default)
+#define ENGINE_TLSF 1               // Two-level segregated fit; never searches a bin
+#define ENGINE_BUDDY 2              // Power-of-two blocks from a buddy heap; arenas as fallback
+
+// TLSF splits each power of two into TLSF_SL_COUNT equal classes. Sizes
+// below 2^TLSF_FL_SHIFT share the first row, in ALIGNMENT-sized classes.
+#define TLSF_SL_BITS 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_BITS)
+#define TLSF_FL_SHIFT (TLSF_SL_BITS + 3)
+#define TLSF_FL_COUNT (64 - TLSF_FL_SHIFT + 1)
+#define TLSF_BINS (TLSF_FL_COUNT * TLSF_SL_COUNT)
+
+// Placement policies of the segregated engine, switchable at runtime
+#define PLACEMENT_GOOD_FIT 0        // Head of the request's bin, else of the next non-empty bin (default)
+#define PLACEMENT_FIRST_FIT 1       // First fitting block, walking each bin from its head
+#define PLACEMENT_NEXT_FIT 2        // First fit resuming after the previous choice
+#define PLACEMENT_BEST_FIT 3        // Smallest fitting block
+#define PLACEMENT_ADDRESS_FIT 4     // Lowest-addressed fitting block (address-ordered first fit)
+
+#define MAX_BINS (NUM_BINS > TLSF_BINS ? NUM_BINS : TLSF_BINS)
+#define BIN_BITMAP_WORDS ((MAX_BINS + 63) / 64) // At most 64: one summary bit per word
+
+// Arenas are independent heaps; thread-safe mode binds threads to them
+#define MAX_ARENAS 64               // Shared plus private arenas
+#define DEFAULT_ARENAS 8            // Shared arenas in thread-safe mode
+
+typedef struct arena arena_t;
+
+// Per-thread caches of freed small blocks (tcache)
+#define TCACHE_MAX_SIZE 256         // Largest block size kept in a thread cache
+#define TCACHE_CLASSES ((TCACHE_MAX_SIZE - MIN_BLOCK_SIZE) / ALIGNMENT + 1)
+#define TCACHE_CAPACITY 32          // Blocks per class before flushing half
+#define TCACHE_REFILL 16            // Blocks fetched per refill of an empty class
+
+// Slabs: page-sized runs of one small size class with no per-object header
+#define SLAB_SIZE 4096              // Bytes per slab, aligned to its own size
+#define SLAB_MAX_SIZE 256           // Largest object size served from slabs
+#define SLAB_CLASS_STEP 16          // Object size granularity of slab classes
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_CLASS_STEP)
+#define SLAB_REGION_SIZE (4 * 1024 * 1024) // Address space reserved for slabs
+
+// Buddy heap: 2^k-byte blocks that split in halves and merge with their buddy
+#define BUDDY_MIN_ORDER 4           // 16-byte blocks, room for the free-list links
+#define BUDDY_MAX_ORDER 25          // The whole heap is one 32MB block
+#define BUDDY_ORDERS (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1)
+#define BUDDY_HEAP_SIZE ((size_t)1 << BUDDY_MAX_ORDER)
+
+// Options accepted by allocator_init_ex()
+typedef struct allocator_options {
+    int thread_safe;                // Lock the heap so any thread may call in
+    int num_arenas;                 // Shared arenas in thread-safe mode (0 = default)
+    int tcache;                     // Cache freed small blocks per thread
+    int slab;                       // Serve small sizes from slabs
+    int remote_free;                // Hand frees of other threads' blocks over lock-free
+    size_t mmap_threshold;          // Map requests of at least this size directly (0 = default)
+    int purge_decay_ms;             // Delay before purging freed spans (0 = default, or PURGE_*)
+    int engine;                     // Free list engine (ENGINE_*)
+    int placement;                  // Placement policy (PLACEMENT_*)
+    int quiet;                      // Skip the initialization and cleanup messages
+} allocator_options_t;
+
+// Live statistics filled in by my_get_stats()
+#define STATS_SIZE_CLASSES 64       // Class i counts blocks of 2^i to 2^(i+1) - 1 bytes
+
+typedef struct allocator_stats {
+    size_t heap_size;               // As get_heap_size()
+    size_t allocated_bytes;         // As get_total_allocated()
+    size_t free_bytes;              // As get_total_free()
+    size_t peak_allocated;          // Highest allocated_bytes since initialization
+    size_t allocated_blocks;        // Live blocks, including those in thread caches
+    size_t free_blocks;             // As get_fragmentation_count()
+    size_t largest_free_block;      // Largest block on a free list
+    size_t size_classes[STATS_SIZE_CLASSES]; // Live blocks by power-of-two size class
+    unsigned long long malloc_calls;  // Blocks asked of the malloc, aligned, batch and arena calls
+    unsigned long long calloc_calls;
+    unsigned long long realloc_calls;
+    unsigned long long free_calls;    // Pointers passed to my_free() and my_free_batch()
+} allocator_stats_t;
+
+// Allocation traces: a trace_header_t, then one trace_record_t per call in
+// the order the calls took effect
+#define TRACE_MAGIC 0x43525441      // "ATRC" read as a little-endian word
+#define TRACE_VERSION 1
+#define TRACE_MALLOC 1
+#define TRACE_CALLOC 2
+#define TRACE_REALLOC 3
+#define TRACE_FREE 4
+#define TRACE_ALIGNED_ALLOC 5
 
-// External heap for GUI access
-extern char heap[HEAP_SIZE];
+typedef struct trace_header {
+    uint32_t magic;                 // TRACE_MAGIC
+    uint32_t version;               // TRACE_VERSION
+    uint32_t record_size;           // sizeof(trace_record_t)
+    uint32_t reserved;
+} trace_header_t;
+
+typedef struct trace_record {
+    uint64_t timestamp;             // Nanoseconds since recording started
+    uint64_t size;                  // Bytes requested (calloc: num * size)
+    uint64_t id;                    // Address of the block returned or freed (0 for NULL)
+    uint64_t old_id;                // Realloc: address of the block resized (0 for NULL)
+    uint32_t thread;                // Calling thread, numbered in order of its first record
+    uint16_t op;                    // TRACE_*
+    uint16_t align_shift;           // Aligned allocations: log2 of the alignment
+} trace_record_t;
+
+// Heap profiles: allocations are sampled about once per interval bytes, so
+// large blocks are nearly always caught and small ones in proportion
+#define DEFAULT_PROFILE_INTERVAL (512 * 1024) // Mean bytes allocated between samples
+#define PROFILE_MAX_DEPTH 32        // Stack frames kept per sample
+
+// Hot-path instrumentation, compiled in with -DALLOCATOR_INSTRUMENT: cycles
+// and free-list nodes visited per call, in per-thread histograms
+#define PROBE_FIND 0                // find_free_block(): choosing a free block
+#define PROBE_SPLIT 1               // split_block()
+#define PROBE_MERGE 2               // merge_free_blocks() and coalescing on free
+#define PROBE_ADD_FREE 3            // add_to_free_list()
+#define PROBE_REMOVE_FREE 4         // remove_from_free_list()
+#define PROBES 5
+
+// Log-linear histograms: exact below 16, then 4 buckets per power of two
+#define PROBE_HIST_SUB_BITS 2
+#define PROBE_HIST_BUCKETS (16 + (64 - 4) * (1 << PROBE_HIST_SUB_BITS))
+
+typedef struct probe_stats {
+    unsigned long long calls;
+    unsigned long long cycles;      // Summed over all calls
+    unsigned long long nodes;       // Free-list nodes visited, summed over all calls
+    unsigned long long cycle_hist[PROBE_HIST_BUCKETS];
+    unsigned long long node_hist[PROBE_HIST_BUCKETS];
+} probe_stats_t;
+
+// Statistics export: a stats_export_t at the start of a shared file,
+// rewritten under a sequence lock so readers in other processes never
+// block the allocator
+#define STATS_EXPORT_MAGIC 0x58505341 // "ASPX" read as a little-endian word
+#define STATS_EXPORT_VERSION 1
+#define STATS_EXPORT_PREFIX "/dev/shm/allocator." // Default file, followed by the pid
+#define DEFAULT_EXPORT_INTERVAL_MS 10 // Between updates
+#define LATENCY_KINDS 4             // malloc, calloc, realloc and free calls, in that order
+#define LATENCY_SAMPLE_INTERVAL 64  // Calls of a kind per thread for each one timed
+// Latency histograms in nanoseconds, laid out as the probe histograms up to 2^32
+#define LATENCY_BUCKETS (16 + (32 - 4) * (1 << PROBE_HIST_SUB_BITS))
+
+typedef struct stats_export {
+    uint32_t magic;                 // STATS_EXPORT_MAGIC
+    uint32_t version;               // STATS_EXPORT_VERSION
+    uint32_t size;                  // sizeof(stats_export_t)
+    uint32_t pid;                   // Publishing process
+    uint64_t sequence;              // Odd while an update is being written
+    uint64_t updates;               // Updates published so far
+    uint64_t timestamp_ns;          // CLOCK_MONOTONIC time of the last update
+    uint32_t interval_ms;           // Between updates
+    uint32_t reserved;
+    allocator_stats_t stats;        // As my_get_stats()
+    uint64_t latency[LATENCY_KINDS][LATENCY_BUCKETS]; // Timed calls by latency bucket
+} stats_export_t;
+
+// Callback for heap_walk(), called once per block
+typedef void (*heap_visit_fn)(const block_header_t* block, void* context);
 
 // Memory allocator functions
 void* my_malloc(size_t size);
@@ -27,13 +213,70 @@ void my_free(void* ptr);
 void* my_realloc(void* ptr, size_t size);
 void* my_calloc(size_t num, size_t size);
 
+// Aligned allocation; alignments must be powers of two
+void* my_aligned_alloc(size_t alignment, size_t size);
+int my_posix_memalign(void** memptr, size_t alignment, size_t size);
+void* my_memalign(size_t alignment, size_t size);
+void* my_aligned_realloc(void* ptr, size_t alignment, size_t size);
+
+// Batch allocation of equal-sized blocks, and batch free of any blocks
+size_t my_malloc_batch(size_t size, size_t count, void** out_ptrs);
+void my_free_batch(void** ptrs, size_t count);
+
+// Ownership and usable size of a pointer, for mixing with other allocators
+int my_owns(const void* ptr);
+size_t my_usable_size(const void* ptr);
+
+// Private arenas: allocate explicitly, release with my_free() or all at once
+arena_t* arena_create(size_t size);
+void arena_destroy(arena_t* arena);
+void* arena_malloc(arena_t* arena, size_t size);
+size_t arena_get_allocated(const arena_t* arena);
+size_t arena_get_free(const arena_t* arena);
+
+// Placement policy of the segregated engine; TLSF and buddy blocks ignore it
+int my_set_placement_policy(int policy);
+int my_get_placement_policy(void);
+
 // Utility functions
 void allocator_init(void);
+void allocator_init_ex(const allocator_options_t* options);
+void allocator_flush_thread_cache(void);
 void allocator_cleanup(void);
+void allocator_fork_prepare(void);
+void allocator_fork_release(void);
 void print_heap_status(void);
+size_t get_heap_size(void);
+void heap_walk(heap_visit_fn visit, void* context);
 size_t get_total_allocated(void);
 size_t get_total_free(void);
+size_t get_largest_free_block(void);
+size_t get_resident_bytes(void);
+size_t get_dirty_bytes(void);
+size_t get_purged_bytes(void);
+size_t my_trim(void);
 int get_fragmentation_count(void);
+void my_get_stats(allocator_stats_t* stats);
+
+// Record every public allocation call to a trace file until stopped
+int my_trace_start(const char* path);
+void my_trace_stop(void);
+
+// Sample allocations with their call stacks, and dump the live and
+// cumulative samples as a pprof heap profile
+int my_profile_start(size_t interval);
+int my_profile_dump(const char* path);
+void my_profile_stop(void);
+
+// Hot-path instrumentation totals of every thread; returns 0 (and zeroes
+// `stats`) unless built with -DALLOCATOR_INSTRUMENT
+int my_get_probe_stats(probe_stats_t stats[PROBES]);
+void print_probe_report(void);
+
+// Publish live statistics to a shared file every interval_ms (0 for the
+// default) until stopped; a NULL path means STATS_EXPORT_PREFIX<pid>
+int my_stats_export_start(const char* path, int interval_ms);
+void my_stats_export_stop(void);
 
 // Internal helper functions (for testing and debugging)
 void merge_free_blocks(void);
@@ -41,6 +284,7 @@ block_header_t* split_block(block_header_t* block, size_t size);
 block_header_t* find_free_block(size_t size);
 void add_to_free_list(block_header_t* block);
 void remove_from_free_list(block_header_t* block);
+size_t bin_index(size_t size);
 
 // Memory alignment utility
 size_t align_size(size_t size);
@@ -0,0 +1,54 @@
+#ifndef TRACE_TOOLS_H
+#define TRACE_TOOLS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "allocator.h"
+
+// Shared by the tools that consume allocation traces: a chunked reader, a
+// map from recorded block addresses to live blocks, and engine selection.
+
+#define TRACE_READ_RECORDS 4096     // Records read from a trace at a time
+
+typedef struct {
+    FILE* file;
+    trace_record_t* records;        // The chunk last read
+    unsigned long long total;       // Records in the whole trace
+} trace_reader_t;
+
+// A live block, keyed by the address it had when recorded
+typedef struct {
+    uint64_t key;                   // Recorded address; 0 empty, 1 deleted
+    void* ptr;                      // The block standing in for it
+    size_t requested;               // Bytes asked for
+    size_t usable;                  // Bytes the allocator set aside for them
+} live_entry_t;
+
+typedef struct {
+    live_entry_t* entries;
+    size_t capacity;                // A power of two
+    size_t used;                    // Live plus deleted entries
+    size_t live;
+} live_map_t;
+
+// Open a trace and check its header; prints an error and returns 0 on failure
+int trace_open(trace_reader_t* reader, const char* path);
+// Read the next chunk into reader->records; returns its record count, 0 at the end
+size_t trace_read(trace_reader_t* reader);
+void trace_close(trace_reader_t* reader);
+
+int live_init(live_map_t* map, size_t capacity);
+live_entry_t* live_find(live_map_t* map, uint64_t key);
+// Add a block; returns its entry, or NULL if the map cannot grow
+live_entry_t* live_insert(live_map_t* map, uint64_t key, void* ptr);
+void live_remove(live_map_t* map, live_entry_t* entry);
+
+// Initialize this allocator with the engine named segregated, tlsf or buddy;
+// returns 0 for any other name
+int start_engine(const char* name);
+
+// Memory straight from the OS, so a tool's own tables weigh the same on
+// every allocator it measures
+void* tool_map(size_t size);
+
+#endif // TRACE_TOOLS_H
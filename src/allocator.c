@@ -1,338 +1,4269 @@
+#define _GNU_SOURCE
 #include "../include/allocator.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+#if defined(ALLOCATOR_INSTRUMENT) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// A region is one REGION_ALIGN-aligned mapping obtained from the OS. Its
+// descriptor sits at the front, followed by blocks and a zero-size fence
+// header that is never free, so coalescing stops at the region's end.
+typedef struct region {
+    struct region* next;                     // Next region of the same arena, or next huge mapping
+    struct region* prev;                     // Previous huge mapping (huge mappings only)
+    arena_t* arena;                          // Arena owning the region's blocks (NULL if huge)
+    char* start;                             // First block
+    char* end;                               // Fence header after the last block
+    size_t mapped_size;                      // Bytes mapped, including this descriptor
+} region_t;
+
+// An arena is an independent heap with its own regions, bins, counters and
+// lock. Blocks never span or coalesce across regions.
+struct arena {
+    region_t* regions;                       // Regions owned by the arena, newest first
+    block_header_t* free_bins[MAX_BINS];     // Segregated free lists
+    uint64_t bin_bitmap[BIN_BITMAP_WORDS];   // Bit set for each non-empty bin
+    uint64_t bin_summary;                    // Bit set for each non-zero bitmap word
+    size_t bin_largest[MAX_BINS];            // Size of the largest block in each bin (0 if empty)
+    block_header_t* rover;                   // Where the next next-fit search resumes
+    size_t allocated;                        // Bytes allocated from this arena
+    size_t free;                             // Free payload bytes in this arena
+    size_t heap_size;                        // Bytes mapped for the arena's regions
+    size_t purged;                           // Bytes of free pages returned to the OS
+    long long dirty_since;                   // When the oldest unpurged large span was freed (ms)
+    unsigned int purge_ticks;                // Frees since the decay clock was last read
+    pthread_mutex_t lock;                    // Guards the regions, bins, headers and counters
+    size_t mapped_size;                      // Size of the descriptor mapping (0 for arena 0)
+    int slot;                                // Index in the arena table
+    int is_private;                          // Created by arena_create(), skipped by my_malloc()
+    size_t free_blocks;                      // Blocks on the free lists
+    size_t blocks;                           // Allocated blocks
+    size_t size_classes[STATS_SIZE_CLASSES]; // Allocated blocks by power-of-two size class
+    block_header_t* remote_frees;            // Blocks other threads freed, pushed without the lock
+};
+
+// Address-to-region map: a two-level radix table indexed by the
+// REGION_ALIGN-sized chunk an address falls in. Leaves are mapped on demand.
+#define MAP_ADDRESS_BITS 48
+#define MAP_LEAF_BITS 14
+#define MAP_ROOT_SIZE ((size_t)1 << (MAP_ADDRESS_BITS - REGION_SHIFT - MAP_LEAF_BITS))
+#define MAP_LEAF_SIZE ((size_t)1 << MAP_LEAF_BITS)
+
+// Descriptor, first block header and fence header of every region
+#define REGION_OVERHEAD (align_size(sizeof(region_t)) + 2 * HEADER_SIZE)
+
+// A huge block is the only block of its own mapping: a region descriptor,
+// one block header and the payload, with no fence. Aligned huge blocks place
+// their header further in, so the payload lands on the alignment.
+#define HUGE_OVERHEAD (align_size(sizeof(region_t)) + HEADER_SIZE)
+#define PAGE_SIZE_BYTES 4096
+
+// Per-thread cache of freed small blocks, one LIFO list per exact size.
+// Cached blocks stay allocated as far as the heap is concerned.
+typedef struct thread_cache {
+    block_header_t* heads[TCACHE_CLASSES];   // Cached blocks, linked through next
+    int counts[TCACHE_CLASSES];              // Blocks in each list
+    unsigned int generation;                 // Heap generation of the cached blocks
+    int registered;                          // Thread-exit drain is installed
+} thread_cache_t;
+
+#define TCACHE_CLASS(size) (((size) - MIN_BLOCK_SIZE) / ALIGNMENT)
+
+#define SLAB_BITMAP_WORDS ((SLAB_SIZE / SLAB_CLASS_STEP + 63) / 64)
+
+// A slab is one SLAB_SIZE page of equal-sized objects. Its descriptor sits at
+// the front of the page, so the slab owning an object is found by masking the
+// object's address and the objects themselves carry no header.
+typedef struct slab {
+    struct slab* next;                       // Next slab in the partial list or empty pool
+    struct slab* prev;                       // Previous slab in the partial list
+    uint64_t free_map[SLAB_BITMAP_WORDS];    // Bit set for each free object
+    char* objects;                           // First object
+    uint32_t object_size;                    // Size of every object (0 while pooled)
+    uint32_t capacity;                       // Objects that fit after the descriptor
+    uint32_t free_count;                     // Objects currently free
+    uint32_t cls;                            // Size class index
+} slab_t;
+
+// The slabs of one size class that still have free objects
+typedef struct slab_class {
+    slab_t* partial;                         // Slabs with at least one free object
+    pthread_mutex_t lock;                    // Guards the list, slab bitmaps and counters
+    size_t allocated;                        // Bytes of objects handed out
+    size_t free;                             // Bytes of free objects in this class's slabs
+} slab_class_t;
+
+#define SLAB_CLASS(size) (((size) - 1) / SLAB_CLASS_STEP)
+
+// A free buddy block holds only its list links. Whether a block is free or
+// split lives in per-order bitmaps, so allocated blocks carry no header.
+typedef struct buddy_node {
+    struct buddy_node* next;
+    struct buddy_node* prev;
+} buddy_node_t;
+#define SLAB_DESCRIPTOR_SIZE ((sizeof(slab_t) + SLAB_CLASS_STEP - 1) & ~(size_t)(SLAB_CLASS_STEP - 1))
+
+// Arena counters are only written under the arena lock. Relaxed atomic
+// stores let get_total_allocated()/get_total_free() sum them without locking.
+#define STAT_ADD(counter, amount) __atomic_store_n(&(counter), (counter) + (amount), __ATOMIC_RELAXED)
+#define STAT_SUB(counter, amount) __atomic_store_n(&(counter), (counter) - (amount), __ATOMIC_RELAXED)
+#define STAT_PEAK(peak, value) \
+    do { \
+        if ((value) > (peak)) { \
+            __atomic_store_n(&(peak), (value), __ATOMIC_RELAXED); \
+        } \
+    } while (0)
+
+// Heaps' allocated byte counters also move the allocator-wide total, whose
+// high-water mark is the peak my_get_stats() reports
+#define ALLOCATED_ADD(counter, amount) \
+    do { \
+        STAT_ADD(counter, amount); \
+        total_allocated_add(amount); \
+    } while (0)
+#define ALLOCATED_SUB(counter, amount) \
+    do { \
+        STAT_SUB(counter, amount); \
+        total_allocated_sub(amount); \
+    } while (0)
+
+// Records buffered before a trace is written out
+#define TRACE_BUFFER_RECORDS 8192
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Heap profiling
+#define PROFILE_BUCKETS 4096             // Call stacks kept; later ones share bucket 0
+#define PROFILE_INITIAL_SAMPLES 1024     // Sampled blocks tracked before the table grows
+#define PROFILE_FILTER_BITS 14           // Counters screening frees for sampled blocks
+#define PROFILE_FILTER_SIZE ((size_t)1 << PROFILE_FILTER_BITS)
+#define PROFILE_HASH(ptr) (((uint64_t)(uintptr_t)(ptr) >> 4) * 0x9E3779B97F4A7C15ULL)
+#define PROFILE_FILTER_SLOT(ptr) ((size_t)(PROFILE_HASH(ptr) >> (64 - PROFILE_FILTER_BITS)))
+
+// Public calls counted for my_get_stats()
+#define OP_MALLOC 0
+#define OP_CALLOC 1
+#define OP_REALLOC 2
+#define OP_FREE 3
+#define OP_KINDS 4
+#define OP_STRIPES 16 // Copies of the call counters, spread over threads
+
+// One copy of the call counters, padded to its own cache line so threads
+// counting on different stripes do not contend
+typedef struct op_stripe {
+    unsigned long long calls[OP_KINDS];
+    char pad[64 - OP_KINDS * sizeof(unsigned long long)];
+} op_stripe_t;
+
+// Probes and timed calls of one thread. Only the owner writes its counters,
+// so the relaxed stores of STAT_ADD are enough and no call takes a lock.
+typedef struct op_counts {
+#ifdef ALLOCATOR_INSTRUMENT
+    probe_stats_t probes[PROBES];
+    unsigned long long nodes_visited;        // Free-list nodes looked at, for the probes
+#endif
+    unsigned long long latency[LATENCY_KINDS][LATENCY_BUCKETS]; // Calls timed for the export
+    int latency_countdown[LATENCY_KINDS];    // Calls of each kind before the next one is timed
+    struct op_counts* next;                  // Next registered thread
+    struct op_counts* prev;
+    int registered;                          // Linked in, with its thread-exit fold installed
+} op_counts_t;
+
+// Samples of the heap profile taken at one call stack
+typedef struct profile_bucket {
+    void* frames[PROFILE_MAX_DEPTH];
+    int depth;
+    unsigned long long allocs;               // Blocks sampled
+    unsigned long long alloc_bytes;
+    unsigned long long frees;                // Sampled blocks freed since
+    unsigned long long free_bytes;
+} profile_bucket_t;
+
+// A sampled block not yet freed
+typedef struct profile_sample {
+    uintptr_t ptr;                           // 0 for an empty entry, 1 for a deleted one
+    size_t size;                             // Bytes requested
+    uint32_t bucket;
+} profile_sample_t;
 
 // Global variables
-char heap[HEAP_SIZE];                  // Static heap memory (exposed for GUI)
-static block_header_t* free_list_head; // Head of free blocks list
+static arena_t main_arena;             // Arena 0, the default heap
+static region_t*** region_map = NULL;  // Root of the address-to-region map
+static pthread_mutex_t region_map_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD; // Smallest directly mapped request
+static region_t* huge_list = NULL;     // Every live huge mapping
+static pthread_mutex_t huge_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t huge_allocated = 0;      // Payload bytes of live huge blocks
+static size_t huge_mapped = 0;         // Bytes mapped for live huge blocks
+static size_t total_allocated = 0;     // Bytes allocated from every heap
+static size_t total_peak = 0;          // Highest value of total_allocated
+static int purge_decay_ms = DEFAULT_PURGE_DECAY_MS; // Delay before purging, or PURGE_*
+static int engine = ENGINE_SEGREGATED; // Free list engine
+static int placement_policy = PLACEMENT_GOOD_FIT; // Read under each arena's lock
+static arena_t* arena_table[MAX_ARENAS]; // Every live arena, shared ones first
+static int arena_slots = 0;            // High-water mark of arena_table
+static int num_shared_arenas = 1;      // Arenas my_malloc() assigns threads to
+static int thread_safe = 0;            // Take arena locks on every operation
 static int allocator_initialized = 0;  // Initialization flag
-static size_t total_allocated = 0;     // Total allocated memory
-static size_t total_free = HEAP_SIZE;  // Total free memory
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static int next_home_arena = 0;        // Round-robin arena assignment
+static __thread int home_arena = -1;   // Arena this thread is bound to
+static int tcache_enabled = 0;         // Serve small sizes from thread caches
+static int remote_free_enabled = 0;    // Queue frees of other arenas' blocks to their owners
+static int quiet = 0;                  // Skip the initialization and cleanup messages
+static unsigned int heap_generation = 0; // Bumped on every initialization
+static pthread_key_t tcache_key;       // Drains the cache when a thread exits
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static __thread thread_cache_t thread_cache;
+static int slab_enabled = 0;           // Serve small sizes from slabs
+static char* slab_region = NULL;       // Reserved address range holding every slab
+static char* slab_region_top = NULL;   // First slab never handed out
+static slab_t* slab_pool = NULL;       // Empty slabs available to any class
+static pthread_mutex_t slab_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static slab_class_t slab_classes[SLAB_CLASSES];
+static char* buddy_heap = NULL;        // Reserved buddy heap, or NULL unless ENGINE_BUDDY
+static uint64_t* buddy_free_map[BUDDY_ORDERS];  // Per order, bit set for each free block
+static uint64_t* buddy_split_map[BUDDY_ORDERS]; // Per order, bit set for each split block
+static buddy_node_t* buddy_lists[BUDDY_ORDERS]; // Free blocks of each order
+static uint32_t buddy_nonempty = 0;    // Bit set for each order with a free block
+static void* buddy_maps = NULL;        // Mapping holding every bitmap
+static size_t buddy_maps_size = 0;
+static size_t buddy_allocated = 0;     // Bytes of buddy blocks handed out
+static size_t buddy_free_blocks = 0;   // Blocks on the buddy free lists
+static pthread_mutex_t buddy_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t buddy_blocks[BUDDY_ORDERS]; // Allocated buddy blocks of each order
+static size_t huge_size_classes[STATS_SIZE_CLASSES]; // Live huge blocks by size class
+static __thread op_counts_t thread_ops;
+static op_counts_t* op_counts_list = NULL; // Every thread that has made a call
+static op_stripe_t op_calls[OP_STRIPES]; // Calls of every thread, summed by op_totals()
+static int next_op_stripe = 0;         // Round-robin stripe assignment
+static __thread int op_stripe = -1;    // Stripe this thread counts on
+static unsigned long long ops_baseline[OP_KINDS]; // Calls made before the last initialization
+#ifdef ALLOCATOR_INSTRUMENT
+static probe_stats_t retired_probes[PROBES]; // Probes of threads that have exited
+#endif
+static unsigned long long retired_latency[LATENCY_KINDS][LATENCY_BUCKETS]; // Timed calls of exited threads
+static int exporting = 0;              // Time calls and publish statistics to export_map
+static stats_export_t* export_map = NULL; // Shared mapping of the export file
+static char export_path[256];
+static int export_interval_ms = DEFAULT_EXPORT_INTERVAL_MS;
+static pthread_t export_thread;
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER; // Wakes the publisher to stop
+static pthread_cond_t export_wake = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t op_counts_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t op_counts_key;    // Folds a thread's probes and timings in at exit
+static pthread_once_t op_counts_key_once = PTHREAD_ONCE_INIT;
+static int tracing = 0;                // Record public calls with trace_event()
+static int trace_fd = -1;              // Trace file while recording
+static trace_record_t* trace_buffer = NULL; // Records not yet written out
+static size_t trace_count = 0;
+static long long trace_start_ns = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; // Orders records, guards the buffer
+static uint32_t next_trace_thread = 0;
+static __thread int trace_thread = -1; // Number of this thread in the trace
+static int profiling = 0;              // Record sampled allocations in the heap profile
+static size_t profile_interval = DEFAULT_PROFILE_INTERVAL; // Mean bytes between samples
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the tables below
+static profile_bucket_t* profile_buckets = NULL; // Bucket 0 takes stacks that find no room
+static size_t profile_num_buckets = 0;
+static uint32_t* profile_bucket_table = NULL; // Stack hash to bucket number plus one
+static profile_sample_t* profile_samples = NULL; // Sampled blocks by address
+static size_t profile_capacity = 0;    // A power of two
+static size_t profile_used = 0;        // Live plus deleted entries
+static size_t profile_live = 0;
+static uint32_t profile_filter[PROFILE_FILTER_SIZE]; // Sampled blocks hashing to each slot
+static __thread long long sample_countdown = 0; // Bytes this thread allocates before its next sample
+static __thread uint64_t sample_random = 0; // State of this thread's sampling intervals, 0 until seeded
 
-// Initialize the allocator
-void allocator_init(void) {
-    if (allocator_initialized) {
-        return;
+// Stored in the prev link of cached blocks to catch double frees
+#define TCACHE_MARK ((block_header_t*)&tcache_key)
+
+// Marks a block waiting on an arena's remote free list, in its prev link
+#define REMOTE_MARK ((block_header_t*)&remote_free_enabled)
+
+static void arena_add_free(arena_t* arena, block_header_t* block);
+static int buddy_setup(void);
+static void* arena_allocate(arena_t* arena, size_t size, size_t alignment);
+static void arena_drain_remote(arena_t* arena);
+
+// Map zeroed, read-write memory from the OS
+static void* os_map(size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+#endif
+}
+
+// Return memory obtained with os_map() or os_map_aligned()
+static void os_unmap(void* ptr, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, size);
+#endif
+}
+
+// Map memory starting at a multiple of `alignment` (a power of two)
+static void* os_map_aligned(size_t size, size_t alignment) {
+#ifdef _WIN32
+    // Reserve an oversized range to find an aligned address, then map exactly
+    // there; another thread may take it in between, so retry a few times
+    for (int attempt = 0; attempt < 8; attempt++) {
+        char* probe = (char*)VirtualAlloc(NULL, size + alignment, MEM_RESERVE, PAGE_NOACCESS);
+        if (probe == NULL) {
+            return NULL;
+        }
+        char* aligned = (char*)(((uintptr_t)probe + alignment - 1) & ~(uintptr_t)(alignment - 1));
+        VirtualFree(probe, 0, MEM_RELEASE);
+        void* ptr = VirtualAlloc(aligned, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    return NULL;
+#else
+    // Over-map, then trim the unaligned head and the excess tail
+    char* base = (char*)os_map(size + alignment);
+    if (base == NULL) {
+        return NULL;
+    }
+    char* aligned = (char*)(((uintptr_t)base + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    if (aligned > base) {
+        munmap(base, (size_t)(aligned - base));
+    }
+    size_t tail = (size_t)(base + size + alignment - (aligned + size));
+    if (tail > 0) {
+        munmap(aligned + size, tail);
     }
+    return aligned;
+#endif
+}
+
+// Drop the contents of whole pages, keeping the range mapped
+static void os_purge(void* ptr, size_t size) {
+#ifdef _WIN32
+    VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise(ptr, size, MADV_DONTNEED);
+#endif
+}
+
+// Milliseconds on a monotonic clock
+static long long now_ms(void) {
+#ifdef _WIN32
+    return (long long)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+// Nanoseconds on a monotonic clock
+static long long now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (long long)((double)counter.QuadPart * 1e9 / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+// Round a size up to a block size: with its header, a multiple of ALIGNMENT
+size_t align_size(size_t size) {
+    return ((size + HEADER_SIZE + ALIGNMENT - 1) & ~(ALIGNMENT - 1)) - HEADER_SIZE;
+}
+
+// Make sure map leaves exist for every chunk of [base, base + size)
+static int region_map_reserve(const void* base, size_t size) {
+    uintptr_t first = (uintptr_t)base >> REGION_SHIFT;
+    uintptr_t last = ((uintptr_t)base + size - 1) >> REGION_SHIFT;
+    int ok = 1;
     
-    // Initialize the first free block covering the entire heap
-    free_list_head = (block_header_t*)heap;
-    free_list_head->size = HEAP_SIZE - HEADER_SIZE;
-    free_list_head->is_free = 1;
-    free_list_head->next = NULL;
-    free_list_head->prev = NULL;
+    pthread_mutex_lock(&region_map_lock);
+    if (region_map == NULL) {
+        __atomic_store_n(&region_map, (region_t***)os_map(MAP_ROOT_SIZE * sizeof(region_t**)), __ATOMIC_RELEASE);
+    }
     
-    total_allocated = 0;
-    total_free = HEAP_SIZE - HEADER_SIZE;
-    allocator_initialized = 1;
+    for (uintptr_t chunk = first; chunk <= last; chunk++) {
+        if (region_map == NULL || (chunk >> MAP_LEAF_BITS) >= MAP_ROOT_SIZE) {
+            ok = 0;
+            break;
+        }
+        if (region_map[chunk >> MAP_LEAF_BITS] == NULL) {
+            region_t** leaf = (region_t**)os_map(MAP_LEAF_SIZE * sizeof(region_t*));
+            if (leaf == NULL) {
+                ok = 0;
+                break;
+            }
+            __atomic_store_n(&region_map[chunk >> MAP_LEAF_BITS], leaf, __ATOMIC_RELEASE);
+        }
+    }
     
-    printf("Memory allocator initialized with %zu bytes\n", HEAP_SIZE);
+    pthread_mutex_unlock(&region_map_lock);
+    return ok;
 }
 
-// Align size to the specified alignment boundary
-size_t align_size(size_t size) {
-    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+// Point every chunk of [base, base + size) at `value` (a region or NULL).
+// Leaves must have been reserved before a non-NULL value is stored.
+static void region_map_set(const void* base, size_t size, region_t* value) {
+    uintptr_t first = (uintptr_t)base >> REGION_SHIFT;
+    uintptr_t last = ((uintptr_t)base + size - 1) >> REGION_SHIFT;
+    
+    for (uintptr_t chunk = first; chunk <= last; chunk++) {
+        region_t** leaf = __atomic_load_n(&region_map[chunk >> MAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+        if (leaf != NULL) {
+            __atomic_store_n(&leaf[chunk & (MAP_LEAF_SIZE - 1)], value, __ATOMIC_RELEASE);
+        }
+    }
 }
 
-// Find a free block that can accommodate the requested size
-block_header_t* find_free_block(size_t size) {
-    // First check if we have any free blocks at all
-    if (free_list_head == NULL) {
+// Find the region whose mapping contains an address, or NULL
+static region_t* region_of(const void* ptr) {
+    uintptr_t chunk = (uintptr_t)ptr >> REGION_SHIFT;
+    region_t*** root = __atomic_load_n(&region_map, __ATOMIC_ACQUIRE);
+    if (root == NULL || (chunk >> MAP_LEAF_BITS) >= MAP_ROOT_SIZE) {
+        return NULL;
+    }
+    
+    region_t** leaf = __atomic_load_n(&root[chunk >> MAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+    if (leaf == NULL) {
+        return NULL;
+    }
+    return __atomic_load_n(&leaf[chunk & (MAP_LEAF_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+// Map a new region able to hold a block of `size` bytes and add its space
+// to the arena as one free block (caller holds the arena lock)
+static region_t* arena_grow(arena_t* arena, size_t size) {
+    if (size > SIZE_MAX - REGION_OVERHEAD - REGION_ALIGN) {
+        return NULL;
+    }
+    size_t mapped_size = (size + REGION_OVERHEAD + REGION_ALIGN - 1) & ~(REGION_ALIGN - 1);
+    if (mapped_size < REGION_SIZE) {
+        mapped_size = REGION_SIZE;
+    }
+    
+    char* base = (char*)os_map_aligned(mapped_size, REGION_ALIGN);
+    if (base == NULL) {
+        return NULL;
+    }
+    
+    region_t* region = (region_t*)base;
+    region->arena = arena;
+    region->mapped_size = mapped_size;
+    region->start = base + align_size(sizeof(region_t));
+    region->end = base + mapped_size - HEADER_SIZE;
+    
+    if (!region_map_reserve(base, mapped_size)) {
+        os_unmap(base, mapped_size);
         return NULL;
     }
+    region_map_set(base, mapped_size, region);
+    
+    // The first block of a region never has BLOCK_PREV_FREE set, so
+    // coalescing stops at the region's start. Fresh pages are not resident.
+    size_t first_size = (size_t)(region->end - region->start) - HEADER_SIZE;
+    block_header_t* first_block = (block_header_t*)region->start;
+    first_block->size = first_size | BLOCK_FREE | BLOCK_PURGED;
+    *(size_t*)(region->end - sizeof(size_t)) = first_size;
+    
+    block_header_t* fence = (block_header_t*)region->end;
+    fence->size = BLOCK_PREV_FREE;
+    
+    region->next = arena->regions;
+    arena->regions = region;
+    arena_add_free(arena, first_block);
+    STAT_ADD(arena->free, first_size);
+    STAT_ADD(arena->heap_size, mapped_size);
+    
+    return region;
+}
+
+// Move the allocator-wide allocated total. Heaps change it under their own
+// locks, so with several of them it needs atomic updates; a CAS loop keeps
+// the high-water mark.
+static void total_allocated_add(size_t bytes) {
+    size_t total;
+    if (!thread_safe) {
+        total = total_allocated + bytes;
+        STAT_ADD(total_allocated, bytes);
+    } else {
+        total = __atomic_add_fetch(&total_allocated, bytes, __ATOMIC_RELAXED);
+    }
+    size_t peak = __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+    while (total > peak &&
+           !__atomic_compare_exchange_n(&total_peak, &peak, total, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void total_allocated_sub(size_t bytes) {
+    if (!thread_safe) {
+        STAT_SUB(total_allocated, bytes);
+    } else {
+        __atomic_sub_fetch(&total_allocated, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+// Reset an arena and give it a first region of at least `size` bytes
+static int arena_setup(arena_t* arena, size_t size) {
+    arena->regions = NULL;
+    memset(arena->free_bins, 0, sizeof(arena->free_bins));
+    memset(arena->bin_bitmap, 0, sizeof(arena->bin_bitmap));
+    arena->bin_summary = 0;
+    memset(arena->bin_largest, 0, sizeof(arena->bin_largest));
+    arena->rover = NULL;
+    arena->free_blocks = 0;
+    arena->blocks = 0;
+    memset(arena->size_classes, 0, sizeof(arena->size_classes));
+    arena->remote_frees = NULL;
+    arena->allocated = 0;
+    arena->free = 0;
+    arena->heap_size = 0;
+    arena->purged = 0;
+    arena->dirty_since = 0;
+    arena->purge_ticks = 0;
+    arena->is_private = 0;
+    pthread_mutex_init(&arena->lock, NULL);
+    
+    if (arena_grow(arena, size) == NULL) {
+        pthread_mutex_destroy(&arena->lock);
+        return 0;
+    }
+    return 1;
+}
+
+// Map a new arena descriptor and its first region
+static arena_t* arena_map(size_t size) {
+    size_t page_size = 4096;
+    size_t mapped_size = (sizeof(arena_t) + page_size - 1) & ~(page_size - 1);
     
-    block_header_t* current = free_list_head;
+    arena_t* arena = (arena_t*)os_map(mapped_size);
+    if (arena == NULL) {
+        return NULL;
+    }
     
-    while (current != NULL) {
-        if (current->is_free && current->size >= size) {
-            return current;
+    arena->mapped_size = mapped_size;
+    if (!arena_setup(arena, size)) {
+        os_unmap(arena, mapped_size);
+        return NULL;
+    }
+    return arena;
+}
+
+// Publish an arena in the first free table slot (caller holds init_lock)
+static int arena_register(arena_t* arena) {
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        if (arena_table[i] == NULL) {
+            arena->slot = i;
+            __atomic_store_n(&arena_table[i], arena, __ATOMIC_RELEASE);
+            if (i >= arena_slots) {
+                __atomic_store_n(&arena_slots, i + 1, __ATOMIC_RELEASE);
+            }
+            return 1;
         }
-        current = current->next;
     }
+    return 0;
+}
+
+// Give an arena's regions and descriptor back to the OS
+static void arena_unmap(arena_t* arena) {
+    region_t* region = arena->regions;
+    while (region != NULL) {
+        region_t* next = region->next;
+        region_map_set(region, region->mapped_size, NULL);
+        os_unmap(region, region->mapped_size);
+        region = next;
+    }
+    arena->regions = NULL;
     
-    return NULL; // No suitable block found
+    pthread_mutex_destroy(&arena->lock);
+    if (arena->mapped_size != 0) {
+        os_unmap(arena, arena->mapped_size);
+    }
 }
 
-// Split a block if it's larger than needed
-block_header_t* split_block(block_header_t* block, size_t size) {
-    if (block->size <= size + HEADER_SIZE + MIN_BLOCK_SIZE) {
-        // Block is too small to split
+// Remove an arena from the table and give its memory back
+static void arena_release(arena_t* arena) {
+    __atomic_store_n(&arena_table[arena->slot], NULL, __ATOMIC_RELEASE);
+    total_allocated_sub(arena->allocated);
+    arena_unmap(arena);
+}
+
+// Find the arena that owns a block address, or NULL if no arena does
+static arena_t* arena_of(const void* ptr) {
+    region_t* region = region_of(ptr);
+    if (region == NULL || (const char*)ptr < region->start || (const char*)ptr >= region->end) {
         return NULL;
     }
+    return region->arena;
+}
+
+#ifdef ALLOCATOR_INSTRUMENT
+static unsigned long long read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (unsigned long long)now_ns();
+#endif
+}
+
+// Add one thread's probe totals to a sum
+static void probe_stats_add(probe_stats_t* sum, const probe_stats_t* stats) {
+    sum->calls += __atomic_load_n(&stats->calls, __ATOMIC_RELAXED);
+    sum->cycles += __atomic_load_n(&stats->cycles, __ATOMIC_RELAXED);
+    sum->nodes += __atomic_load_n(&stats->nodes, __ATOMIC_RELAXED);
+    for (int i = 0; i < PROBE_HIST_BUCKETS; i++) {
+        sum->cycle_hist[i] += __atomic_load_n(&stats->cycle_hist[i], __ATOMIC_RELAXED);
+        sum->node_hist[i] += __atomic_load_n(&stats->node_hist[i], __ATOMIC_RELAXED);
+    }
+}
+#endif
+
+// Histogram bucket of a value: exact below 16, then PROBE_HIST_SUB_BITS
+// bits below the leading one
+static size_t probe_bucket(unsigned long long value) {
+    if (value < 16) {
+        return (size_t)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    size_t sub = (size_t)(value >> (exponent - PROBE_HIST_SUB_BITS)) & ((1 << PROBE_HIST_SUB_BITS) - 1);
+    return 16 + (size_t)(exponent - 4) * (1 << PROBE_HIST_SUB_BITS) + sub;
+}
+
+#ifdef ALLOCATOR_INSTRUMENT
+// Smallest value falling in a bucket
+static unsigned long long probe_bucket_floor(size_t bucket) {
+    if (bucket < 16) {
+        return bucket;
+    }
+    size_t exponent = (bucket - 16) / (1 << PROBE_HIST_SUB_BITS) + 4;
+    size_t sub = (bucket - 16) % (1 << PROBE_HIST_SUB_BITS);
+    return (1ULL << exponent) + ((unsigned long long)sub << (exponent - PROBE_HIST_SUB_BITS));
+}
+
+// Smallest value in the bucket holding a given fraction of the calls
+static unsigned long long probe_percentile(const unsigned long long* hist, unsigned long long calls, double fraction) {
+    unsigned long long rank = (unsigned long long)(calls * fraction);
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < PROBE_HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > rank) {
+            return probe_bucket_floor(i);
+        }
+    }
+    return 0;
+}
+#endif
+
+// Fold an exiting thread's probes and timed calls into the retired totals
+static void op_counts_thread_exit(void* arg) {
+    op_counts_t* counts = (op_counts_t*)arg;
+    pthread_mutex_lock(&op_counts_lock);
+#ifdef ALLOCATOR_INSTRUMENT
+    for (int probe = 0; probe < PROBES; probe++) {
+        probe_stats_add(&retired_probes[probe], &counts->probes[probe]);
+    }
+    memset(counts->probes, 0, sizeof(counts->probes));
+#endif
+    for (int kind = 0; kind < LATENCY_KINDS; kind++) {
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+            retired_latency[kind][i] += counts->latency[kind][i];
+        }
+    }
+    memset(counts->latency, 0, sizeof(counts->latency));
+    if (counts->prev != NULL) {
+        counts->prev->next = counts->next;
+    } else {
+        op_counts_list = counts->next;
+    }
+    if (counts->next != NULL) {
+        counts->next->prev = counts->prev;
+    }
+    pthread_mutex_unlock(&op_counts_lock);
+    counts->registered = 0;
+}
+
+static void create_op_counts_key(void) {
+    pthread_key_create(&op_counts_key, op_counts_thread_exit);
+}
+
+// The calling thread's counters, linked in on first use
+static op_counts_t* thread_counts(void) {
+    op_counts_t* counts = &thread_ops;
+    if (!counts->registered) {
+        pthread_once(&op_counts_key_once, create_op_counts_key);
+        pthread_setspecific(op_counts_key, counts);
+        pthread_mutex_lock(&op_counts_lock);
+        counts->prev = NULL;
+        counts->next = op_counts_list;
+        if (op_counts_list != NULL) {
+            op_counts_list->prev = counts;
+        }
+        op_counts_list = counts;
+        pthread_mutex_unlock(&op_counts_lock);
+        counts->registered = 1;
+    }
+    return counts;
+}
+
+// Count `n` public calls of one kind made by the calling thread
+static void count_ops(int op, unsigned long long n) {
+    if (op_stripe < 0) {
+        op_stripe = __atomic_fetch_add(&next_op_stripe, 1, __ATOMIC_RELAXED) % OP_STRIPES;
+    }
+    if (thread_safe) {
+        __atomic_fetch_add(&op_calls[op_stripe].calls[op], n, __ATOMIC_RELAXED);
+    } else {
+        STAT_ADD(op_calls[op_stripe].calls[op], n);
+    }
+}
+
+#ifdef ALLOCATOR_INSTRUMENT
+// Record one instrumented call in the calling thread's histograms
+static void probe_record(int probe, unsigned long long cycles, unsigned long long nodes) {
+    probe_stats_t* stats = &thread_counts()->probes[probe];
+    STAT_ADD(stats->calls, 1);
+    STAT_ADD(stats->cycles, cycles);
+    STAT_ADD(stats->nodes, nodes);
+    STAT_ADD(stats->cycle_hist[probe_bucket(cycles)], 1);
+    STAT_ADD(stats->node_hist[probe_bucket(nodes)], 1);
+}
+
+// Time the code from PROBE_BEGIN() to PROBE_END(), counting the free-list
+// nodes PROBE_VISIT() marks in between, those of nested probes included
+#define PROBE_BEGIN() \
+    unsigned long long probe_start = read_cycles(); \
+    unsigned long long probe_nodes = thread_ops.nodes_visited
+#define PROBE_VISIT() (thread_ops.nodes_visited++)
+#define PROBE_END(probe) probe_record((probe), read_cycles() - probe_start, thread_ops.nodes_visited - probe_nodes)
+#else
+// Without ALLOCATOR_INSTRUMENT the probes compile to nothing
+#define PROBE_BEGIN()
+#define PROBE_VISIT() ((void)0)
+#define PROBE_END(probe) ((void)0)
+#endif
+
+// Whether to time this call for the statistics export: one call of each
+// kind in LATENCY_SAMPLE_INTERVAL per thread, and only while exporting. The
+// calls in between pay just the decrement. Counting kinds apart keeps a
+// regular pattern such as free then malloc from always landing on one.
+static inline int latency_sampled(int kind) {
+    if (__builtin_expect(--thread_ops.latency_countdown[kind] >= 0, 1)) {
+        return 0;
+    }
+    thread_ops.latency_countdown[kind] = LATENCY_SAMPLE_INTERVAL - 1;
+    return __atomic_load_n(&exporting, __ATOMIC_RELAXED);
+}
+
+static void latency_record(int kind, long long start) {
+    size_t bucket = probe_bucket((unsigned long long)(now_ns() - start));
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    STAT_ADD(thread_counts()->latency[kind][bucket], 1);
+}
+
+// Sum the calls of every thread, live or exited, over the fixed stripes
+static void op_totals(unsigned long long totals[OP_KINDS]) {
+    for (int op = 0; op < OP_KINDS; op++) {
+        totals[op] = 0;
+    }
+    for (int stripe = 0; stripe < OP_STRIPES; stripe++) {
+        for (int op = 0; op < OP_KINDS; op++) {
+            totals[op] += __atomic_load_n(&op_calls[stripe].calls[op], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Write `size` bytes to a file; returns 0 on failure
+static int write_all(int fd, const void* data, size_t size) {
+    const char* next = (const char*)data;
+    while (size > 0) {
+        ssize_t written = write(fd, next, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return 0;
+        }
+        next += written;
+        size -= (size_t)written;
+    }
+    return 1;
+}
+
+// Write out the buffered trace records (caller holds trace_lock)
+static void trace_flush(void) {
+    if (!write_all(trace_fd, trace_buffer, trace_count * sizeof(trace_record_t))) {
+        printf("Error: Cannot write the allocation trace\n");
+    }
+    trace_count = 0;
+}
+
+// Append one record (caller holds trace_lock). Records are appended in the
+// order the lock is taken, so a block's free never precedes its allocation.
+static void trace_append(int op, size_t size, const void* id, const void* old_id, size_t alignment) {
+    if (trace_fd < 0) {
+        return;
+    }
+    if (trace_thread < 0) {
+        trace_thread = (int)next_trace_thread++;
+    }
     
-    // Create new block header after the allocated portion
-    block_header_t* new_block = (block_header_t*)((char*)block + HEADER_SIZE + size);
-    new_block->size = block->size - size - HEADER_SIZE;
-    new_block->is_free = 1;
-    new_block->next = NULL;
-    new_block->prev = NULL;
+    trace_record_t* record = &trace_buffer[trace_count];
+    record->timestamp = (uint64_t)(now_ns() - trace_start_ns);
+    record->size = size;
+    record->id = (uint64_t)(uintptr_t)id;
+    record->old_id = (uint64_t)(uintptr_t)old_id;
+    record->thread = (uint32_t)trace_thread;
+    record->op = (uint16_t)op;
+    record->align_shift = 0;
+    while (((size_t)1 << record->align_shift) < alignment) {
+        record->align_shift++;
+    }
     
-    // Update the original block size
-    block->size = size;
+    if (++trace_count == TRACE_BUFFER_RECORDS) {
+        trace_flush();
+    }
+}
+
+// Record one call. Allocations are recorded after they happen and frees
+// before, so an address is never reused ahead of the record freeing it.
+static void trace_event(int op, size_t size, const void* id, const void* old_id, size_t alignment) {
+    pthread_mutex_lock(&trace_lock);
+    trace_append(op, size, id, old_id, alignment);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+#define TRACING() __atomic_load_n(&tracing, __ATOMIC_RELAXED)
+
+// Start recording every public allocation call to a new trace file at
+// `path`. Returns 1 on success.
+int my_trace_start(const char* path) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        pthread_mutex_unlock(&trace_lock);
+        printf("Error: An allocation trace is already being recorded\n");
+        return 0;
+    }
     
-    // Add the new block to the free list
-    add_to_free_list(new_block);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    trace_buffer = fd >= 0 ? (trace_record_t*)os_map(TRACE_BUFFER_RECORDS * sizeof(trace_record_t)) : NULL;
+    if (trace_buffer == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        pthread_mutex_unlock(&trace_lock);
+        printf("Error: Cannot record an allocation trace to %s\n", path);
+        return 0;
+    }
     
-    return new_block;
+    trace_header_t header = {TRACE_MAGIC, TRACE_VERSION, sizeof(trace_record_t), 0};
+    trace_fd = fd;
+    trace_count = 0;
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        printf("Error: Cannot write the allocation trace\n");
+    }
+    trace_start_ns = now_ns();
+    __atomic_store_n(&tracing, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_lock);
+    return 1;
+}
+
+// Stop recording and close the trace file
+void my_trace_stop(void) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        __atomic_store_n(&tracing, 0, __ATOMIC_RELAXED);
+        trace_flush();
+        close(trace_fd);
+        trace_fd = -1;
+        os_unmap(trace_buffer, TRACE_BUFFER_RECORDS * sizeof(trace_record_t));
+        trace_buffer = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Draw the bytes a thread allocates before its next sample. Exponential
+// intervals make the samples a Poisson process over bytes: every byte is
+// equally likely to be sampled, whatever the size of its block.
+static long long profile_next_interval(void) {
+    uint64_t x = sample_random; // xorshift64*
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sample_random = x;
+    double u = (double)(((x * 0x2545F4914F6CDD1DULL) >> 11) + 1) / 9007199254740992.0; // In (0, 1]
+    
+    // -ln(u): halve u into [0.5, 1], then a series in t = (u - 1) / (u + 1),
+    // which stays within [-1/3, 0]
+    double halvings = 0;
+    while (u < 0.5) {
+        u *= 2;
+        halvings++;
+    }
+    double t = (u - 1) / (u + 1);
+    double t2 = t * t;
+    double log_u = 2 * t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 / 9))));
+    size_t interval = __atomic_load_n(&profile_interval, __ATOMIC_RELAXED);
+    return (long long)((halvings * 0.6931471805599453 - log_u) * (double)interval);
+}
+
+// Find a call stack's bucket, adding one while there is room (caller holds
+// profile_lock). The table has twice as many slots as buckets.
+static uint32_t profile_bucket_of(void* const* frames, int depth) {
+    uint64_t hash = (uint64_t)depth;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 0x100000001B3ULL;
+    }
+    
+    size_t mask = 2 * PROFILE_BUCKETS - 1;
+    for (size_t i = (size_t)(hash >> 32) & mask;; i = (i + 1) & mask) {
+        uint32_t bucket = profile_bucket_table[i];
+        if (bucket == 0) {
+            if (profile_num_buckets == PROFILE_BUCKETS) {
+                return 0;
+            }
+            bucket = (uint32_t)profile_num_buckets++;
+            profile_buckets[bucket].depth = depth;
+            memcpy(profile_buckets[bucket].frames, frames, depth * sizeof(void*));
+            profile_bucket_table[i] = bucket + 1;
+            return bucket;
+        }
+        bucket--;
+        if (profile_buckets[bucket].depth == depth &&
+            memcmp(profile_buckets[bucket].frames, frames, depth * sizeof(void*)) == 0) {
+            return bucket;
+        }
+    }
+}
+
+// Find a sampled block (caller holds profile_lock)
+static profile_sample_t* profile_find(uintptr_t ptr) {
+    size_t mask = profile_capacity - 1;
+    for (size_t i = (size_t)(PROFILE_HASH(ptr) >> 32) & mask;; i = (i + 1) & mask) {
+        if (profile_samples[i].ptr == ptr) {
+            return &profile_samples[i];
+        }
+        if (profile_samples[i].ptr == 0) {
+            return NULL;
+        }
+    }
+}
+
+// First unused slot for an address in a sample table
+static profile_sample_t* profile_slot(profile_sample_t* samples, size_t capacity, uintptr_t ptr) {
+    size_t mask = capacity - 1;
+    size_t i = (size_t)(PROFILE_HASH(ptr) >> 32) & mask;
+    while (samples[i].ptr > 1) {
+        i = (i + 1) & mask;
+    }
+    return &samples[i];
+}
+
+// Track a sampled block, rebuilding the table at three quarters full
+// (caller holds profile_lock)
+static void profile_insert(uintptr_t ptr, size_t size, uint32_t bucket) {
+    if ((profile_used + 1) * 4 >= profile_capacity * 3) {
+        size_t capacity = profile_capacity;
+        while (profile_live * 2 >= capacity) {
+            capacity *= 2;
+        }
+        profile_sample_t* samples = (profile_sample_t*)os_map(capacity * sizeof(profile_sample_t));
+        if (samples == NULL) {
+            return;
+        }
+        for (size_t i = 0; i < profile_capacity; i++) {
+            if (profile_samples[i].ptr > 1) {
+                *profile_slot(samples, capacity, profile_samples[i].ptr) = profile_samples[i];
+            }
+        }
+        os_unmap(profile_samples, profile_capacity * sizeof(profile_sample_t));
+        profile_samples = samples;
+        profile_capacity = capacity;
+        profile_used = profile_live;
+    }
+    
+    profile_sample_t* sample = profile_slot(profile_samples, profile_capacity, ptr);
+    if (sample->ptr == 0) {
+        profile_used++;
+    }
+    sample->ptr = ptr;
+    sample->size = size;
+    sample->bucket = bucket;
+    profile_live++;
+    profile_buckets[bucket].allocs++;
+    profile_buckets[bucket].alloc_bytes += size;
+    STAT_ADD(profile_filter[PROFILE_FILTER_SLOT(ptr)], 1);
+}
+
+// Take a sample once the calling thread's countdown runs out. Never inlined,
+// so the stack it captures starts two frames up, past the public call.
+static __attribute__((noinline)) void profile_sample(void* ptr, size_t size) {
+    if (sample_random == 0) {
+        // A thread's first call only draws its first interval
+        sample_random = ((uint64_t)(uintptr_t)&sample_random ^ (uint64_t)now_ns()) | 1;
+        sample_countdown = profile_next_interval() - (long long)size;
+        if (sample_countdown >= 0) {
+            return;
+        }
+    }
+    sample_countdown = profile_next_interval();
+    if (!__atomic_load_n(&profiling, __ATOMIC_RELAXED)) {
+        return;
+    }
+    
+    void* frames[PROFILE_MAX_DEPTH + 2];
+    int depth = 0;
+#if defined(__GLIBC__)
+    depth = backtrace(frames, PROFILE_MAX_DEPTH + 2);
+#elif defined(_WIN32)
+    depth = CaptureStackBackTrace(0, PROFILE_MAX_DEPTH + 2, frames, NULL);
+#endif
+    depth = depth > 2 ? depth - 2 : 0;
+    
+    pthread_mutex_lock(&profile_lock);
+    if (profiling) {
+        profile_insert((uintptr_t)ptr, size, profile_bucket_of(frames + 2, depth));
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+// Stop tracking a sampled block that is being freed (caller holds profile_lock)
+static void profile_forget_locked(const void* ptr) {
+    profile_sample_t* sample = profile_samples != NULL ? profile_find((uintptr_t)ptr) : NULL;
+    if (sample != NULL) {
+        profile_bucket_t* bucket = &profile_buckets[sample->bucket];
+        bucket->frees++;
+        bucket->free_bytes += sample->size;
+        STAT_SUB(profile_filter[PROFILE_FILTER_SLOT(ptr)], 1);
+        sample->ptr = 1;
+        profile_live--;
+    }
+}
+
+// Stop tracking a sampled block that is being freed
+static void profile_forget(const void* ptr) {
+    pthread_mutex_lock(&profile_lock);
+    profile_forget_locked(ptr);
+    pthread_mutex_unlock(&profile_lock);
+}
+
+// Count an allocation toward the calling thread's next heap profile sample.
+// Unless a sample is due, the decrement is all it costs.
+#define PROFILE_ALLOC(ptr, size) \
+    do { \
+        if ((sample_countdown -= (long long)(size)) < 0) { \
+            profile_sample((ptr), (size)); \
+        } \
+    } while (0)
+
+// Whether a block may be sampled. The filter is zero for nearly every
+// address, so unsampled frees take no lock.
+#define PROFILE_MAYBE_SAMPLED(ptr) \
+    ((ptr) != NULL && __atomic_load_n(&profile_filter[PROFILE_FILTER_SLOT(ptr)], __ATOMIC_RELAXED) != 0)
+
+// Check a block about to be freed against the sampled ones
+#define PROFILE_FREE(ptr) \
+    do { \
+        if (PROFILE_MAYBE_SAMPLED(ptr)) { \
+            profile_forget(ptr); \
+        } \
+    } while (0)
+
+// Start sampling about one allocation per `interval` bytes (0 for
+// DEFAULT_PROFILE_INTERVAL), recording each sampled block's call stack
+// until it is freed. Other threads move to a new interval after their next
+// sample. Returns 1 on success.
+int my_profile_start(size_t interval) {
+#ifdef __GLIBC__
+    // The first backtrace() loads the unwinder, which allocates
+    void* frame;
+    backtrace(&frame, 1);
+#endif
+
+    pthread_mutex_lock(&profile_lock);
+    if (profiling) {
+        pthread_mutex_unlock(&profile_lock);
+        printf("Error: The heap profiler is already running\n");
+        return 0;
+    }
+    
+    profile_buckets = (profile_bucket_t*)os_map(PROFILE_BUCKETS * sizeof(profile_bucket_t));
+    profile_bucket_table = (uint32_t*)os_map(2 * PROFILE_BUCKETS * sizeof(uint32_t));
+    profile_samples = (profile_sample_t*)os_map(PROFILE_INITIAL_SAMPLES * sizeof(profile_sample_t));
+    if (profile_buckets == NULL || profile_bucket_table == NULL || profile_samples == NULL) {
+        if (profile_buckets != NULL) {
+            os_unmap(profile_buckets, PROFILE_BUCKETS * sizeof(profile_bucket_t));
+        }
+        if (profile_bucket_table != NULL) {
+            os_unmap(profile_bucket_table, 2 * PROFILE_BUCKETS * sizeof(uint32_t));
+        }
+        if (profile_samples != NULL) {
+            os_unmap(profile_samples, PROFILE_INITIAL_SAMPLES * sizeof(profile_sample_t));
+        }
+        profile_buckets = NULL;
+        profile_bucket_table = NULL;
+        profile_samples = NULL;
+        pthread_mutex_unlock(&profile_lock);
+        printf("Error: Cannot map the heap profile tables\n");
+        return 0;
+    }
+    profile_num_buckets = 1;
+    profile_capacity = PROFILE_INITIAL_SAMPLES;
+    profile_used = 0;
+    profile_live = 0;
+    __atomic_store_n(&profile_interval, interval > 0 ? interval : DEFAULT_PROFILE_INTERVAL, __ATOMIC_RELAXED);
+    __atomic_store_n(&profiling, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&profile_lock);
+    
+    // The calling thread draws a fresh interval on its next allocation
+    sample_random = 0;
+    sample_countdown = 0;
+    return 1;
+}
+
+// Write the heap profile to `path` in the text format pprof reads: per call
+// stack, the sampled blocks still live and all those ever allocated, then
+// the process's mappings for symbolization. Returns 1 on success.
+int my_profile_dump(const char* path) {
+    pthread_mutex_lock(&profile_lock);
+    if (!profiling) {
+        pthread_mutex_unlock(&profile_lock);
+        printf("Error: The heap profiler is not running\n");
+        return 0;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd < 0) {
+        pthread_mutex_unlock(&profile_lock);
+        printf("Error: Cannot write a heap profile to %s\n", path);
+        return 0;
+    }
+    
+    unsigned long long live = 0, live_bytes = 0, allocs = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < profile_num_buckets; i++) {
+        live += profile_buckets[i].allocs - profile_buckets[i].frees;
+        live_bytes += profile_buckets[i].alloc_bytes - profile_buckets[i].free_bytes;
+        allocs += profile_buckets[i].allocs;
+        alloc_bytes += profile_buckets[i].alloc_bytes;
+    }
+    
+    // heap_v2 tells pprof the counts are samples, to be scaled by the interval
+    char line[128 + PROFILE_MAX_DEPTH * 20];
+    int length = snprintf(line, sizeof(line), "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n", live,
+                          live_bytes, allocs, alloc_bytes, profile_interval);
+    int ok = write_all(fd, line, (size_t)length);
+    for (size_t i = 0; ok && i < profile_num_buckets; i++) {
+        const profile_bucket_t* bucket = &profile_buckets[i];
+        if (bucket->allocs == 0) {
+            continue;
+        }
+        length = snprintf(line, sizeof(line), "%llu: %llu [%llu: %llu] @", bucket->allocs - bucket->frees,
+                          bucket->alloc_bytes - bucket->free_bytes, bucket->allocs, bucket->alloc_bytes);
+        for (int frame = 0; frame < bucket->depth; frame++) {
+            length += snprintf(line + length, sizeof(line) - length, " 0x%llx",
+                               (unsigned long long)(uintptr_t)bucket->frames[frame]);
+        }
+        line[length++] = '\n';
+        ok = write_all(fd, line, (size_t)length);
+    }
+    pthread_mutex_unlock(&profile_lock);
+    
+    int maps = ok ? open("/proc/self/maps", O_RDONLY) : -1;
+    if (maps >= 0) {
+        const char* heading = "\nMAPPED_LIBRARIES:\n";
+        ok = write_all(fd, heading, strlen(heading));
+        char chunk[4096];
+        ssize_t got;
+        while (ok && (got = read(maps, chunk, sizeof(chunk))) > 0) {
+            ok = write_all(fd, chunk, (size_t)got);
+        }
+        close(maps);
+    }
+    close(fd);
+    if (!ok) {
+        printf("Error: Cannot write a heap profile to %s\n", path);
+    }
+    return ok;
+}
+
+// Stop sampling and discard the heap profile
+void my_profile_stop(void) {
+    pthread_mutex_lock(&profile_lock);
+    if (profiling) {
+        __atomic_store_n(&profiling, 0, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < PROFILE_FILTER_SIZE; i++) {
+            __atomic_store_n(&profile_filter[i], 0, __ATOMIC_RELAXED);
+        }
+        os_unmap(profile_buckets, PROFILE_BUCKETS * sizeof(profile_bucket_t));
+        os_unmap(profile_bucket_table, 2 * PROFILE_BUCKETS * sizeof(uint32_t));
+        os_unmap(profile_samples, profile_capacity * sizeof(profile_sample_t));
+        profile_buckets = NULL;
+        profile_bucket_table = NULL;
+        profile_samples = NULL;
+        profile_capacity = 0;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+// Initialize the allocator with explicit options (NULL for defaults)
+void allocator_init_ex(const allocator_options_t* options) {
+    pthread_mutex_lock(&init_lock);
+    if (allocator_initialized) {
+        pthread_mutex_unlock(&init_lock);
+        return;
+    }
+    
+    thread_safe = (options != NULL && options->thread_safe);
+    tcache_enabled = (options != NULL && options->tcache);
+    remote_free_enabled = thread_safe && options->remote_free;
+    quiet = (options != NULL && options->quiet);
+    mmap_threshold = (options != NULL && options->mmap_threshold > 0) ? options->mmap_threshold : DEFAULT_MMAP_THRESHOLD;
+    purge_decay_ms = (options != NULL && options->purge_decay_ms != 0) ? options->purge_decay_ms : DEFAULT_PURGE_DECAY_MS;
+    engine = (options != NULL && (options->engine == ENGINE_TLSF || options->engine == ENGINE_BUDDY)) ? options->engine
+                                                                                                       : ENGINE_SEGREGATED;
+    placement_policy = PLACEMENT_GOOD_FIT;
+    if (options != NULL && options->placement != PLACEMENT_GOOD_FIT) {
+        my_set_placement_policy(options->placement);
+    }
+    heap_generation++;
+    
+    // Statistics start over with each heap
+    op_totals(ops_baseline);
+    total_allocated = huge_allocated;
+    total_peak = total_allocated;
+    
+    int requested = 1;
+    if (thread_safe) {
+        requested = options->num_arenas > 0 ? options->num_arenas : DEFAULT_ARENAS;
+        if (requested > MAX_ARENAS) {
+            requested = MAX_ARENAS;
+        }
+    }
+    
+    // Arena 0's descriptor is static; the other shared arenas map theirs
+    main_arena.mapped_size = 0;
+    if (!arena_setup(&main_arena, 0)) {
+        pthread_mutex_unlock(&init_lock);
+        printf("Error: Cannot map the initial heap region\n");
+        return;
+    }
+    arena_register(&main_arena);
+    num_shared_arenas = 1;
+    
+    while (num_shared_arenas < requested) {
+        arena_t* arena = arena_map(0);
+        if (arena == NULL) {
+            break;
+        }
+        arena_register(arena);
+        num_shared_arenas++;
+    }
+    
+    // Slabs are carved from one reserved range so ownership is a range check
+    slab_enabled = 0;
+    if (options != NULL && options->slab) {
+        slab_region = (char*)os_map(SLAB_REGION_SIZE);
+        if (slab_region != NULL) {
+            slab_region_top = slab_region;
+            slab_pool = NULL;
+            for (int i = 0; i < SLAB_CLASSES; i++) {
+                slab_classes[i].partial = NULL;
+                slab_classes[i].allocated = 0;
+                slab_classes[i].free = 0;
+                pthread_mutex_init(&slab_classes[i].lock, NULL);
+            }
+            slab_enabled = 1;
+        }
+    }
+    
+    if (engine == ENGINE_BUDDY && !buddy_setup()) {
+        printf("Error: Cannot map the buddy heap\n");
+        engine = ENGINE_SEGREGATED;
+    }
+    
+    __atomic_store_n(&allocator_initialized, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&init_lock);
+    
+    if (quiet) {
+        return;
+    }
+    if (thread_safe || tcache_enabled || slab_enabled || engine != ENGINE_SEGREGATED) {
+        printf("Memory allocator initialized with %zu bytes in %d arenas%s%s%s\n", get_heap_size(), num_shared_arenas,
+               tcache_enabled ? ", thread caches" : "", slab_enabled ? ", slabs" : "",
+               engine == ENGINE_TLSF ? ", TLSF" : engine == ENGINE_BUDDY ? ", buddy heap" : "");
+    } else {
+        printf("Memory allocator initialized with %zu bytes\n", get_heap_size());
+    }
+}
+
+// Initialize the allocator
+void allocator_init(void) {
+    allocator_init_ex(NULL);
+}
+
+static void lock_mutex(pthread_mutex_t* lock) {
+    if (thread_safe) {
+        pthread_mutex_lock(lock);
+    }
+}
+
+static void unlock_mutex(pthread_mutex_t* lock) {
+    if (thread_safe) {
+        pthread_mutex_unlock(lock);
+    }
+}
+
+static void lock_arena(arena_t* arena) {
+    lock_mutex(&arena->lock);
+}
+
+static void unlock_arena(arena_t* arena) {
+    unlock_mutex(&arena->lock);
+}
+
+// Take every allocator lock before fork(), so the child's copy of the heap
+// has no structure left half-updated by a thread that does not exist there.
+// init_lock comes first as it keeps the arena table still, and the order
+// otherwise follows the nesting of the locks.
+void allocator_fork_prepare(void) {
+    pthread_mutex_lock(&init_lock);
+    pthread_mutex_lock(&profile_lock);
+    pthread_mutex_lock(&trace_lock);
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        if (arena_table[i] != NULL) {
+            lock_arena(arena_table[i]);
+        }
+    }
+    if (slab_enabled) {
+        for (int i = 0; i < SLAB_CLASSES; i++) {
+            lock_mutex(&slab_classes[i].lock);
+        }
+    }
+    lock_mutex(&slab_pool_lock);
+    lock_mutex(&buddy_lock);
+    lock_mutex(&huge_lock);
+    pthread_mutex_lock(&region_map_lock);
+    pthread_mutex_lock(&op_counts_lock);
+}
+
+// Release the locks taken by allocator_fork_prepare(), in the parent and in
+// the child alike
+void allocator_fork_release(void) {
+    pthread_mutex_unlock(&op_counts_lock);
+    pthread_mutex_unlock(&region_map_lock);
+    unlock_mutex(&huge_lock);
+    unlock_mutex(&buddy_lock);
+    unlock_mutex(&slab_pool_lock);
+    if (slab_enabled) {
+        for (int i = SLAB_CLASSES - 1; i >= 0; i--) {
+            unlock_mutex(&slab_classes[i].lock);
+        }
+    }
+    for (int i = MAX_ARENAS - 1; i >= 0; i--) {
+        if (arena_table[i] != NULL) {
+            unlock_arena(arena_table[i]);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    pthread_mutex_unlock(&profile_lock);
+    pthread_mutex_unlock(&init_lock);
+}
+
+// Get the shared arena this thread is bound to, assigning one round-robin
+static arena_t* thread_arena(void) {
+    if (home_arena < 0) {
+        home_arena = __atomic_fetch_add(&next_home_arena, 1, __ATOMIC_RELAXED);
+    }
+    return arena_table[home_arena % num_shared_arenas];
+}
+
+// Get the block physically following this one; at the end of a region this
+// is the fence, which is never free
+static block_header_t* next_physical_block(block_header_t* block) {
+    return (block_header_t*)((char*)block + HEADER_SIZE + BLOCK_SIZE(block));
+}
+
+// Get the block physically preceding this one through its boundary tag, or
+// NULL unless that block is free. The tag is the last word of the free
+// block, just before this header.
+static block_header_t* prev_physical_block(block_header_t* block) {
+    if (!(block->size & BLOCK_PREV_FREE)) {
+        return NULL;
+    }
+    size_t prev_size = ((size_t*)block)[-1];
+    return (block_header_t*)((char*)block - HEADER_SIZE - prev_size);
+}
+
+// Set a block's size, keeping its flags
+static void set_block_size(block_header_t* block, size_t size) {
+    block->size = size | (block->size & BLOCK_FLAGS);
+}
+
+// Set or clear BLOCK_PREV_FREE in the block after `block`. That block may
+// be allocated, and remote_free reads an allocated block's size word
+// without the arena lock, so the word is stored atomically.
+static void set_next_prev_free(block_header_t* block, int prev_free) {
+    block_header_t* next = next_physical_block(block);
+    size_t size = prev_free ? next->size | BLOCK_PREV_FREE : next->size & ~(size_t)BLOCK_PREV_FREE;
+    __atomic_store_n(&next->size, size, __ATOMIC_RELAXED);
+}
+
+// Mark a block free: write its boundary tag and flag it in the following
+// block. Called again whenever a free block changes size.
+static void mark_free(block_header_t* block) {
+    size_t size = BLOCK_SIZE(block);
+    block->size |= BLOCK_FREE;
+    *(size_t*)((char*)block + HEADER_SIZE + size - sizeof(size_t)) = size;
+    set_next_prev_free(block, 1);
+}
+
+// Mark a block allocated
+static void mark_allocated(block_header_t* block) {
+    block->size &= ~(size_t)(BLOCK_FREE | BLOCK_PURGED);
+    set_next_prev_free(block, 0);
+}
+
+// Power-of-two size class of a block for the statistics
+static size_t size_class_of(size_t size) {
+    return size == 0 ? 0 : (size_t)(63 - __builtin_clzll((unsigned long long)size));
+}
+
+// Count a block in or out of a locked arena's allocated blocks
+static void arena_count_block(arena_t* arena, size_t size) {
+    STAT_ADD(arena->blocks, 1);
+    STAT_ADD(arena->size_classes[size_class_of(size)], 1);
+}
+
+static void arena_uncount_block(arena_t* arena, size_t size) {
+    STAT_SUB(arena->blocks, 1);
+    STAT_SUB(arena->size_classes[size_class_of(size)], 1);
+}
+
+// Map a block size to its free list bin
+size_t bin_index(size_t size) {
+    if (size < SMALL_BIN_LIMIT) {
+        return (size - MIN_BLOCK_SIZE) / ALIGNMENT;
+    }
+    
+    // Large bins hold sizes in [2^k, 2^(k+1))
+    size_t log2 = (size_t)(63 - __builtin_clzll((unsigned long long)size));
+    return NUM_SMALL_BINS + (log2 - 9);
+}
+
+// Map a block size to its TLSF class: the power of two selects the row and
+// the next TLSF_SL_BITS bits select the class within it
+static size_t tlsf_bin_index(size_t size) {
+    if (size < ((size_t)1 << TLSF_FL_SHIFT)) {
+        return size / ALIGNMENT;
+    }
+    
+    size_t log2 = (size_t)(63 - __builtin_clzll((unsigned long long)size));
+    size_t sl = (size >> (log2 - TLSF_SL_BITS)) & (TLSF_SL_COUNT - 1);
+    return (log2 - TLSF_FL_SHIFT + 1) * TLSF_SL_COUNT + sl;
+}
+
+// Map a block size to its bin under the active engine
+static size_t free_bin_index(size_t size) {
+    return engine == ENGINE_TLSF ? tlsf_bin_index(size) : bin_index(size);
+}
+
+// Get the whole pages inside a free block's payload, the part that can be
+// returned to the OS without disturbing its header, list links or boundary tag
+static size_t purge_span(block_header_t* block, char** start) {
+    uintptr_t first = ((uintptr_t)block + sizeof(block_header_t) + PAGE_SIZE_BYTES - 1) & ~(uintptr_t)(PAGE_SIZE_BYTES - 1);
+    uintptr_t last = ((uintptr_t)block + HEADER_SIZE + BLOCK_SIZE(block) - sizeof(size_t)) & ~(uintptr_t)(PAGE_SIZE_BYTES - 1);
+    if (start != NULL) {
+        *start = (char*)first;
+    }
+    return last > first ? (size_t)(last - first) : 0;
+}
+
+// Add a block to the bin of its size in the given arena
+static void arena_add_free(arena_t* arena, block_header_t* block) {
+    PROBE_BEGIN();
+    size_t index = free_bin_index(BLOCK_SIZE(block));
+    
+    if (block->size & BLOCK_PURGED) {
+        STAT_ADD(arena->purged, purge_span(block, NULL));
+    }
+    
+    // Insert at the beginning of the bin
+    block->next = arena->free_bins[index];
+    block->prev = NULL;
+    if (arena->free_bins[index]) {
+        PROBE_VISIT();
+        arena->free_bins[index]->prev = block;
+    }
+    arena->free_bins[index] = block;
+    __atomic_store_n(&arena->bin_bitmap[index / 64], arena->bin_bitmap[index / 64] | 1ULL << (index % 64),
+                     __ATOMIC_RELAXED);
+    STAT_ADD(arena->free_blocks, 1);
+    __atomic_store_n(&arena->bin_summary, arena->bin_summary | 1ULL << (index / 64), __ATOMIC_RELAXED);
+    STAT_PEAK(arena->bin_largest[index], BLOCK_SIZE(block));
+    PROBE_END(PROBE_ADD_FREE);
+}
+
+// The largest block of a non-empty bin has left it. Find the bin's new
+// largest, stopping at a block of the same size, so a bin holding one size
+// (every small bin) never walks.
+static void arena_refresh_largest(arena_t* arena, size_t index, size_t removed) {
+    size_t largest = 0;
+    for (block_header_t* current = arena->free_bins[index]; current != NULL && largest < removed;
+         current = current->next) {
+        PROBE_VISIT();
+        if (BLOCK_SIZE(current) > largest) {
+            largest = BLOCK_SIZE(current);
+        }
+    }
+    __atomic_store_n(&arena->bin_largest[index], largest, __ATOMIC_RELAXED);
+}
+
+// Remove a block from the bin of its size in the given arena
+static void arena_remove_free(arena_t* arena, block_header_t* block) {
+    PROBE_BEGIN();
+    if (block->size & BLOCK_PURGED) {
+        STAT_SUB(arena->purged, purge_span(block, NULL));
+    }
+    
+    size_t index = free_bin_index(BLOCK_SIZE(block));
+    if (block->prev) {
+        PROBE_VISIT();
+        block->prev->next = block->next;
+    } else {
+        arena->free_bins[index] = block->next;
+        if (arena->free_bins[index] == NULL) {
+            __atomic_store_n(&arena->bin_bitmap[index / 64], arena->bin_bitmap[index / 64] & ~(1ULL << (index % 64)),
+                             __ATOMIC_RELAXED);
+            if (arena->bin_bitmap[index / 64] == 0) {
+                __atomic_store_n(&arena->bin_summary, arena->bin_summary & ~(1ULL << (index / 64)), __ATOMIC_RELAXED);
+            }
+        }
+    }
+    
+    if (block->next) {
+        PROBE_VISIT();
+        block->next->prev = block->prev;
+    }
+    
+    if (arena->rover == block) {
+        arena->rover = block->next;
+    }
+    STAT_SUB(arena->free_blocks, 1);
+    if (BLOCK_SIZE(block) == arena->bin_largest[index]) {
+        if (arena->free_bins[index] == NULL) {
+            __atomic_store_n(&arena->bin_largest[index], 0, __ATOMIC_RELAXED);
+        } else {
+            arena_refresh_largest(arena, index, BLOCK_SIZE(block));
+        }
+    }
+    
+    block->next = NULL;
+    block->prev = NULL;
+    PROBE_END(PROBE_REMOVE_FREE);
+}
+
+// Add block to the free list of its size bin
+void add_to_free_list(block_header_t* block) {
+    arena_add_free(arena_of(block), block);
+}
+
+// Remove block from the free list of its size bin
+void remove_from_free_list(block_header_t* block) {
+    arena_remove_free(arena_of(block), block);
+}
+
+// Merge a free block (not yet on the free list) with its free neighbours.
+// Only the two physical neighbours are inspected, so this is O(1).
+static block_header_t* coalesce_block(arena_t* arena, block_header_t* block) {
+    PROBE_BEGIN();
+    block_header_t* next = next_physical_block(block);
+    if (BLOCK_IS_FREE(next)) {
+        PROBE_VISIT();
+        arena_remove_free(arena, next);
+        block->size += HEADER_SIZE + BLOCK_SIZE(next);
+        STAT_ADD(arena->free, HEADER_SIZE);
+    }
+    
+    block_header_t* prev = prev_physical_block(block);
+    if (prev != NULL) {
+        PROBE_VISIT();
+        arena_remove_free(arena, prev);
+        prev->size += HEADER_SIZE + BLOCK_SIZE(block);
+        STAT_ADD(arena->free, HEADER_SIZE);
+        block = prev;
+    }
+    
+    // The freed bytes are resident, so the merged block counts as dirty
+    block->size &= ~(size_t)BLOCK_PURGED;
+    mark_free(block);
+    
+    PROBE_END(PROBE_MERGE);
+    return block;
+}
+
+// Find the first non-empty bin of an arena at or above the given index.
+// The summary word finds the next non-empty bitmap word, so this is O(1).
+static int find_nonempty_bin(arena_t* arena, size_t index) {
+    size_t word = index / 64;
+    if (word >= BIN_BITMAP_WORDS) {
+        return -1;
+    }
+    
+    uint64_t bits = arena->bin_bitmap[word] & (~0ULL << (index % 64));
+    if (bits == 0) {
+        uint64_t words = arena->bin_summary & (~1ULL << word);
+        if (words == 0) {
+            return -1;
+        }
+        word = (size_t)__builtin_ctzll(words);
+        bits = arena->bin_bitmap[word];
+    }
+    return (int)(word * 64 + __builtin_ctzll(bits));
+}
+
+// First fit: walk each bin from its head, starting at the request's bin.
+// Every block in a higher bin fits, so only the first bin is searched.
+static block_header_t* first_fit(arena_t* arena, size_t index, size_t size) {
+    for (int bin = find_nonempty_bin(arena, index); bin >= 0; bin = find_nonempty_bin(arena, (size_t)bin + 1)) {
+        for (block_header_t* current = arena->free_bins[bin]; current != NULL; current = current->next) {
+            PROBE_VISIT();
+            if (BLOCK_SIZE(current) >= size) {
+                return current;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Next fit: resume the search after the block chosen last time, falling
+// back to a first fit when the rest of that list has nothing large enough
+static block_header_t* next_fit(arena_t* arena, size_t index, size_t size) {
+    block_header_t* block = NULL;
+    if (arena->rover != NULL && free_bin_index(BLOCK_SIZE(arena->rover)) >= index) {
+        for (block_header_t* current = arena->rover; current != NULL && block == NULL; current = current->next) {
+            PROBE_VISIT();
+            if (BLOCK_SIZE(current) >= size) {
+                block = current;
+            }
+        }
+    }
+    if (block == NULL) {
+        block = first_fit(arena, index, size);
+    }
+    if (block != NULL) {
+        arena->rover = block->next;
+    }
+    return block;
+}
+
+// Best fit: the smallest block that fits. Bins never overlap in size, so it
+// is in the first bin holding any fitting block.
+static block_header_t* best_fit(arena_t* arena, size_t index, size_t size) {
+    block_header_t* best = NULL;
+    for (int bin = find_nonempty_bin(arena, index); bin >= 0 && best == NULL;
+         bin = find_nonempty_bin(arena, (size_t)bin + 1)) {
+        for (block_header_t* current = arena->free_bins[bin]; current != NULL; current = current->next) {
+            PROBE_VISIT();
+            if (BLOCK_SIZE(current) >= size && (best == NULL || BLOCK_SIZE(current) < BLOCK_SIZE(best))) {
+                best = current;
+                if (BLOCK_SIZE(best) == size) {
+                    break;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+// Address-ordered first fit: the lowest-addressed fitting block. The bins
+// are not kept in address order, so every candidate bin is searched.
+static block_header_t* address_fit(arena_t* arena, size_t index, size_t size) {
+    block_header_t* lowest = NULL;
+    for (int bin = find_nonempty_bin(arena, index); bin >= 0; bin = find_nonempty_bin(arena, (size_t)bin + 1)) {
+        for (block_header_t* current = arena->free_bins[bin]; current != NULL; current = current->next) {
+            PROBE_VISIT();
+            if (BLOCK_SIZE(current) >= size && (lowest == NULL || current < lowest)) {
+                lowest = current;
+            }
+        }
+    }
+    return lowest;
+}
+
+// Choose a free block in one arena under the engine and placement policy
+static block_header_t* choose_free_block(arena_t* arena, size_t size) {
+    size_t index = free_bin_index(size);
+    
+    if (engine != ENGINE_TLSF) {
+        switch (__atomic_load_n(&placement_policy, __ATOMIC_RELAXED)) {
+            case PLACEMENT_FIRST_FIT:
+                return first_fit(arena, index, size);
+            case PLACEMENT_NEXT_FIT:
+                return next_fit(arena, index, size);
+            case PLACEMENT_BEST_FIT:
+                return best_fit(arena, index, size);
+            case PLACEMENT_ADDRESS_FIT:
+                return address_fit(arena, index, size);
+            default:
+                break;
+        }
+    }
+    
+    // Small bins hold a single size, and the head of a large bin often fits
+    block_header_t* head = arena->free_bins[index];
+    if (head != NULL) {
+        PROBE_VISIT();
+        if (BLOCK_SIZE(head) >= size) {
+            return head;
+        }
+    }
+    
+    // Every block in a higher bin is large enough
+    int bin = find_nonempty_bin(arena, index + 1);
+    if (bin >= 0) {
+        PROBE_VISIT();
+        return arena->free_bins[bin];
+    }
+    
+    // Last resort: search the rest of our own large bin, unless it holds
+    // nothing large enough. TLSF skips this, so its worst case stays O(1) at
+    // the cost of sometimes growing the heap.
+    if (head != NULL && engine != ENGINE_TLSF && arena->bin_largest[index] >= size) {
+        for (block_header_t* current = head->next; current != NULL; current = current->next) {
+            PROBE_VISIT();
+            if (BLOCK_SIZE(current) >= size) {
+                return current;
+            }
+        }
+    }
+    
+    return NULL; // No suitable block found
+}
+
+// Find a free block in one arena that can accommodate the requested size
+static block_header_t* find_block_in_arena(arena_t* arena, size_t size) {
+    PROBE_BEGIN();
+    block_header_t* block = choose_free_block(arena, size);
+    PROBE_END(PROBE_FIND);
+    return block;
+}
+
+// Switch the placement policy; searches already under way finish with the
+// old one. Returns 0 for an unknown policy.
+int my_set_placement_policy(int policy) {
+    if (policy < PLACEMENT_GOOD_FIT || policy > PLACEMENT_ADDRESS_FIT) {
+        printf("Error: Unknown placement policy %d\n", policy);
+        return 0;
+    }
+    __atomic_store_n(&placement_policy, policy, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Get the current placement policy
+int my_get_placement_policy(void) {
+    return __atomic_load_n(&placement_policy, __ATOMIC_RELAXED);
+}
+
+// Find a free block that can accommodate the requested size
+block_header_t* find_free_block(size_t size) {
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = arena_table[i];
+        block_header_t* block = arena != NULL ? find_block_in_arena(arena, size) : NULL;
+        if (block != NULL) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+// Split a block of the given arena if it's larger than needed
+static block_header_t* arena_split_block(arena_t* arena, block_header_t* block, size_t size) {
+    if (BLOCK_SIZE(block) <= size + HEADER_SIZE + MIN_BLOCK_SIZE) {
+        // Block is too small to split
+        return NULL;
+    }
+    PROBE_BEGIN();
+    
+    // Create new block header after the allocated portion
+    block_header_t* new_block = (block_header_t*)((char*)block + HEADER_SIZE + size);
+    new_block->size = (BLOCK_SIZE(block) - size - HEADER_SIZE) | (block->size & BLOCK_PURGED);
+    new_block->next = NULL;
+    new_block->prev = NULL;
+    
+    // Update the original block size
+    set_block_size(block, size);
+    
+    // The following block now sits after the new one
+    mark_free(new_block);
+    
+    // The new header is carved out of free space
+    STAT_SUB(arena->free, HEADER_SIZE);
+    
+    // Add the new block to the free list
+    arena_add_free(arena, new_block);
+    
+    PROBE_END(PROBE_SPLIT);
+    return new_block;
+}
+
+// Split a block if it's larger than needed
+block_header_t* split_block(block_header_t* block, size_t size) {
+    return arena_split_block(arena_of(block), block, size);
+}
+
+// Merge adjacent free blocks within one region of an arena
+static void merge_region(arena_t* arena, region_t* region) {
+    PROBE_BEGIN();
+    char* current_pos = region->start;
+    
+    while (current_pos < region->end) {
+        block_header_t* current_block = (block_header_t*)current_pos;
+        PROBE_VISIT();
+        
+        if (BLOCK_IS_FREE(current_block)) {
+            // The fence is never free, so the next block is always in the region
+            block_header_t* next_block = next_physical_block(current_block);
+            
+            if (BLOCK_IS_FREE(next_block)) {
+                // Merge blocks; the grown block may move to another bin
+                arena_remove_free(arena, current_block);
+                arena_remove_free(arena, next_block);
+                current_block->size &= ~(size_t)BLOCK_PURGED;
+                current_block->size += HEADER_SIZE + BLOCK_SIZE(next_block);
+                STAT_ADD(arena->free, HEADER_SIZE);
+                mark_free(current_block);
+                arena_add_free(arena, current_block);
+                continue; // Don't advance current_pos, check for more merges
+            }
+        }
+        
+        current_pos += HEADER_SIZE + BLOCK_SIZE(current_block);
+    }
+    PROBE_END(PROBE_MERGE);
+}
+
+// Merge adjacent free blocks across every arena.
+// my_free() already coalesces with both neighbours, so this is only an
+// explicit, on-demand defragmentation pass.
+void merge_free_blocks(void) {
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = arena_table[i];
+        if (arena != NULL) {
+            lock_arena(arena);
+            for (region_t* region = arena->regions; region != NULL; region = region->next) {
+                merge_region(arena, region);
+            }
+            unlock_arena(arena);
+        }
+    }
+}
+
+// Take a block for the given size out of a locked arena
+static block_header_t* allocate_from_arena(arena_t* arena, size_t size) {
+    arena_drain_remote(arena);
+    block_header_t* block = find_block_in_arena(arena, size);
+    if (block == NULL) {
+        // Grow the arena by a region that fits the request
+        if (arena_grow(arena, size) == NULL) {
+            return NULL;
+        }
+        block = find_block_in_arena(arena, size);
+    }
+    
+    // Remove block from free list
+    arena_remove_free(arena, block);
+    
+    // Split block if it's larger than needed
+    arena_split_block(arena, block, size);
+    
+    // Mark block as allocated
+    mark_allocated(block);
+    
+    // Update statistics
+    ALLOCATED_ADD(arena->allocated, BLOCK_SIZE(block));
+    STAT_SUB(arena->free, BLOCK_SIZE(block));
+    arena_count_block(arena, BLOCK_SIZE(block));
+    
+    return block;
+}
+
+// Take a block for the given size whose payload is a multiple of `alignment`
+// out of a locked arena. The slack in front of the aligned payload stays on
+// the free list as a block of its own, and the tail is split off as usual.
+static block_header_t* allocate_aligned_from_arena(arena_t* arena, size_t size, size_t alignment) {
+    arena_drain_remote(arena);
+    
+    // Leave room for the worst-case slack, which must fit a whole free block
+    size_t search = size + alignment + HEADER_SIZE + MIN_BLOCK_SIZE;
+    block_header_t* block = find_block_in_arena(arena, search);
+    if (block == NULL) {
+        if (arena_grow(arena, search) == NULL) {
+            return NULL;
+        }
+        block = find_block_in_arena(arena, search);
+    }
+    
+    arena_remove_free(arena, block);
+    
+    uintptr_t payload = (uintptr_t)block + HEADER_SIZE;
+    uintptr_t aligned = (payload + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned != payload) {
+        while (aligned - payload < HEADER_SIZE + MIN_BLOCK_SIZE) {
+            aligned += alignment;
+        }
+        
+        // Give the slack back as a free block in front of the aligned one
+        block_header_t* lead = block;
+        block = (block_header_t*)(aligned - HEADER_SIZE);
+        block->size = BLOCK_SIZE(lead) - (size_t)(aligned - payload);
+        set_block_size(lead, (size_t)(aligned - payload) - HEADER_SIZE);
+        mark_free(lead);
+        
+        STAT_SUB(arena->free, HEADER_SIZE);
+        arena_add_free(arena, lead);
+    }
+    
+    arena_split_block(arena, block, size);
+    mark_allocated(block);
+    
+    ALLOCATED_ADD(arena->allocated, BLOCK_SIZE(block));
+    STAT_SUB(arena->free, BLOCK_SIZE(block));
+    arena_count_block(arena, BLOCK_SIZE(block));
+    
+    return block;
+}
+
+// Take a block from this thread's arena, growing it if needed, then from the
+// other shared arenas if the OS refuses more memory
+static block_header_t* allocate_from_shared_arenas(size_t size, size_t alignment) {
+    arena_t* home = thread_arena();
+    arena_t* arena = home;
+    lock_arena(arena);
+    block_header_t* block = alignment > ALIGNMENT ? allocate_aligned_from_arena(arena, size, alignment)
+                                                  : allocate_from_arena(arena, size);
+    
+    for (int i = 0; block == NULL && i < num_shared_arenas; i++) {
+        if (arena_table[i] == home) {
+            continue;
+        }
+        unlock_arena(arena);
+        arena = arena_table[i];
+        lock_arena(arena);
+        block = alignment > ALIGNMENT ? allocate_aligned_from_arena(arena, size, alignment)
+                                      : allocate_from_arena(arena, size);
+    }
+    
+    unlock_arena(arena);
+    return block;
+}
+
+// Carve up to `count` blocks of `size` bytes from the front of one free
+// block of a locked arena in a single pass. The remainder goes back to the
+// free list. Returns the number of blocks carved.
+static size_t carve_blocks(arena_t* arena, block_header_t* block, size_t size, size_t count, void** out) {
+    size_t stride = HEADER_SIZE + size;
+    size_t total = HEADER_SIZE + BLOCK_SIZE(block);
+    size_t carved = total / stride < count ? total / stride : count;
+    size_t rest = total - carved * stride;
+    size_t purged_flag = block->size & BLOCK_PURGED;
+    
+    arena_remove_free(arena, block);
+    STAT_SUB(arena->free, BLOCK_SIZE(block));
+    
+    // A free block never follows another free block, so no flags are needed
+    char* pos = (char*)block;
+    block_header_t* chunk = NULL;
+    for (size_t i = 0; i < carved; i++) {
+        chunk = (block_header_t*)pos;
+        chunk->size = size;
+        out[i] = pos + HEADER_SIZE;
+        pos += stride;
+    }
+    
+    if (rest >= HEADER_SIZE + MIN_BLOCK_SIZE) {
+        // The remainder stands as a free block of its own
+        block_header_t* tail = (block_header_t*)pos;
+        tail->size = (rest - HEADER_SIZE) | purged_flag;
+        tail->next = NULL;
+        tail->prev = NULL;
+        mark_free(tail);
+        STAT_ADD(arena->free, BLOCK_SIZE(tail));
+        arena_add_free(arena, tail);
+    } else {
+        // Too small to stand alone, so the last block keeps it
+        chunk->size += rest;
+        set_next_prev_free(chunk, 0);
+        ALLOCATED_ADD(arena->allocated, rest);
+    }
+    
+    ALLOCATED_ADD(arena->allocated, carved * size);
+    STAT_ADD(arena->blocks, carved);
+    STAT_ADD(arena->size_classes[size_class_of(size)], carved - 1);
+    STAT_ADD(arena->size_classes[size_class_of(BLOCK_SIZE(chunk))], 1);
+    return carved;
+}
+
+// Fill `out` with up to `count` blocks of `size` bytes from a locked arena,
+// splitting as few free blocks as possible. Returns the number allocated.
+static size_t allocate_batch_from_arena(arena_t* arena, size_t size, size_t count, void** out) {
+    size_t stride = HEADER_SIZE + size;
+    size_t done = 0;
+    arena_drain_remote(arena);
+    
+    while (done < count) {
+        // Look for one block holding everything that is left, growing the
+        // arena if none does, and settle for any block that fits one more
+        size_t remaining = count - done;
+        if (remaining > (SIZE_MAX / 2) / stride) {
+            remaining = (SIZE_MAX / 2) / stride;
+        }
+        size_t want = remaining * stride - HEADER_SIZE;
+        block_header_t* block = find_block_in_arena(arena, want);
+        if (block == NULL && arena_grow(arena, want) != NULL) {
+            block = find_block_in_arena(arena, want);
+        }
+        if (block == NULL) {
+            block = find_block_in_arena(arena, size);
+        }
+        if (block == NULL) {
+            break;
+        }
+        done += carve_blocks(arena, block, size, count - done, out + done);
+    }
+    
+    return done;
+}
+
+// Return the whole pages of a free block to the OS
+static size_t purge_block(arena_t* arena, block_header_t* block) {
+    char* start;
+    size_t span = purge_span(block, &start);
+    if ((block->size & BLOCK_PURGED) || span == 0) {
+        return 0;
+    }
+    
+    os_purge(start, span);
+    block->size |= BLOCK_PURGED;
+    STAT_ADD(arena->purged, span);
+    return span;
+}
+
+// Purge every dirty free block of a locked arena with at least `min_span`
+// bytes of whole pages. Returns the bytes purged.
+static size_t purge_arena(arena_t* arena, size_t min_span) {
+    size_t purged = 0;
+    
+    for (int bin = find_nonempty_bin(arena, free_bin_index(min_span)); bin >= 0;
+         bin = find_nonempty_bin(arena, (size_t)bin + 1)) {
+        for (block_header_t* block = arena->free_bins[bin]; block != NULL; block = block->next) {
+            if (!(block->size & BLOCK_PURGED) && purge_span(block, NULL) >= min_span) {
+                purged += purge_block(arena, block);
+            }
+        }
+    }
+    
+    arena->dirty_since = 0;
+    return purged;
+}
+
+// Apply the purge policy to a block just put back on the free list. With a
+// decay, dirty spans are purged in batches once the oldest has waited
+// purge_decay_ms; the clock is only read every few frees.
+static void purge_after_free(arena_t* arena, block_header_t* block) {
+    if (purge_decay_ms == PURGE_NEVER || purge_span(block, NULL) < PURGE_THRESHOLD) {
+        return;
+    }
+    
+    if (purge_decay_ms == PURGE_IMMEDIATE) {
+        purge_block(arena, block);
+        return;
+    }
+    
+    if (arena->dirty_since == 0) {
+        arena->dirty_since = now_ms();
+        arena->purge_ticks = 0;
+    } else if ((++arena->purge_ticks & 63) == 0 && now_ms() - arena->dirty_since >= purge_decay_ms) {
+        purge_arena(arena, PURGE_THRESHOLD);
+    }
+}
+
+// Return an allocated block to its locked arena
+static void release_to_arena(arena_t* arena, block_header_t* block) {
+    // Mark block as free
+    block->size |= BLOCK_FREE;
+    
+    // Update statistics
+    ALLOCATED_SUB(arena->allocated, BLOCK_SIZE(block));
+    STAT_ADD(arena->free, BLOCK_SIZE(block));
+    arena_uncount_block(arena, BLOCK_SIZE(block));
+    
+    // Merge with free neighbours and put the result back on the free list
+    block = coalesce_block(arena, block);
+    arena_add_free(arena, block);
+    purge_after_free(arena, block);
+}
+
+// Hand a block to its arena's owner without taking the arena lock: one
+// CAS pushes it on the arena's remote free list. A block already free,
+// cached or queued is a double free and must not be pushed, as that would
+// overwrite its free-list links; claiming prev with a CAS also stops two
+// threads queueing the same block at once.
+static void remote_free(arena_t* arena, block_header_t* block) {
+    // The owner may be flagging a free neighbour in the size word meanwhile
+    size_t size = __atomic_load_n(&block->size, __ATOMIC_RELAXED);
+    block_header_t* prev = __atomic_load_n(&block->prev, __ATOMIC_RELAXED);
+    if ((size & BLOCK_FREE) || prev == TCACHE_MARK || prev == REMOTE_MARK ||
+        !__atomic_compare_exchange_n(&block->prev, &prev, REMOTE_MARK, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        printf("Error: Double free detected\n");
+        return;
+    }
+    block_header_t* head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+    do {
+        block->next = head;
+    } while (!__atomic_compare_exchange_n(&arena->remote_frees, &head, block, 1, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+// Release every block other threads have queued for a locked arena. The
+// whole list is taken in one exchange, so pushes never see it change under
+// them and there is no ABA problem.
+static void arena_drain_remote(arena_t* arena) {
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    
+    block_header_t* block = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (block != NULL) {
+        block_header_t* next = block->next;
+        if (BLOCK_IS_FREE(block)) {
+            printf("Error: Double free detected\n");
+        } else {
+            release_to_arena(arena, block);
+        }
+        block = next;
+    }
+}
+
+// Shrink an allocated block of a locked arena, freeing the tail if it can
+// stand as a block of its own
+static void shrink_block(arena_t* arena, block_header_t* block, size_t size) {
+    block_header_t* tail = arena_split_block(arena, block, size);
+    if (tail == NULL) {
+        return;
+    }
+    
+    // The tail's bytes move from allocated to free
+    ALLOCATED_SUB(arena->allocated, HEADER_SIZE + BLOCK_SIZE(tail));
+    STAT_ADD(arena->free, HEADER_SIZE + BLOCK_SIZE(tail));
+    
+    // Merge it with a free successor
+    arena_remove_free(arena, tail);
+    tail = coalesce_block(arena, tail);
+    arena_add_free(arena, tail);
+    purge_after_free(arena, tail);
+}
+
+// Resize an allocated block of a locked arena without moving it, growing
+// into a free right neighbour if needed. Returns 0 if it has to move.
+static int resize_in_place(arena_t* arena, block_header_t* block, size_t size) {
+    size_t old_size = BLOCK_SIZE(block);
+    if (size > BLOCK_SIZE(block)) {
+        block_header_t* next = next_physical_block(block);
+        if (!BLOCK_IS_FREE(next) || BLOCK_SIZE(block) + HEADER_SIZE + BLOCK_SIZE(next) < size) {
+            return 0;
+        }
+        
+        // Absorb the whole neighbour, then give back what isn't needed
+        arena_remove_free(arena, next);
+        block->size += HEADER_SIZE + BLOCK_SIZE(next);
+        ALLOCATED_ADD(arena->allocated, HEADER_SIZE + BLOCK_SIZE(next));
+        STAT_SUB(arena->free, BLOCK_SIZE(next));
+        
+        set_next_prev_free(block, 0);
+    }
+    
+    shrink_block(arena, block, size);
+    arena_uncount_block(arena, old_size);
+    arena_count_block(arena, BLOCK_SIZE(block));
+    return 1;
+}
+
+// Give cached blocks of one class back to the heap until `keep` remain
+static void tcache_flush(thread_cache_t* cache, size_t cls, int keep) {
+    arena_t* locked = NULL;
+    
+    while (cache->counts[cls] > keep) {
+        block_header_t* block = cache->heads[cls];
+        cache->heads[cls] = block->next;
+        cache->counts[cls]--;
+        block->next = NULL;
+        block->prev = NULL;
+        
+        // Blocks of other threads' arenas are queued for their owners
+        arena_t* arena = arena_of(block);
+        if (remote_free_enabled && arena != thread_arena()) {
+            remote_free(arena, block);
+            continue;
+        }
+        
+        // Consecutive blocks usually share an arena, so keep its lock
+        if (arena != locked) {
+            if (locked != NULL) {
+                unlock_arena(locked);
+            }
+            locked = arena;
+            lock_arena(locked);
+        }
+        release_to_arena(locked, block);
+    }
+    
+    if (locked != NULL) {
+        unlock_arena(locked);
+    }
+}
+
+// Drain every class of a thread cache back to the heap
+static void tcache_drain(thread_cache_t* cache) {
+    if (!__atomic_load_n(&allocator_initialized, __ATOMIC_ACQUIRE) ||
+        cache->generation != heap_generation) {
+        return;
+    }
+    for (size_t cls = 0; cls < TCACHE_CLASSES; cls++) {
+        tcache_flush(cache, cls, 0);
+    }
+}
+
+static void tcache_thread_exit(void* arg) {
+    thread_cache_t* cache = (thread_cache_t*)arg;
+    tcache_drain(cache);
+    cache->registered = 0;
+}
+
+static void create_tcache_key(void) {
+    pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+// Get the calling thread's cache, discarding blocks from a previous heap
+static thread_cache_t* get_thread_cache(void) {
+    thread_cache_t* cache = &thread_cache;
+    
+    if (cache->generation != heap_generation) {
+        memset(cache->heads, 0, sizeof(cache->heads));
+        memset(cache->counts, 0, sizeof(cache->counts));
+        cache->generation = heap_generation;
+    }
+    
+    if (!cache->registered) {
+        pthread_once(&tcache_key_once, create_tcache_key);
+        pthread_setspecific(tcache_key, cache);
+        cache->registered = 1;
+    }
+    
+    return cache;
+}
+
+// Fill an empty cache class with a batch of blocks under a single lock
+static int tcache_refill(thread_cache_t* cache, size_t cls, size_t size) {
+    arena_t* arena = thread_arena();
+    lock_arena(arena);
+    
+    for (int i = 0; i < TCACHE_REFILL; i++) {
+        block_header_t* block = allocate_from_arena(arena, size);
+        if (block == NULL) {
+            break;
+        }
+        block->next = cache->heads[cls];
+        block->prev = TCACHE_MARK;
+        cache->heads[cls] = block;
+        cache->counts[cls]++;
+    }
+    
+    unlock_arena(arena);
+    return cache->counts[cls] > 0;
+}
+
+// Flush the calling thread's cache back to the shared heap
+void allocator_flush_thread_cache(void) {
+    tcache_drain(&thread_cache);
+}
+
+// Check whether an address lies in the slab region
+static int slab_owns(const void* ptr) {
+    return slab_region != NULL && (const char*)ptr >= slab_region &&
+           (const char*)ptr < slab_region + SLAB_REGION_SIZE;
+}
+
+// Get the slab holding an object from its address
+static slab_t* slab_of(const void* ptr) {
+    return (slab_t*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+// Take an empty slab from the pool or the unused region and format it for a class
+static slab_t* slab_create(size_t cls) {
+    lock_mutex(&slab_pool_lock);
+    slab_t* slab = slab_pool;
+    if (slab != NULL) {
+        slab_pool = slab->next;
+    } else if (slab_region_top + SLAB_SIZE <= slab_region + SLAB_REGION_SIZE) {
+        slab = (slab_t*)slab_region_top;
+        __atomic_store_n(&slab_region_top, slab_region_top + SLAB_SIZE, __ATOMIC_RELEASE);
+    }
+    unlock_mutex(&slab_pool_lock);
+    
+    if (slab == NULL) {
+        return NULL;
+    }
+    
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->objects = (char*)slab + SLAB_DESCRIPTOR_SIZE;
+    slab->object_size = (uint32_t)((cls + 1) * SLAB_CLASS_STEP);
+    slab->capacity = (uint32_t)((SLAB_SIZE - SLAB_DESCRIPTOR_SIZE) / slab->object_size);
+    slab->free_count = slab->capacity;
+    slab->cls = (uint32_t)cls;
+    
+    // Every object starts out free
+    memset(slab->free_map, 0, sizeof(slab->free_map));
+    for (uint32_t word = 0; word < slab->capacity / 64; word++) {
+        slab->free_map[word] = ~0ULL;
+    }
+    if (slab->capacity % 64 != 0) {
+        slab->free_map[slab->capacity / 64] = (1ULL << (slab->capacity % 64)) - 1;
+    }
+    
+    return slab;
+}
+
+// Unlink a slab from its class's partial list
+static void slab_unlink(slab_class_t* sc, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        sc->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+// Push a slab onto the front of its class's partial list
+static void slab_link(slab_class_t* sc, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = sc->partial;
+    if (sc->partial) {
+        sc->partial->prev = slab;
+    }
+    sc->partial = slab;
+}
+
+// Allocate one object of a small size, or NULL when the slab region is used up
+static void* slab_malloc(size_t size) {
+    size_t cls = SLAB_CLASS(size);
+    slab_class_t* sc = &slab_classes[cls];
+    lock_mutex(&sc->lock);
+    
+    slab_t* slab = sc->partial;
+    if (slab == NULL) {
+        slab = slab_create(cls);
+        if (slab == NULL) {
+            unlock_mutex(&sc->lock);
+            return NULL;
+        }
+        slab_link(sc, slab);
+        STAT_ADD(sc->free, (size_t)slab->capacity * slab->object_size);
+    }
+    
+    // Lowest free object first keeps a slab's live objects packed together
+    uint32_t index = 0;
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+        if (slab->free_map[word] != 0) {
+            int bit = __builtin_ctzll(slab->free_map[word]);
+            slab->free_map[word] &= ~(1ULL << bit);
+            index = (uint32_t)(word * 64 + bit);
+            break;
+        }
+    }
+    
+    if (--slab->free_count == 0) {
+        slab_unlink(sc, slab);
+    }
+    
+    ALLOCATED_ADD(sc->allocated, slab->object_size);
+    STAT_SUB(sc->free, slab->object_size);
+    
+    unlock_mutex(&sc->lock);
+    return slab->objects + (size_t)index * slab->object_size;
+}
+
+// Return an object to its slab
+static void slab_free(void* ptr) {
+    slab_t* slab = slab_of(ptr);
+    
+    // Only object starts inside a formatted slab are valid
+    size_t offset = (size_t)((char*)ptr - (char*)slab);
+    if ((char*)slab >= __atomic_load_n(&slab_region_top, __ATOMIC_ACQUIRE) || slab->object_size == 0 || offset < SLAB_DESCRIPTOR_SIZE ||
+        (offset - SLAB_DESCRIPTOR_SIZE) % slab->object_size != 0 ||
+        (offset - SLAB_DESCRIPTOR_SIZE) / slab->object_size >= slab->capacity) {
+        printf("Error: Invalid pointer passed to my_free\n");
+        return;
+    }
+    
+    slab_class_t* sc = &slab_classes[slab->cls];
+    uint32_t index = (uint32_t)((offset - SLAB_DESCRIPTOR_SIZE) / slab->object_size);
+    uint64_t bit = 1ULL << (index % 64);
+    
+    lock_mutex(&sc->lock);
+    
+    if (slab->free_map[index / 64] & bit) {
+        unlock_mutex(&sc->lock);
+        printf("Error: Double free detected\n");
+        return;
+    }
+    
+    slab->free_map[index / 64] |= bit;
+    ALLOCATED_SUB(sc->allocated, slab->object_size);
+    STAT_ADD(sc->free, slab->object_size);
+    
+    if (++slab->free_count == 1) {
+        // A full slab has room again
+        slab_link(sc, slab);
+    } else if (slab->free_count == slab->capacity && (sc->partial != slab || slab->next != NULL)) {
+        // Keep one empty slab per class; give the rest back to the pool
+        slab_unlink(sc, slab);
+        STAT_SUB(sc->free, (size_t)slab->capacity * slab->object_size);
+        slab->object_size = 0;
+        
+        lock_mutex(&slab_pool_lock);
+        slab->next = slab_pool;
+        slab_pool = slab;
+        unlock_mutex(&slab_pool_lock);
+    }
+    
+    unlock_mutex(&sc->lock);
+}
+
+// Check whether an address lies in the buddy heap
+static int buddy_owns(const void* ptr) {
+    return buddy_heap != NULL && (const char*)ptr >= buddy_heap && (const char*)ptr < buddy_heap + BUDDY_HEAP_SIZE;
+}
+
+// Test, set or clear the bit of the order-`order` block at heap offset `offset`
+static int buddy_test(uint64_t** maps, size_t order, size_t offset) {
+    size_t index = offset >> order;
+    return (maps[order - BUDDY_MIN_ORDER][index / 64] >> (index % 64)) & 1;
+}
+
+static void buddy_set(uint64_t** maps, size_t order, size_t offset) {
+    size_t index = offset >> order;
+    maps[order - BUDDY_MIN_ORDER][index / 64] |= 1ULL << (index % 64);
+}
+
+static void buddy_clear(uint64_t** maps, size_t order, size_t offset) {
+    size_t index = offset >> order;
+    maps[order - BUDDY_MIN_ORDER][index / 64] &= ~(1ULL << (index % 64));
+}
+
+// Put a block on the free list of its order
+static void buddy_push(size_t order, size_t offset) {
+    buddy_node_t* node = (buddy_node_t*)(buddy_heap + offset);
+    size_t slot = order - BUDDY_MIN_ORDER;
+    node->prev = NULL;
+    node->next = buddy_lists[slot];
+    if (node->next) {
+        node->next->prev = node;
+    }
+    buddy_lists[slot] = node;
+    __atomic_store_n(&buddy_nonempty, buddy_nonempty | (1u << slot), __ATOMIC_RELAXED);
+    buddy_set(buddy_free_map, order, offset);
+    STAT_ADD(buddy_free_blocks, 1);
+}
+
+// Take a block off the free list of its order
+static void buddy_remove(size_t order, size_t offset) {
+    buddy_node_t* node = (buddy_node_t*)(buddy_heap + offset);
+    size_t slot = order - BUDDY_MIN_ORDER;
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        buddy_lists[slot] = node->next;
+        if (buddy_lists[slot] == NULL) {
+            __atomic_store_n(&buddy_nonempty, buddy_nonempty & ~(1u << slot), __ATOMIC_RELAXED);
+        }
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    }
+    buddy_clear(buddy_free_map, order, offset);
+    STAT_SUB(buddy_free_blocks, 1);
+}
+
+// Reserve the buddy heap and its bitmaps; the heap starts as one free block.
+// Pages are only touched as blocks are handed out.
+static int buddy_setup(void) {
+    size_t words[BUDDY_ORDERS];
+    buddy_maps_size = 0;
+    for (size_t order = BUDDY_MIN_ORDER; order <= BUDDY_MAX_ORDER; order++) {
+        words[order - BUDDY_MIN_ORDER] = ((BUDDY_HEAP_SIZE >> order) + 63) / 64;
+        buddy_maps_size += 2 * words[order - BUDDY_MIN_ORDER] * sizeof(uint64_t);
+    }
+    
+    // Region alignment makes every block up to REGION_ALIGN naturally aligned
+    buddy_heap = (char*)os_map_aligned(BUDDY_HEAP_SIZE, REGION_ALIGN);
+    buddy_maps = os_map(buddy_maps_size);
+    if (buddy_heap == NULL || buddy_maps == NULL) {
+        if (buddy_heap != NULL) {
+            os_unmap(buddy_heap, BUDDY_HEAP_SIZE);
+        }
+        if (buddy_maps != NULL) {
+            os_unmap(buddy_maps, buddy_maps_size);
+        }
+        buddy_heap = NULL;
+        buddy_maps = NULL;
+        return 0;
+    }
+    
+    uint64_t* map = (uint64_t*)buddy_maps;
+    for (size_t i = 0; i < BUDDY_ORDERS; i++) {
+        buddy_free_map[i] = map;
+        buddy_split_map[i] = map + words[i];
+        map += 2 * words[i];
+        buddy_lists[i] = NULL;
+        buddy_blocks[i] = 0;
+    }
+    buddy_nonempty = 0;
+    buddy_allocated = 0;
+    buddy_free_blocks = 0;
+    buddy_push(BUDDY_MAX_ORDER, 0);
+    return 1;
+}
+
+// Find the order of the unsplit block containing heap offset `offset` by
+// following split blocks down from the top
+static size_t buddy_block_order(size_t offset) {
+    size_t order = BUDDY_MAX_ORDER;
+    while (order > BUDDY_MIN_ORDER && buddy_test(buddy_split_map, order, offset)) {
+        order--;
+    }
+    return order;
+}
+
+// Allocate the smallest power-of-two block holding `size` bytes, or NULL
+// when no block of that order or above is free. O(log n) splits at most.
+static void* buddy_malloc(size_t size) {
+    size_t order = BUDDY_MIN_ORDER;
+    if (size > ((size_t)1 << BUDDY_MIN_ORDER)) {
+        order = (size_t)(64 - __builtin_clzll((unsigned long long)(size - 1)));
+    }
+    if (order > BUDDY_MAX_ORDER) {
+        return NULL;
+    }
+    
+    lock_mutex(&buddy_lock);
+    uint32_t candidates = buddy_nonempty >> (order - BUDDY_MIN_ORDER);
+    if (candidates == 0) {
+        unlock_mutex(&buddy_lock);
+        return NULL;
+    }
+    
+    // Split the smallest free block that is large enough, freeing upper halves
+    size_t current = order + (size_t)__builtin_ctz(candidates);
+    size_t offset = (size_t)((char*)buddy_lists[current - BUDDY_MIN_ORDER] - buddy_heap);
+    buddy_remove(current, offset);
+    while (current > order) {
+        buddy_set(buddy_split_map, current, offset);
+        current--;
+        buddy_push(current, offset + ((size_t)1 << current));
+    }
+    
+    ALLOCATED_ADD(buddy_allocated, (size_t)1 << order);
+    STAT_ADD(buddy_blocks[order - BUDDY_MIN_ORDER], 1);
+    unlock_mutex(&buddy_lock);
+    return buddy_heap + offset;
+}
+
+// Free a buddy block, merging it with its buddy for as long as that is free
+static void buddy_free(void* ptr) {
+    size_t offset = (size_t)((char*)ptr - buddy_heap);
+    
+    lock_mutex(&buddy_lock);
+    size_t order = buddy_block_order(offset);
+    if ((offset & (((size_t)1 << order) - 1)) != 0) {
+        unlock_mutex(&buddy_lock);
+        printf("Error: Invalid pointer passed to my_free\n");
+        return;
+    }
+    if (buddy_test(buddy_free_map, order, offset)) {
+        unlock_mutex(&buddy_lock);
+        printf("Error: Double free detected\n");
+        return;
+    }
+    
+    ALLOCATED_SUB(buddy_allocated, (size_t)1 << order);
+    STAT_SUB(buddy_blocks[order - BUDDY_MIN_ORDER], 1);
+    while (order < BUDDY_MAX_ORDER) {
+        size_t buddy = offset ^ ((size_t)1 << order);
+        if (!buddy_test(buddy_free_map, order, buddy)) {
+            break;
+        }
+        buddy_remove(order, buddy);
+        offset &= ~((size_t)1 << order);
+        order++;
+        buddy_clear(buddy_split_map, order, offset);
+    }
+    buddy_push(order, offset);
+    unlock_mutex(&buddy_lock);
+}
+
+// Get the size of a live buddy block, or 0 if `ptr` is not one
+static size_t buddy_block_size(const void* ptr) {
+    size_t offset = (size_t)((const char*)ptr - buddy_heap);
+    
+    lock_mutex(&buddy_lock);
+    size_t order = buddy_block_order(offset);
+    int live = (offset & (((size_t)1 << order) - 1)) == 0 && !buddy_test(buddy_free_map, order, offset);
+    unlock_mutex(&buddy_lock);
+    return live ? (size_t)1 << order : 0;
+}
+
+// Offset of the block header in a huge mapping whose payload must be a
+// multiple of `alignment`
+static size_t huge_header_offset(size_t alignment) {
+    return ((HUGE_OVERHEAD + alignment - 1) & ~(alignment - 1)) - HEADER_SIZE;
+}
+
+// Alignment a huge mapping needs so its payload keeps its alignment: the
+// region alignment, or more if the payload offset is a larger power of two
+static size_t huge_map_alignment(size_t offset) {
+    size_t payload = offset + HEADER_SIZE;
+    size_t alignment = payload & (~payload + 1);
+    return alignment > REGION_ALIGN ? alignment : REGION_ALIGN;
+}
+
+// Bytes to map for a huge block with `size` bytes of payload
+static size_t huge_mapping_size(size_t offset, size_t size) {
+    return (size + offset + HEADER_SIZE + PAGE_SIZE_BYTES - 1) & ~(size_t)(PAGE_SIZE_BYTES - 1);
+}
+
+// Lay out the descriptor and block header of a huge mapping
+static block_header_t* huge_format(region_t* region, size_t mapped_size, size_t offset) {
+    region->arena = NULL;
+    region->mapped_size = mapped_size;
+    region->start = (char*)region + offset;
+    region->end = (char*)region + mapped_size;
+    
+    // The payload runs to the end of the mapping
+    block_header_t* block = (block_header_t*)region->start;
+    block->size = mapped_size - offset - HEADER_SIZE;
+    return block;
+}
+
+// Add a huge mapping to the live list and the statistics
+static void huge_link(region_t* region) {
+    lock_mutex(&huge_lock);
+    region->prev = NULL;
+    region->next = huge_list;
+    if (huge_list != NULL) {
+        huge_list->prev = region;
+    }
+    huge_list = region;
+    ALLOCATED_ADD(huge_allocated, BLOCK_SIZE((block_header_t*)region->start));
+    STAT_ADD(huge_mapped, region->mapped_size);
+    STAT_ADD(huge_size_classes[size_class_of(BLOCK_SIZE((block_header_t*)region->start))], 1);
+    unlock_mutex(&huge_lock);
+}
+
+// Remove a huge mapping from the live list and the statistics
+static void huge_unlink(region_t* region) {
+    lock_mutex(&huge_lock);
+    if (region->prev != NULL) {
+        region->prev->next = region->next;
+    } else {
+        huge_list = region->next;
+    }
+    if (region->next != NULL) {
+        region->next->prev = region->prev;
+    }
+    ALLOCATED_SUB(huge_allocated, BLOCK_SIZE((block_header_t*)region->start));
+    STAT_SUB(huge_mapped, region->mapped_size);
+    STAT_SUB(huge_size_classes[size_class_of(BLOCK_SIZE((block_header_t*)region->start))], 1);
+    unlock_mutex(&huge_lock);
+}
+
+// Find the huge mapping whose block header is at this address, or NULL
+static region_t* huge_of(const void* block) {
+    region_t* region = region_of(block);
+    if (region == NULL || region->arena != NULL || (const char*)block != region->start) {
+        return NULL;
+    }
+    return region;
+}
+
+// Give a huge block a mapping of its own, its payload a multiple of `alignment`
+static void* huge_malloc(size_t size, size_t alignment) {
+    size_t offset = huge_header_offset(alignment);
+    if (size > SIZE_MAX - offset - HEADER_SIZE - PAGE_SIZE_BYTES - huge_map_alignment(offset)) {
+        return NULL;
+    }
+    
+    size_t mapped_size = huge_mapping_size(offset, size);
+    char* base = (char*)os_map_aligned(mapped_size, huge_map_alignment(offset));
+    if (base == NULL) {
+        return NULL;
+    }
+    if (!region_map_reserve(base, mapped_size)) {
+        os_unmap(base, mapped_size);
+        return NULL;
+    }
+    
+    region_t* region = (region_t*)base;
+    block_header_t* block = huge_format(region, mapped_size, offset);
+    region_map_set(base, mapped_size, region);
+    huge_link(region);
+    
+    return (char*)block + HEADER_SIZE;
+}
+
+// Unmap a huge block
+static void huge_free(region_t* region) {
+    huge_unlink(region);
+    region_map_set(region, region->mapped_size, NULL);
+    os_unmap(region, region->mapped_size);
+}
+
+// Resize a huge block by remapping its pages. On Linux the pages are
+// extended or trimmed in place, or moved to a new aligned range with
+// mremap(), so no data is copied. The payload keeps its alignment. Returns
+// NULL, leaving the block intact, if it cannot be resized.
+static void* huge_realloc(region_t* region, size_t size) {
+    size_t offset = (size_t)(region->start - (char*)region);
+    size_t map_alignment = huge_map_alignment(offset);
+    if (size > SIZE_MAX - offset - HEADER_SIZE - PAGE_SIZE_BYTES - map_alignment) {
+        return NULL;
+    }
+    
+    char* base = (char*)region;
+    size_t old_mapped = region->mapped_size;
+    size_t new_mapped = huge_mapping_size(offset, size);
+    if (new_mapped == old_mapped) {
+        return region->start + HEADER_SIZE;
+    }
+
+#ifdef __linux__
+    // Map leaves for the grown range up front so the remap cannot fail halfway
+    if (!region_map_reserve(base, new_mapped)) {
+        return NULL;
+    }
+    
+    huge_unlink(region);
+    region_map_set(base, old_mapped, NULL);
+    
+    char* moved = (char*)mremap(base, old_mapped, new_mapped, 0);
+    if (moved == MAP_FAILED) {
+        // The following pages are taken; move into a fresh aligned range
+        char* target = (char*)os_map_aligned(new_mapped, map_alignment);
+        if (target != NULL && region_map_reserve(target, new_mapped)) {
+            moved = (char*)mremap(base, old_mapped, new_mapped, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+        }
+        if (moved == MAP_FAILED) {
+            if (target != NULL) {
+                os_unmap(target, new_mapped);
+            }
+            region_map_set(base, old_mapped, region);
+            huge_link(region);
+            return NULL;
+        }
+    }
+#else
+    // Without mremap the pages have to be copied to a new mapping
+    char* moved = (char*)os_map_aligned(new_mapped, map_alignment);
+    if (moved == NULL) {
+        return NULL;
+    }
+    if (!region_map_reserve(moved, new_mapped)) {
+        os_unmap(moved, new_mapped);
+        return NULL;
+    }
+    memcpy(moved, base, old_mapped < new_mapped ? old_mapped : new_mapped);
+    
+    huge_unlink(region);
+    region_map_set(base, old_mapped, NULL);
+    os_unmap(base, old_mapped);
+#endif
+
+    region_t* resized = (region_t*)moved;
+    block_header_t* block = huge_format(resized, new_mapped, offset);
+    region_map_set(moved, new_mapped, resized);
+    huge_link(resized);
+    
+    return (char*)block + HEADER_SIZE;
+}
+
+// Allocate a block without counting a call; my_calloc() and my_realloc()
+// count themselves
+static void* malloc_uncounted(size_t size) {
+    if (!__atomic_load_n(&allocator_initialized, __ATOMIC_ACQUIRE)) {
+        allocator_init();
+        if (!__atomic_load_n(&allocator_initialized, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+    }
+    
+    if (size == 0) {
+        return NULL;
+    }
+    
+    // No region could hold a request this close to the address space size
+    if (size > SIZE_MAX - REGION_ALIGN) {
+        printf("Error: Out of memory. Cannot allocate %zu bytes.\n", size);
+        return NULL;
+    }
+    
+    // Align the requested size; buddy blocks and slab objects have no
+    // header and round the request their own way
+    size_t requested = size;
+    size = align_size(size);
+    
+    // Huge requests get a mapping of their own, away from the heap
+    if (size >= mmap_threshold) {
+        void* ptr = huge_malloc(size, ALIGNMENT);
+        if (ptr == NULL) {
+            printf("Error: Out of memory. Cannot allocate %zu bytes.\n", size);
+        }
+        return ptr;
+    }
+    
+    // The buddy engine serves everything else while its heap has room
+    if (buddy_heap != NULL) {
+        void* ptr = buddy_malloc(requested);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    
+    // Small sizes come from slabs while the slab region has room
+    if (slab_enabled && requested <= SLAB_MAX_SIZE) {
+        void* ptr = slab_malloc(requested);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    
+    // Heap blocks must hold the free-list links and boundary tag once freed
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
+    
+    // Small sizes are served from the thread cache without any lock
+    if (tcache_enabled && size <= TCACHE_MAX_SIZE) {
+        thread_cache_t* cache = get_thread_cache();
+        size_t cls = TCACHE_CLASS(size);
+        
+        if (cache->heads[cls] != NULL || tcache_refill(cache, cls, size)) {
+            block_header_t* block = cache->heads[cls];
+            cache->heads[cls] = block->next;
+            cache->counts[cls]--;
+            block->next = NULL;
+            block->prev = NULL;
+            return (char*)block + HEADER_SIZE;
+        }
+    }
+    
+    // Everything else comes from the shared arenas
+    block_header_t* block = allocate_from_shared_arenas(size, ALIGNMENT);
+    if (block == NULL) {
+        // Free blocks are coalesced eagerly, so there is nothing to merge
+        printf("Error: Out of memory. Cannot allocate %zu bytes.\n", size);
+        return NULL;
+    }
+    
+    // Return pointer to data (after header)
+    return (char*)block + HEADER_SIZE;
+}
+
+static void* malloc_counted(size_t size) {
+    count_ops(OP_MALLOC, 1);
+    void* ptr = malloc_uncounted(size);
+    if (ptr != NULL) {
+        PROFILE_ALLOC(ptr, size);
+    }
+    if (TRACING() && ptr != NULL) {
+        trace_event(TRACE_MALLOC, size, ptr, NULL, 0);
+    }
+    return ptr;
+}
+
+// Custom malloc implementation
+void* my_malloc(size_t size) {
+    if (latency_sampled(OP_MALLOC)) {
+        long long start = now_ns();
+        void* ptr = malloc_counted(size);
+        latency_record(OP_MALLOC, start);
+        return ptr;
+    }
+    return malloc_counted(size);
+}
+
+static void* aligned_alloc_uncounted(size_t alignment, size_t size) {
+    // Every block is already this aligned
+    if (alignment <= ALIGNMENT) {
+        return malloc_uncounted(size);
+    }
+    
+    if (!__atomic_load_n(&allocator_initialized, __ATOMIC_ACQUIRE)) {
+        allocator_init();
+        if (!__atomic_load_n(&allocator_initialized, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+    }
+    
+    if (size == 0) {
+        return NULL;
+    }
+    
+    if (size > SIZE_MAX - REGION_ALIGN || alignment > SIZE_MAX / 4 - size) {
+        printf("Error: Out of memory. Cannot allocate %zu bytes.\n", size);
+        return NULL;
+    }
+    
+    size = align_size(size);
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
+    
+    // A region's first payload is never region aligned, so such alignments
+    // always take a mapping of their own, as do huge sizes
+    if (size >= mmap_threshold || alignment >= REGION_ALIGN) {
+        void* ptr = huge_malloc(size, alignment);
+        if (ptr == NULL) {
+            printf("Error: Out of memory. Cannot allocate %zu bytes.\n", size);
+        }
+        return ptr;
+    }
+    
+    // Buddy blocks are aligned to their own size
+    if (buddy_heap != NULL) {
+        void* ptr = buddy_malloc(size > alignment ? size : alignment);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    
+    block_header_t* block = allocate_from_shared_arenas(size, alignment);
+    if (block == NULL) {
+        printf("Error: Out of memory. Cannot allocate %zu bytes.\n", size);
+        return NULL;
+    }
+    
+    return (char*)block + HEADER_SIZE;
+}
+
+// Allocate `size` bytes at a multiple of `alignment`, a power of two.
+// my_free() and my_realloc() accept the result like any other block.
+void* my_aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        printf("Error: Alignment %zu is not a power of two\n", alignment);
+        return NULL;
+    }
+    
+    count_ops(OP_MALLOC, 1);
+    void* ptr = aligned_alloc_uncounted(alignment, size);
+    if (ptr != NULL) {
+        PROFILE_ALLOC(ptr, size);
+    }
+    if (TRACING() && ptr != NULL) {
+        trace_event(TRACE_ALIGNED_ALLOC, size, ptr, NULL, alignment);
+    }
+    return ptr;
+}
+
+// POSIX-style aligned allocation: the alignment must also be a multiple of
+// sizeof(void*). Returns 0, EINVAL or ENOMEM.
+int my_posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    
+    if (size == 0) {
+        *memptr = NULL;
+        return 0;
+    }
+    
+    void* ptr = my_aligned_alloc(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+// Obsolete memalign() interface, same as my_aligned_alloc()
+void* my_memalign(size_t alignment, size_t size) {
+    return my_aligned_alloc(alignment, size);
+}
+
+// Allocate `count` blocks of `size` bytes into `out_ptrs`, carving them from
+// as few free blocks as possible under one lock. Returns the number of
+// blocks allocated; on a shortfall the remaining entries are set to NULL.
+size_t my_malloc_batch(size_t size, size_t count, void** out_ptrs) {
+    if (!__atomic_load_n(&allocator_initialized, __ATOMIC_ACQUIRE)) {
+        allocator_init();
+        if (!__atomic_load_n(&allocator_initialized, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    
+    if (size == 0 || count == 0 || out_ptrs == NULL || size > SIZE_MAX - REGION_ALIGN) {
+        return 0;
+    }
+    count_ops(OP_MALLOC, count);
+    size_t requested = size;
+    
+    size = align_size(size);
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
+    
+    size_t done = 0;
+    if (size >= mmap_threshold) {
+        // Huge blocks each need a mapping of their own anyway
+        while (done < count && (out_ptrs[done] = huge_malloc(size, ALIGNMENT)) != NULL) {
+            done++;
+        }
+    } else {
+        // The buddy heap first under the buddy engine
+        while (buddy_heap != NULL && done < count && (out_ptrs[done] = buddy_malloc(requested)) != NULL) {
+            done++;
+        }
+        
+        // This thread's arena first, then the other shared arenas
+        arena_t* home = thread_arena();
+        lock_arena(home);
+        done += allocate_batch_from_arena(home, size, count - done, out_ptrs + done);
+        unlock_arena(home);
+        
+        for (int i = 0; done < count && i < num_shared_arenas; i++) {
+            arena_t* arena = arena_table[i];
+            if (arena == home) {
+                continue;
+            }
+            lock_arena(arena);
+            done += allocate_batch_from_arena(arena, size, count - done, out_ptrs + done);
+            unlock_arena(arena);
+        }
+    }
+    
+    if (done < count) {
+        printf("Error: Out of memory. Allocated %zu of %zu blocks of %zu bytes.\n", done, count, size);
+        for (size_t i = done; i < count; i++) {
+            out_ptrs[i] = NULL;
+        }
+    }
+    
+    for (size_t i = 0; i < done; i++) {
+        PROFILE_ALLOC(out_ptrs[i], requested);
+    }
+    if (TRACING()) {
+        pthread_mutex_lock(&trace_lock);
+        for (size_t i = 0; i < done; i++) {
+            trace_append(TRACE_MALLOC, requested, out_ptrs[i], NULL, 0);
+        }
+        pthread_mutex_unlock(&trace_lock);
+    }
+    return done;
+}
+
+// Free a block without counting a call
+static void free_uncounted(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    
+    // Slab objects have no header; the address identifies them
+    if (slab_owns(ptr)) {
+        slab_free(ptr);
+        return;
+    }
+    
+    // So do buddy blocks
+    if (buddy_owns(ptr)) {
+        buddy_free(ptr);
+        return;
+    }
+    
+    // Get block header from pointer
+    block_header_t* block = (block_header_t*)((char*)ptr - HEADER_SIZE);
+    
+    // Huge blocks give their whole mapping back
+    region_t* huge = huge_of(block);
+    if (huge != NULL) {
+        huge_free(huge);
+        return;
+    }
+    
+    // Validate pointer and find the arena it came from
+    arena_t* arena = arena_of(block);
+    if (arena == NULL) {
+        printf("Error: Invalid pointer passed to my_free\n");
+        return;
+    }
+    
+    if (block->prev == TCACHE_MARK || block->prev == REMOTE_MARK) {
+        printf("Error: Double free detected\n");
+        return;
+    }
+    
+    // Small blocks go to the thread cache, overflowing in batches
+    if (tcache_enabled && !arena->is_private && BLOCK_SIZE(block) <= TCACHE_MAX_SIZE && !BLOCK_IS_FREE(block)) {
+        thread_cache_t* cache = get_thread_cache();
+        size_t cls = TCACHE_CLASS(BLOCK_SIZE(block));
+        
+        block->next = cache->heads[cls];
+        block->prev = TCACHE_MARK;
+        cache->heads[cls] = block;
+        if (++cache->counts[cls] > TCACHE_CAPACITY) {
+            tcache_flush(cache, cls, TCACHE_CAPACITY / 2);
+        }
+        return;
+    }
+    
+    // Another thread's block goes to its owner without waiting for the lock;
+    // the owner checks it when it next allocates
+    if (remote_free_enabled && !arena->is_private && arena != thread_arena()) {
+        remote_free(arena, block);
+        return;
+    }
+    
+    lock_arena(arena);
+    
+    if (BLOCK_IS_FREE(block)) {
+        unlock_arena(arena);
+        printf("Error: Double free detected\n");
+        return;
+    }
+    
+    release_to_arena(arena, block);
+    
+    unlock_arena(arena);
+}
+
+// Check whether a pointer is a block of this allocator's
+int my_owns(const void* ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    const block_header_t* block = (const block_header_t*)((const char*)ptr - HEADER_SIZE);
+    return slab_owns(ptr) || buddy_owns(ptr) || huge_of(block) != NULL || arena_of(block) != NULL;
+}
+
+// Get the bytes usable at an allocated block, at least as many as were asked for
+size_t my_usable_size(const void* ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    if (slab_owns(ptr)) {
+        return slab_of(ptr)->object_size;
+    }
+    if (buddy_owns(ptr)) {
+        return buddy_block_size(ptr);
+    }
+    const block_header_t* block = (const block_header_t*)((const char*)ptr - HEADER_SIZE);
+    if (huge_of(block) != NULL || arena_of(block) != NULL) {
+        return BLOCK_SIZE(block);
+    }
+    return 0;
+}
+
+static void free_counted(void* ptr) {
+    count_ops(OP_FREE, 1);
+    PROFILE_FREE(ptr);
+    if (TRACING() && ptr != NULL) {
+        trace_event(TRACE_FREE, 0, ptr, NULL, 0);
+    }
+    free_uncounted(ptr);
+}
+
+// Custom free implementation
+void my_free(void* ptr) {
+    if (latency_sampled(OP_FREE)) {
+        long long start = now_ns();
+        free_counted(ptr);
+        latency_record(OP_FREE, start);
+        return;
+    }
+    free_counted(ptr);
+}
+
+static int compare_addresses(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(void* const*)a;
+    uintptr_t y = (uintptr_t)*(void* const*)b;
+    return (x > y) - (x < y);
+}
+
+// Free `count` blocks at once. The pointers are sorted by address (the array
+// is reordered) so that runs of physically adjacent blocks are merged into a
+// single free block, with one coalesce and one free-list insertion per run.
+// Blocks bypass the thread cache. NULL entries are skipped.
+void my_free_batch(void** ptrs, size_t count) {
+    if (ptrs == NULL || count == 0) {
+        return;
+    }
+    count_ops(OP_FREE, count);
+    for (size_t i = 0; i < count; i++) {
+        PROFILE_FREE(ptrs[i]);
+    }
+    if (TRACING()) {
+        pthread_mutex_lock(&trace_lock);
+        for (size_t i = 0; i < count; i++) {
+            if (ptrs[i] != NULL) {
+                trace_append(TRACE_FREE, 0, ptrs[i], NULL, 0);
+            }
+        }
+        pthread_mutex_unlock(&trace_lock);
+    }
+    
+    qsort(ptrs, count, sizeof(void*), compare_addresses);
+    
+    arena_t* locked = NULL;
+    size_t i = 0;
+    while (i < count) {
+        void* ptr = ptrs[i++];
+        if (ptr == NULL) {
+            continue;
+        }
+        
+        block_header_t* block = (block_header_t*)((char*)ptr - HEADER_SIZE);
+        arena_t* arena = (slab_owns(ptr) || buddy_owns(ptr)) ? NULL : arena_of(block);
+        if (arena == NULL) {
+            // Slab objects, buddy and huge blocks, and bad pointers take the usual path
+            if (locked != NULL) {
+                unlock_arena(locked);
+                locked = NULL;
+            }
+            free_uncounted(ptr);
+            continue;
+        }
+        
+        // Sorted blocks usually share an arena, so keep its lock
+        if (arena != locked) {
+            if (locked != NULL) {
+                unlock_arena(locked);
+            }
+            locked = arena;
+            lock_arena(locked);
+        }
+        
+        if (BLOCK_IS_FREE(block) || block->prev == TCACHE_MARK || block->prev == REMOTE_MARK) {
+            printf("Error: Double free detected\n");
+            continue;
+        }
+        
+        // Absorb the following pointers while they are the next physical block
+        size_t freed = BLOCK_SIZE(block);
+        arena_uncount_block(arena, BLOCK_SIZE(block));
+        while (i < count) {
+            block_header_t* next = next_physical_block(block);
+            if ((char*)ptrs[i] != (char*)next + HEADER_SIZE || BLOCK_SIZE(next) == 0 || BLOCK_IS_FREE(next) ||
+                next->prev == TCACHE_MARK || next->prev == REMOTE_MARK) {
+                break;
+            }
+            next->size |= BLOCK_FREE; // Catches the same pointer appearing twice
+            freed += BLOCK_SIZE(next);
+            arena_uncount_block(arena, BLOCK_SIZE(next));
+            block->size += HEADER_SIZE + BLOCK_SIZE(next);
+            i++;
+        }
+        
+        block->size |= BLOCK_FREE;
+        ALLOCATED_SUB(arena->allocated, freed);
+        STAT_ADD(arena->free, BLOCK_SIZE(block));
+        block = coalesce_block(arena, block);
+        arena_add_free(arena, block);
+        purge_after_free(arena, block);
+    }
+    
+    if (locked != NULL) {
+        unlock_arena(locked);
+    }
+}
+
+// Resize a block whose payload is a multiple of `alignment`, keeping it so.
+// Blocks resized in place keep their address; a moved block is aligned anew.
+static void* realloc_uncounted(void* ptr, size_t alignment, size_t size) {
+    if (ptr == NULL) {
+        return aligned_alloc_uncounted(alignment, size);
+    }
+    
+    if (size == 0) {
+        free_uncounted(ptr);
+        return NULL;
+    }
+    
+    block_header_t* block = (block_header_t*)((char*)ptr - HEADER_SIZE);
+    arena_t* arena = NULL;
+    region_t* huge = NULL;
+    size_t old_size;
+    
+    if (slab_owns(ptr)) {
+        // Slab objects keep their slot while the new size still fits
+        old_size = slab_of(ptr)->object_size;
+        if (size <= old_size) {
+            return ptr;
+        }
+    } else if (buddy_owns(ptr)) {
+        // As do buddy blocks
+        old_size = buddy_block_size(ptr);
+        if (old_size == 0) {
+            printf("Error: Invalid pointer passed to my_realloc\n");
+            return NULL;
+        }
+        if (size <= old_size) {
+            return ptr;
+        }
+    } else if ((huge = huge_of(block)) != NULL) {
+        // Huge blocks are remapped rather than copied while they stay huge
+        old_size = BLOCK_SIZE(block);
+        if (size >= mmap_threshold) {
+            void* resized = huge_realloc(huge, size);
+            if (resized != NULL) {
+                return resized;
+            }
+            if (size <= old_size) {
+                return ptr;
+            }
+        }
+    } else {
+        arena = arena_of(block);
+        if (arena == NULL) {
+            printf("Error: Invalid pointer passed to my_realloc\n");
+            return NULL;
+        }
+        
+        size_t aligned = align_size(size);
+        if (aligned < MIN_BLOCK_SIZE) {
+            aligned = MIN_BLOCK_SIZE;
+        }
+        
+        // Shrink in place, or grow into a free right neighbour unless the
+        // block is becoming huge and should move to a mapping of its own
+        lock_arena(arena);
+        old_size = BLOCK_SIZE(block);
+        int resized = (aligned <= old_size || aligned < mmap_threshold || arena->is_private) &&
+                      resize_in_place(arena, block, aligned);
+        unlock_arena(arena);
+        
+        if (resized) {
+            return ptr;
+        }
+    }
+    
+    // Allocate new block, keeping private arena blocks in their arena
+    void* new_ptr = (arena != NULL && arena->is_private) ? arena_allocate(arena, size, alignment)
+                                                         : aligned_alloc_uncounted(alignment, size);
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+    
+    // Copy old data to new block
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    
+    // Free old block
+    free_uncounted(ptr);
+    
+    return new_ptr;
+}
+
+static void* realloc_counted(void* ptr, size_t alignment, size_t size) {
+    count_ops(OP_REALLOC, 1);
+    
+    // The heap profile counts a resize as a free and a new allocation, once
+    // it has succeeded; a failed one leaves the block and its sample alone.
+    // A moved block is freed inside the call, so a sampled one keeps
+    // profile_lock until its sample is gone, before anyone can sample a
+    // block reusing its address.
+    int sampled = PROFILE_MAYBE_SAMPLED(ptr);
+    if (sampled) {
+        pthread_mutex_lock(&profile_lock);
+    }
+    void* new_ptr;
+    if (!TRACING()) {
+        new_ptr = realloc_uncounted(ptr, alignment, size);
+    } else {
+        // Moving frees the old block inside the call, so hold the trace lock
+        // until it is recorded, before anyone can record reusing its address
+        pthread_mutex_lock(&trace_lock);
+        new_ptr = realloc_uncounted(ptr, alignment, size);
+        if (new_ptr != NULL || size == 0) {
+            trace_append(TRACE_REALLOC, size, new_ptr, ptr, 0);
+        }
+        pthread_mutex_unlock(&trace_lock);
+    }
+    if (sampled) {
+        if (new_ptr != NULL || size == 0) {
+            profile_forget_locked(ptr);
+        }
+        pthread_mutex_unlock(&profile_lock);
+    }
+    if (new_ptr != NULL) {
+        PROFILE_ALLOC(new_ptr, size);
+    }
+    return new_ptr;
+}
+
+// Custom realloc implementation
+void* my_realloc(void* ptr, size_t size) {
+    if (latency_sampled(OP_REALLOC)) {
+        long long start = now_ns();
+        void* new_ptr = realloc_counted(ptr, ALIGNMENT, size);
+        latency_record(OP_REALLOC, start);
+        return new_ptr;
+    }
+    return realloc_counted(ptr, ALIGNMENT, size);
+}
+
+// Resize a block from my_aligned_alloc(), keeping its payload a multiple of
+// `alignment`, a power of two
+void* my_aligned_realloc(void* ptr, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        printf("Error: Alignment %zu is not a power of two\n", alignment);
+        return NULL;
+    }
+    return realloc_counted(ptr, alignment, size);
+}
+
+static void* calloc_counted(size_t num, size_t size) {
+    count_ops(OP_CALLOC, 1);
+    size_t total_size = num * size;
+    
+    // Check for overflow
+    if (num != 0 && total_size / num != size) {
+        return NULL;
+    }
+    
+    // Fresh huge mappings are already zeroed by the OS
+    void* ptr = malloc_uncounted(total_size);
+    if (ptr != NULL && huge_of((char*)ptr - HEADER_SIZE) == NULL) {
+        memset(ptr, 0, total_size);
+    }
+    
+    if (ptr != NULL) {
+        PROFILE_ALLOC(ptr, total_size);
+    }
+    if (TRACING() && ptr != NULL) {
+        trace_event(TRACE_CALLOC, total_size, ptr, NULL, 0);
+    }
+    return ptr;
+}
+
+// Custom calloc implementation
+void* my_calloc(size_t num, size_t size) {
+    if (latency_sampled(OP_CALLOC)) {
+        long long start = now_ns();
+        void* ptr = calloc_counted(num, size);
+        latency_record(OP_CALLOC, start);
+        return ptr;
+    }
+    return calloc_counted(num, size);
+}
+
+// Create a private arena whose first region holds at least `size` bytes;
+// like the shared arenas it grows by further regions on demand
+arena_t* arena_create(size_t size) {
+    if (!__atomic_load_n(&allocator_initialized, __ATOMIC_ACQUIRE)) {
+        allocator_init();
+    }
+    
+    arena_t* arena = arena_map(size);
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->is_private = 1;
+    
+    pthread_mutex_lock(&init_lock);
+    int registered = arena_register(arena);
+    pthread_mutex_unlock(&init_lock);
+    
+    if (!registered) {
+        arena_unmap(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+// Destroy a private arena, releasing every block still allocated from it
+void arena_destroy(arena_t* arena) {
+    if (arena == NULL || !arena->is_private) {
+        return;
+    }
+    
+    pthread_mutex_lock(&init_lock);
+    arena_release(arena);
+    pthread_mutex_unlock(&init_lock);
+}
+
+// Allocate from an explicit arena without counting a call
+static void* arena_allocate(arena_t* arena, size_t size, size_t alignment) {
+    if (arena == NULL || size == 0 || size > SIZE_MAX - REGION_ALIGN) {
+        return NULL;
+    }
+    
+    size = align_size(size);
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
+    
+    lock_arena(arena);
+    block_header_t* block = alignment > ALIGNMENT ? allocate_aligned_from_arena(arena, size, alignment)
+                                                  : allocate_from_arena(arena, size);
+    unlock_arena(arena);
+    
+    if (block == NULL) {
+        printf("Error: Out of memory. Cannot allocate %zu bytes.\n", size);
+        return NULL;
+    }
+    
+    return (char*)block + HEADER_SIZE;
+}
+
+// Allocate from an explicit arena
+void* arena_malloc(arena_t* arena, size_t size) {
+    count_ops(OP_MALLOC, 1);
+    return arena_allocate(arena, size, ALIGNMENT);
+}
+
+// Unmap the regions of a locked arena that hold nothing but one free block,
+// keeping at least one region. Returns the bytes unmapped.
+static size_t trim_regions(arena_t* arena) {
+    size_t released = 0;
+    region_t** link = &arena->regions;
+    
+    while (*link != NULL) {
+        region_t* region = *link;
+        block_header_t* first = (block_header_t*)region->start;
+        int empty = BLOCK_IS_FREE(first) && (char*)next_physical_block(first) == region->end;
+        if (!empty || (link == &arena->regions && region->next == NULL)) {
+            link = &region->next;
+            continue;
+        }
+        
+        arena_remove_free(arena, first);
+        STAT_SUB(arena->free, BLOCK_SIZE(first));
+        STAT_SUB(arena->heap_size, region->mapped_size);
+        *link = region->next;
+        region_map_set(region, region->mapped_size, NULL);
+        released += region->mapped_size;
+        os_unmap(region, region->mapped_size);
+    }
+    
+    return released;
+}
+
+// Give free memory back to the OS: purge the pages of every free block and
+// unmap regions that are completely free. Returns the bytes released.
+size_t my_trim(void) {
+    size_t released = 0;
+    
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = arena_table[i];
+        if (arena == NULL) {
+            continue;
+        }
+        lock_arena(arena);
+        arena_drain_remote(arena);
+        released += trim_regions(arena);
+        released += purge_arena(arena, PAGE_SIZE_BYTES);
+        unlock_arena(arena);
+    }
+    
+    return released;
+}
+
+// Get memory allocated from one arena
+size_t arena_get_allocated(const arena_t* arena) {
+    return __atomic_load_n(&arena->allocated, __ATOMIC_RELAXED);
+}
+
+// Get free memory in one arena
+size_t arena_get_free(const arena_t* arena) {
+    return __atomic_load_n(&arena->free, __ATOMIC_RELAXED);
+}
+
+// Get total allocated memory
+size_t get_total_allocated(void) {
+    size_t total = 0;
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = __atomic_load_n(&arena_table[i], __ATOMIC_ACQUIRE);
+        if (arena != NULL) {
+            total += arena_get_allocated(arena);
+        }
+    }
+    if (slab_enabled) {
+        for (int i = 0; i < SLAB_CLASSES; i++) {
+            total += __atomic_load_n(&slab_classes[i].allocated, __ATOMIC_RELAXED);
+        }
+    }
+    total += __atomic_load_n(&buddy_allocated, __ATOMIC_RELAXED);
+    total += __atomic_load_n(&huge_allocated, __ATOMIC_RELAXED);
+    return total;
 }
 
-// Add block to the free list
-void add_to_free_list(block_header_t* block) {
-    if (free_list_head == NULL) {
-        free_list_head = block;
-        block->next = NULL;
-        block->prev = NULL;
-        return;
+// Get total free memory
+size_t get_total_free(void) {
+    size_t total = 0;
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = __atomic_load_n(&arena_table[i], __ATOMIC_ACQUIRE);
+        if (arena != NULL) {
+            total += arena_get_free(arena);
+        }
     }
-    
-    // Insert at the beginning of the free list
-    block->next = free_list_head;
-    block->prev = NULL;
-    if (free_list_head) {
-        free_list_head->prev = block;
+    if (slab_enabled) {
+        for (int i = 0; i < SLAB_CLASSES; i++) {
+            total += __atomic_load_n(&slab_classes[i].free, __ATOMIC_RELAXED);
+        }
+    }
+    if (buddy_heap != NULL) {
+        total += BUDDY_HEAP_SIZE - __atomic_load_n(&buddy_allocated, __ATOMIC_RELAXED);
     }
-    free_list_head = block;
+    return total;
 }
 
-// Remove block from the free list
-void remove_from_free_list(block_header_t* block) {
-    if (block->prev) {
-        block->prev->next = block->next;
-    } else {
-        free_list_head = block->next;
+// Count memory fragmentation (number of free blocks) from the arenas' counters
+int get_fragmentation_count(void) {
+    size_t count = 0;
+    
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = __atomic_load_n(&arena_table[i], __ATOMIC_ACQUIRE);
+        if (arena != NULL) {
+            count += __atomic_load_n(&arena->free_blocks, __ATOMIC_RELAXED);
+        }
     }
     
-    if (block->next) {
-        block->next->prev = block->prev;
+    if (buddy_heap != NULL) {
+        count += __atomic_load_n(&buddy_free_blocks, __ATOMIC_RELAXED);
     }
     
-    block->next = NULL;
-    block->prev = NULL;
+    return (int)count;
 }
 
-// Merge adjacent free blocks
-void merge_free_blocks(void) {
-    char* heap_start = heap;
-    char* heap_end = heap + HEAP_SIZE;
-    char* current_pos = heap_start;
-    
-    while (current_pos < heap_end) {
-        block_header_t* current_block = (block_header_t*)current_pos;
-        
-        if (current_block->is_free) {
-            char* next_pos = current_pos + HEADER_SIZE + current_block->size;
-            
-            // Check if next block exists and is adjacent
-            if (next_pos < heap_end) {
-                block_header_t* next_block = (block_header_t*)next_pos;
-                
-                if (next_block->is_free) {
-                    // Merge blocks
-                    remove_from_free_list(next_block);
-                    current_block->size += HEADER_SIZE + next_block->size;
-                    continue; // Don't advance current_pos, check for more merges
-                }
-            }
-        }
-        
-        current_pos += HEADER_SIZE + current_block->size;
+// Get the largest free block of an arena without its lock: the cached
+// largest size of its highest non-empty bin. Bins, bitmaps and sizes are
+// stored atomically, so a concurrent update gives a size from just before
+// or after it.
+static size_t arena_largest_free(arena_t* arena) {
+    uint64_t words = __atomic_load_n(&arena->bin_summary, __ATOMIC_RELAXED);
+    if (words == 0) {
+        return 0;
+    }
+    int word = 63 - __builtin_clzll(words);
+    uint64_t bits = __atomic_load_n(&arena->bin_bitmap[word], __ATOMIC_RELAXED);
+    if (bits == 0) {
+        return 0;
     }
+    return __atomic_load_n(&arena->bin_largest[word * 64 + 63 - __builtin_clzll(bits)], __ATOMIC_RELAXED);
 }
 
-// Custom malloc implementation
-void* my_malloc(size_t size) {
-    if (!allocator_initialized) {
-        allocator_init();
+// Get the largest free block of any heap, from the cached sizes and
+// bitmaps alone
+size_t get_largest_free_block(void) {
+    size_t largest = 0;
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = __atomic_load_n(&arena_table[i], __ATOMIC_ACQUIRE);
+        size_t block = arena != NULL ? arena_largest_free(arena) : 0;
+        if (block > largest) {
+            largest = block;
+        }
     }
-    
-    if (size == 0) {
-        return NULL;
+    if (buddy_heap != NULL) {
+        uint32_t orders = __atomic_load_n(&buddy_nonempty, __ATOMIC_RELAXED);
+        size_t block = orders != 0 ? (size_t)1 << (BUDDY_MIN_ORDER + 31 - __builtin_clz(orders)) : 0;
+        if (block > largest) {
+            largest = block;
+        }
     }
+    return largest;
+}
+
+// Fill in the live statistics. Every figure is kept up to date as blocks
+// come and go, so this reads a fixed set of counters without taking any
+// lock or walking any list.
+void my_get_stats(allocator_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->heap_size = get_heap_size();
+    stats->allocated_bytes = get_total_allocated();
+    stats->free_bytes = get_total_free();
+    stats->free_blocks = (size_t)get_fragmentation_count();
+    stats->largest_free_block = get_largest_free_block();
     
-    // Align the requested size
-    size = align_size(size);
-    
-    // Ensure minimum block size
-    if (size < MIN_BLOCK_SIZE) {
-        size = MIN_BLOCK_SIZE;
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = __atomic_load_n(&arena_table[i], __ATOMIC_ACQUIRE);
+        if (arena == NULL) {
+            continue;
+        }
+        stats->allocated_blocks += __atomic_load_n(&arena->blocks, __ATOMIC_RELAXED);
+        for (int cls = 0; cls < STATS_SIZE_CLASSES; cls++) {
+            stats->size_classes[cls] += __atomic_load_n(&arena->size_classes[cls], __ATOMIC_RELAXED);
+        }
     }
     
-    // Find a suitable free block
-    block_header_t* block = find_free_block(size);
-    
-    if (block == NULL) {
-        // Try to merge free blocks and search again
-        merge_free_blocks();
-        block = find_free_block(size);
-        
-        if (block == NULL) {
-            printf("Error: Out of memory. Cannot allocate %zu bytes.\n", size);
-            return NULL;
+    // Slab objects of a class all have the same size
+    if (slab_enabled) {
+        for (int i = 0; i < SLAB_CLASSES; i++) {
+            size_t object_size = (size_t)(i + 1) * SLAB_CLASS_STEP;
+            size_t objects = __atomic_load_n(&slab_classes[i].allocated, __ATOMIC_RELAXED) / object_size;
+            stats->allocated_blocks += objects;
+            stats->size_classes[size_class_of(object_size)] += objects;
         }
     }
     
-    // Remove block from free list
-    remove_from_free_list(block);
-    
-    // Split block if it's larger than needed
-    split_block(block, size);
-    
-    // Mark block as allocated
-    block->is_free = 0;
+    if (buddy_heap != NULL) {
+        for (size_t order = BUDDY_MIN_ORDER; order <= BUDDY_MAX_ORDER; order++) {
+            size_t blocks = __atomic_load_n(&buddy_blocks[order - BUDDY_MIN_ORDER], __ATOMIC_RELAXED);
+            stats->allocated_blocks += blocks;
+            stats->size_classes[order] += blocks;
+        }
+    }
     
-    // Update statistics
-    total_allocated += block->size;
-    total_free -= block->size;
+    stats->peak_allocated = __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+    for (int cls = 0; cls < STATS_SIZE_CLASSES; cls++) {
+        size_t blocks = __atomic_load_n(&huge_size_classes[cls], __ATOMIC_RELAXED);
+        stats->allocated_blocks += blocks;
+        stats->size_classes[cls] += blocks;
+    }
     
-    // Return pointer to data (after header)
-    return (char*)block + HEADER_SIZE;
+    unsigned long long calls[OP_KINDS];
+    op_totals(calls);
+    stats->malloc_calls = calls[OP_MALLOC] - ops_baseline[OP_MALLOC];
+    stats->calloc_calls = calls[OP_CALLOC] - ops_baseline[OP_CALLOC];
+    stats->realloc_calls = calls[OP_REALLOC] - ops_baseline[OP_REALLOC];
+    stats->free_calls = calls[OP_FREE] - ops_baseline[OP_FREE];
 }
 
-// Custom free implementation
-void my_free(void* ptr) {
-    if (ptr == NULL) {
-        return;
-    }
-    
-    // Get block header from pointer
-    block_header_t* block = (block_header_t*)((char*)ptr - HEADER_SIZE);
+// Rewrite the export under its sequence lock: odd while writing, so a
+// reader that sees the same even sequence before and after copying has a
+// consistent snapshot
+static void export_publish(void) {
+    static stats_export_t update; // Publisher thread only
     
-    // Validate pointer
-    if ((char*)block < heap || (char*)block >= heap + HEAP_SIZE) {
-        printf("Error: Invalid pointer passed to my_free\n");
+    // Arenas are only created and destroyed under init_lock; skip a turn
+    // rather than wait for one
+    if (pthread_mutex_trylock(&init_lock) != 0) {
         return;
     }
-    
-    if (block->is_free) {
-        printf("Error: Double free detected\n");
-        return;
+    if (allocator_initialized) {
+        my_get_stats(&update.stats);
     }
+    pthread_mutex_unlock(&init_lock);
     
-    // Mark block as free
-    block->is_free = 1;
-    
-    // Update statistics
-    total_allocated -= block->size;
-    total_free += block->size;
-    
-    // Add block back to free list
-    add_to_free_list(block);
+    pthread_mutex_lock(&op_counts_lock);
+    memcpy(update.latency, retired_latency, sizeof(update.latency));
+    for (op_counts_t* counts = op_counts_list; counts != NULL; counts = counts->next) {
+        for (int kind = 0; kind < LATENCY_KINDS; kind++) {
+            for (int i = 0; i < LATENCY_BUCKETS; i++) {
+                update.latency[kind][i] += __atomic_load_n(&counts->latency[kind][i], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    pthread_mutex_unlock(&op_counts_lock);
     
-    // Merge adjacent free blocks
-    merge_free_blocks();
+    uint64_t sequence = export_map->sequence;
+    __atomic_store_n(&export_map->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    export_map->updates++;
+    export_map->timestamp_ns = (uint64_t)now_ns();
+    export_map->stats = update.stats;
+    memcpy(export_map->latency, update.latency, sizeof(update.latency));
+    __atomic_store_n(&export_map->sequence, sequence + 2, __ATOMIC_RELEASE);
 }
 
-// Custom realloc implementation
-void* my_realloc(void* ptr, size_t size) {
-    if (ptr == NULL) {
-        return my_malloc(size);
+static void* export_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&export_lock);
+    while (exporting) {
+        pthread_mutex_unlock(&export_lock);
+        export_publish();
+        pthread_mutex_lock(&export_lock);
+        
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        long long nanoseconds = wake.tv_nsec + (long long)export_interval_ms * 1000000;
+        wake.tv_sec += (time_t)(nanoseconds / 1000000000);
+        wake.tv_nsec = (long)(nanoseconds % 1000000000);
+        while (exporting && pthread_cond_timedwait(&export_wake, &export_lock, &wake) == 0) {
+        }
     }
-    
-    if (size == 0) {
-        my_free(ptr);
-        return NULL;
+    pthread_mutex_unlock(&export_lock);
+    return NULL;
+}
+
+// Start publishing the statistics to a shared file at `path` (NULL for
+// STATS_EXPORT_PREFIX and the pid) every `interval_ms` milliseconds (0 for
+// DEFAULT_EXPORT_INTERVAL_MS). The file is removed when stopped. Returns 1
+// on success.
+int my_stats_export_start(const char* path, int interval_ms) {
+#ifdef _WIN32
+    (void)path;
+    (void)interval_ms;
+    printf("Error: Statistics export needs POSIX shared memory\n");
+    return 0;
+#else
+    pthread_mutex_lock(&export_lock);
+    if (exporting) {
+        pthread_mutex_unlock(&export_lock);
+        printf("Error: Statistics are already being exported\n");
+        return 0;
     }
     
-    block_header_t* block = (block_header_t*)((char*)ptr - HEADER_SIZE);
-    size_t old_size = block->size;
-    
-    // If new size fits in current block, no need to reallocate
-    if (size <= old_size) {
-        return ptr;
+    if (path != NULL) {
+        snprintf(export_path, sizeof(export_path), "%s", path);
+    } else {
+        snprintf(export_path, sizeof(export_path), "%s%ld", STATS_EXPORT_PREFIX, (long)getpid());
     }
-    
-    // Allocate new block
-    void* new_ptr = my_malloc(size);
-    if (new_ptr == NULL) {
-        return NULL;
+    int fd = open(export_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    void* map = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, sizeof(stats_export_t)) == 0) {
+        map = mmap(NULL, sizeof(stats_export_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (map == MAP_FAILED) {
+        if (fd >= 0) {
+            unlink(export_path);
+        }
+        pthread_mutex_unlock(&export_lock);
+        printf("Error: Cannot export statistics to %s\n", export_path);
+        return 0;
     }
     
-    // Copy old data to new block
-    memcpy(new_ptr, ptr, old_size);
-    
-    // Free old block
-    my_free(ptr);
+    export_map = (stats_export_t*)map;
+    export_map->version = STATS_EXPORT_VERSION;
+    export_map->size = sizeof(stats_export_t);
+    export_map->pid = (uint32_t)getpid();
+    export_interval_ms = interval_ms > 0 ? interval_ms : DEFAULT_EXPORT_INTERVAL_MS;
+    export_map->interval_ms = (uint32_t)export_interval_ms;
+    __atomic_store_n(&exporting, 1, __ATOMIC_RELAXED);
+    export_publish();
     
-    return new_ptr;
+    // The magic goes in last: a reader that finds it finds a whole update
+    __atomic_store_n(&export_map->magic, STATS_EXPORT_MAGIC, __ATOMIC_RELEASE);
+    if (pthread_create(&export_thread, NULL, export_main, NULL) != 0) {
+        __atomic_store_n(&exporting, 0, __ATOMIC_RELAXED);
+        munmap(export_map, sizeof(stats_export_t));
+        export_map = NULL;
+        unlink(export_path);
+        pthread_mutex_unlock(&export_lock);
+        printf("Error: Cannot start the statistics publisher\n");
+        return 0;
+    }
+    pthread_mutex_unlock(&export_lock);
+    return 1;
+#endif
 }
 
-// Custom calloc implementation
-void* my_calloc(size_t num, size_t size) {
-    size_t total_size = num * size;
-    
-    // Check for overflow
-    if (num != 0 && total_size / num != size) {
-        return NULL;
+// Stop publishing and remove the export file
+void my_stats_export_stop(void) {
+#ifndef _WIN32
+    pthread_mutex_lock(&export_lock);
+    if (!exporting) {
+        pthread_mutex_unlock(&export_lock);
+        return;
     }
+    __atomic_store_n(&exporting, 0, __ATOMIC_RELAXED);
+    pthread_cond_signal(&export_wake);
+    pthread_mutex_unlock(&export_lock);
+    pthread_join(export_thread, NULL);
     
-    void* ptr = my_malloc(total_size);
-    if (ptr != NULL) {
-        memset(ptr, 0, total_size);
+    munmap(export_map, sizeof(stats_export_t));
+    export_map = NULL;
+    unlink(export_path);
+#endif
+}
+
+// Get the bytes mapped for every arena's regions
+size_t get_heap_size(void) {
+    size_t total = 0;
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = __atomic_load_n(&arena_table[i], __ATOMIC_ACQUIRE);
+        if (arena != NULL) {
+            total += __atomic_load_n(&arena->heap_size, __ATOMIC_RELAXED);
+        }
     }
-    
-    return ptr;
+    return total;
 }
 
-// Get total allocated memory
-size_t get_total_allocated(void) {
-    return total_allocated;
+// Get the free bytes whose pages have been returned to the OS
+size_t get_purged_bytes(void) {
+    size_t total = 0;
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = __atomic_load_n(&arena_table[i], __ATOMIC_ACQUIRE);
+        if (arena != NULL) {
+            total += __atomic_load_n(&arena->purged, __ATOMIC_RELAXED);
+        }
+    }
+    return total;
 }
 
-// Get total free memory
-size_t get_total_free(void) {
-    return total_free;
+// Get the free bytes that are still resident
+size_t get_dirty_bytes(void) {
+    size_t total = 0;
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = __atomic_load_n(&arena_table[i], __ATOMIC_ACQUIRE);
+        if (arena != NULL) {
+            size_t free_bytes = arena_get_free(arena);
+            size_t purged = __atomic_load_n(&arena->purged, __ATOMIC_RELAXED);
+            total += free_bytes > purged ? free_bytes - purged : 0;
+        }
+    }
+    return total;
 }
 
-// Count memory fragmentation (number of free blocks)
-int get_fragmentation_count(void) {
-    int count = 0;
-    block_header_t* current = free_list_head;
-    
-    while (current != NULL) {
-        if (current->is_free) {
-            count++;
+// Estimate the mapped bytes that are resident: everything mapped minus purged pages
+size_t get_resident_bytes(void) {
+    size_t total = get_heap_size() + __atomic_load_n(&huge_mapped, __ATOMIC_RELAXED);
+    if (slab_enabled) {
+        total += (size_t)(__atomic_load_n(&slab_region_top, __ATOMIC_ACQUIRE) - slab_region);
+    }
+    size_t purged = get_purged_bytes();
+    return total > purged ? total - purged : 0;
+}
+
+// Visit every block of every arena, region by region in address order
+void heap_walk(heap_visit_fn visit, void* context) {
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = arena_table[i];
+        if (arena == NULL) {
+            continue;
+        }
+        
+        lock_arena(arena);
+        for (region_t* region = arena->regions; region != NULL; region = region->next) {
+            char* current_pos = region->start;
+            while (current_pos < region->end) {
+                block_header_t* block = (block_header_t*)current_pos;
+                visit(block, context);
+                current_pos += HEADER_SIZE + BLOCK_SIZE(block);
+            }
         }
-        current = current->next;
+        unlock_arena(arena);
     }
-    
-    return count;
 }
 
 // Print heap status
 void print_heap_status(void) {
     printf("\n=== Heap Status ===\n");
-    printf("Total heap size: %d bytes\n", HEAP_SIZE);
-    printf("Total allocated: %zu bytes\n", total_allocated);
-    printf("Total free: %zu bytes\n", total_free);
+    printf("Total heap size: %zu bytes\n", get_heap_size());
+    printf("Total allocated: %zu bytes\n", get_total_allocated());
+    printf("Total free: %zu bytes\n", get_total_free());
     printf("Fragmentation: %d free blocks\n", get_fragmentation_count());
+    if (slab_enabled) {
+        printf("Slab memory: %zu bytes in use\n", (size_t)(slab_region_top - slab_region));
+    }
+    if (buddy_heap != NULL) {
+        printf("Buddy heap: %zu of %zu bytes in use, %zu free blocks\n", buddy_allocated, BUDDY_HEAP_SIZE,
+               buddy_free_blocks);
+    }
+    if (huge_mapped > 0) {
+        printf("Huge mappings: %zu bytes\n", huge_mapped);
+    }
+    printf("Resident: %zu bytes (%zu dirty, %zu purged)\n", get_resident_bytes(), get_dirty_bytes(),
+           get_purged_bytes());
     printf("==================\n\n");
 }
 
-// Validate heap integrity
-int validate_heap(void) {
-    char* heap_start = heap;
-    char* heap_end = heap + HEAP_SIZE;
-    char* current_pos = heap_start;
+// Sum the hot-path instrumentation of every thread, live or exited
+int my_get_probe_stats(probe_stats_t stats[PROBES]) {
+    memset(stats, 0, PROBES * sizeof(probe_stats_t));
+#ifdef ALLOCATOR_INSTRUMENT
+    pthread_mutex_lock(&op_counts_lock);
+    for (int probe = 0; probe < PROBES; probe++) {
+        probe_stats_add(&stats[probe], &retired_probes[probe]);
+    }
+    for (op_counts_t* counts = op_counts_list; counts != NULL; counts = counts->next) {
+        for (int probe = 0; probe < PROBES; probe++) {
+            probe_stats_add(&stats[probe], &counts->probes[probe]);
+        }
+    }
+    pthread_mutex_unlock(&op_counts_lock);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Print the hot-path instrumentation: per probe, its calls and the
+// distribution of cycles and free-list nodes visited per call
+void print_probe_report(void) {
+    printf("\n=== Hot Path Probes ===\n");
+#ifdef ALLOCATOR_INSTRUMENT
+    static const char* names[PROBES] = {"find", "split", "merge", "add", "remove"};
+    static probe_stats_t stats[PROBES]; // Too large for some thread stacks
+    static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&report_lock);
+    my_get_probe_stats(stats);
+#if defined(__x86_64__) || defined(__i386__)
+    const char* unit = "cycles";
+#else
+    const char* unit = "ns";
+#endif
+    printf("%-7s %10s | %-6s %7s %7s %7s %7s | nodes %6s %5s %5s\n", "probe", "calls", unit, "mean", "p50", "p99",
+           "p99.9", "mean", "p50", "p99");
+    for (int probe = 0; probe < PROBES; probe++) {
+        const probe_stats_t* p = &stats[probe];
+        if (p->calls == 0) {
+            continue;
+        }
+        printf("%-7s %10llu | %-6s %7.1f %7llu %7llu %7llu | %5s %6.2f %5llu %5llu\n", names[probe], p->calls, "",
+               (double)p->cycles / p->calls, probe_percentile(p->cycle_hist, p->calls, 0.5),
+               probe_percentile(p->cycle_hist, p->calls, 0.99), probe_percentile(p->cycle_hist, p->calls, 0.999), "",
+               (double)p->nodes / p->calls, probe_percentile(p->node_hist, p->calls, 0.5),
+               probe_percentile(p->node_hist, p->calls, 0.99));
+    }
+    pthread_mutex_unlock(&report_lock);
+#else
+    printf("Not compiled in; build with -DALLOCATOR_INSTRUMENT\n");
+#endif
+    printf("=======================\n\n");
+}
+
+// Validate the blocks of one region, adding up its free and allocated blocks
+static int validate_region(arena_t* arena, region_t* region, size_t* free_blocks, size_t* blocks) {
+    char* current_pos = region->start;
+    size_t prev_free = 0;
     
-    while (current_pos < heap_end) {
+    // The region must be reachable through the address map
+    if (region_of(region) != region || region_of(region->end) != region || region->arena != arena) {
+        printf("Error: Region %p is not mapped to its arena\n", (void*)region);
+        return 0;
+    }
+    
+    while (current_pos < region->end) {
         block_header_t* block = (block_header_t*)current_pos;
         
-        // Check if block header is within heap bounds
-        if ((char*)block + HEADER_SIZE > heap_end) {
+        // Check if block header is within region bounds
+        if ((char*)block + HEADER_SIZE > region->end) {
             printf("Error: Block header extends beyond heap\n");
             return 0;
         }
         
-        // Check if block data is within heap bounds
-        if ((char*)block + HEADER_SIZE + block->size > heap_end) {
+        // Check if block data is within region bounds
+        if ((char*)block + HEADER_SIZE + BLOCK_SIZE(block) > region->end) {
             printf("Error: Block data extends beyond heap\n");
             return 0;
         }
         
-        current_pos += HEADER_SIZE + block->size;
+        // Every payload must keep malloc's alignment
+        if (((uintptr_t)block + HEADER_SIZE) % ALIGNMENT != 0) {
+            printf("Error: Block at %p is not aligned\n", (void*)block);
+            return 0;
+        }
+        
+        // Check the flag for the preceding block and a free block's boundary tag
+        size_t size = BLOCK_SIZE(block);
+        if ((block->size & BLOCK_PREV_FREE) != prev_free ||
+            (BLOCK_IS_FREE(block) && *(size_t*)(current_pos + HEADER_SIZE + size - sizeof(size_t)) != size)) {
+            printf("Error: Boundary tag mismatch at %p\n", (void*)block);
+            return 0;
+        }
+        prev_free = BLOCK_IS_FREE(block) ? BLOCK_PREV_FREE : 0;
+        if (BLOCK_IS_FREE(block)) {
+            (*free_blocks)++;
+        } else {
+            (*blocks)++;
+        }
+        
+        current_pos += HEADER_SIZE + BLOCK_SIZE(block);
+    }
+    
+    // The fence closes the region and carries the last block's flag
+    block_header_t* fence = (block_header_t*)region->end;
+    if (BLOCK_SIZE(fence) != 0 || BLOCK_IS_FREE(fence) || (fence->size & BLOCK_PREV_FREE) != prev_free) {
+        printf("Error: Region fence corrupted at %p\n", (void*)fence);
+        return 0;
+    }
+    
+    return 1;
+}
+
+// Validate every formatted slab and the per-class counters
+static int validate_slabs(void) {
+    size_t allocated[SLAB_CLASSES] = {0};
+    int valid = 1;
+    
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        lock_mutex(&slab_classes[i].lock);
+    }
+    lock_mutex(&slab_pool_lock);
+    
+    for (char* pos = slab_region; pos < slab_region_top && valid; pos += SLAB_SIZE) {
+        slab_t* slab = (slab_t*)pos;
+        if (slab->object_size == 0) {
+            continue; // Pooled
+        }
+        
+        uint32_t free_objects = 0;
+        for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+            free_objects += (uint32_t)__builtin_popcountll(slab->free_map[word]);
+        }
+        if (slab->cls >= SLAB_CLASSES || free_objects != slab->free_count || slab->free_count > slab->capacity) {
+            printf("Error: Slab bitmap mismatch at %p\n", (void*)slab);
+            valid = 0;
+            break;
+        }
+        allocated[slab->cls] += (size_t)(slab->capacity - slab->free_count) * slab->object_size;
+    }
+    
+    for (int i = 0; i < SLAB_CLASSES && valid; i++) {
+        if (allocated[i] != slab_classes[i].allocated) {
+            printf("Error: Slab class %d accounting mismatch\n", i);
+            valid = 0;
+        }
+    }
+    
+    unlock_mutex(&slab_pool_lock);
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        unlock_mutex(&slab_classes[i].lock);
+    }
+    return valid;
+}
+
+// Validate the buddy free lists against the per-order bitmaps and counters
+static int validate_buddy(void) {
+    size_t free_bytes = 0;
+    size_t free_blocks = 0;
+    int valid = 1;
+    
+    lock_mutex(&buddy_lock);
+    for (size_t order = BUDDY_MIN_ORDER; order <= BUDDY_MAX_ORDER && valid; order++) {
+        size_t slot = order - BUDDY_MIN_ORDER;
+        size_t listed = 0;
+        for (buddy_node_t* node = buddy_lists[slot]; node != NULL && valid; node = node->next) {
+            size_t offset = (size_t)((char*)node - buddy_heap);
+            if (buddy_block_order(offset) != order || !buddy_test(buddy_free_map, order, offset)) {
+                printf("Error: Buddy block %p is not free at order %zu\n", (void*)node, order);
+                valid = 0;
+            }
+            listed++;
+        }
+        
+        size_t marked = 0;
+        for (size_t word = 0; word < ((BUDDY_HEAP_SIZE >> order) + 63) / 64; word++) {
+            marked += (size_t)__builtin_popcountll(buddy_free_map[slot][word]);
+        }
+        if (valid && (marked != listed || ((buddy_nonempty >> slot) & 1) != (listed > 0))) {
+            printf("Error: Buddy bitmap mismatch at order %zu\n", order);
+            valid = 0;
+        }
+        free_bytes += listed << order;
+        free_blocks += listed;
+    }
+    
+    if (valid && (free_bytes + buddy_allocated != BUDDY_HEAP_SIZE || free_blocks != buddy_free_blocks)) {
+        printf("Error: Buddy heap accounting mismatch\n");
+        valid = 0;
+    }
+    unlock_mutex(&buddy_lock);
+    return valid;
+}
+
+// Validate heap integrity
+int validate_heap(void) {
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = arena_table[i];
+        if (arena == NULL) {
+            continue;
+        }
+        
+        lock_arena(arena);
+        int valid = 1;
+        size_t free_blocks = 0;
+        size_t blocks = 0;
+        for (region_t* region = arena->regions; region != NULL && valid; region = region->next) {
+            valid = validate_region(arena, region, &free_blocks, &blocks);
+        }
+        if (valid && (free_blocks != arena->free_blocks || blocks != arena->blocks)) {
+            printf("Error: Block counters of arena %d do not match its heap\n", i);
+            valid = 0;
+        }
+        
+        // Each bin's cached largest size, and the arena's, must be exact
+        size_t arena_largest = 0;
+        for (size_t bin = 0; bin < MAX_BINS && valid; bin++) {
+            size_t largest = 0;
+            for (block_header_t* current = arena->free_bins[bin]; current != NULL; current = current->next) {
+                largest = BLOCK_SIZE(current) > largest ? BLOCK_SIZE(current) : largest;
+            }
+            arena_largest = largest > arena_largest ? largest : arena_largest;
+            if (largest != arena->bin_largest[bin]) {
+                printf("Error: Largest block of bin %zu of arena %d is out of date\n", bin, i);
+                valid = 0;
+            }
+        }
+        if (valid && arena_largest != arena_largest_free(arena)) {
+            printf("Error: Largest free block of arena %d is out of date\n", i);
+            valid = 0;
+        }
+        unlock_arena(arena);
+        
+        if (!valid) {
+            return 0;
+        }
+    }
+    
+    if (slab_enabled && !validate_slabs()) {
+        return 0;
+    }
+    
+    if (buddy_heap != NULL && !validate_buddy()) {
+        return 0;
+    }
+    
+    // Every huge mapping must be reachable and hold exactly one block
+    lock_mutex(&huge_lock);
+    size_t huge_bytes = 0;
+    int valid = 1;
+    for (region_t* region = huge_list; region != NULL && valid; region = region->next) {
+        block_header_t* block = (block_header_t*)region->start;
+        if (huge_of(block) != region || block->size != (size_t)(region->end - region->start) - HEADER_SIZE) {
+            printf("Error: Huge mapping %p is corrupted\n", (void*)region);
+            valid = 0;
+        }
+        huge_bytes += BLOCK_SIZE(block);
+    }
+    if (valid && huge_bytes != huge_allocated) {
+        printf("Error: Huge mapping accounting mismatch\n");
+        valid = 0;
+    }
+    unlock_mutex(&huge_lock);
+    if (!valid) {
+        return 0;
     }
     
     return 1; // Heap is valid
@@ -341,29 +4272,115 @@ int validate_heap(void) {
 // Dump heap contents for debugging
 void dump_heap(void) {
     printf("\n=== Heap Dump ===\n");
-    char* heap_start = heap;
-    char* heap_end = heap + HEAP_SIZE;
-    char* current_pos = heap_start;
     int block_num = 0;
     
-    while (current_pos < heap_end) {
-        block_header_t* block = (block_header_t*)current_pos;
-        printf("Block %d: Size=%zu, Free=%s, Address=%p\n", 
-               block_num++, block->size, 
-               block->is_free ? "Yes" : "No", 
-               (void*)block);
-        
-        current_pos += HEADER_SIZE + block->size;
+    for (int i = 0; i < arena_slots; i++) {
+        arena_t* arena = arena_table[i];
+        if (arena == NULL) {
+            continue;
+        }
+        if (arena_slots > 1) {
+            printf("Arena %d%s:\n", i, arena->is_private ? " (private)" : "");
+        }
         
-        if (current_pos >= heap_end) break;
+        lock_arena(arena);
+        for (region_t* region = arena->regions; region != NULL; region = region->next) {
+            printf("Region %p: %zu bytes\n", (void*)region, region->mapped_size);
+            char* current_pos = region->start;
+            while (current_pos < region->end) {
+                block_header_t* block = (block_header_t*)current_pos;
+                printf("Block %d: Size=%zu, Free=%s, Address=%p\n",
+                       block_num++, BLOCK_SIZE(block),
+                       BLOCK_IS_FREE(block) ? "Yes" : "No",
+                       (void*)block);
+                
+                current_pos += HEADER_SIZE + BLOCK_SIZE(block);
+            }
+        }
+        unlock_arena(arena);
+    }
+    
+    lock_mutex(&huge_lock);
+    for (region_t* region = huge_list; region != NULL; region = region->next) {
+        printf("Huge block: Size=%zu, Mapped=%zu, Address=%p\n",
+               BLOCK_SIZE((block_header_t*)region->start), region->mapped_size, (void*)region->start);
+    }
+    unlock_mutex(&huge_lock);
+    
+    if (slab_enabled) {
+        for (char* pos = slab_region; pos < slab_region_top; pos += SLAB_SIZE) {
+            slab_t* slab = (slab_t*)pos;
+            if (slab->object_size != 0) {
+                printf("Slab %p: Object size=%u, Used=%u/%u\n", (void*)slab, slab->object_size,
+                       slab->capacity - slab->free_count, slab->capacity);
+            }
+        }
+    }
+    
+    if (buddy_heap != NULL) {
+        lock_mutex(&buddy_lock);
+        for (size_t order = BUDDY_MIN_ORDER; order <= BUDDY_MAX_ORDER; order++) {
+            size_t count = 0;
+            for (buddy_node_t* node = buddy_lists[order - BUDDY_MIN_ORDER]; node != NULL; node = node->next) {
+                count++;
+            }
+            if (count > 0) {
+                printf("Buddy order %zu: %zu free blocks of %zu bytes\n", order, count, (size_t)1 << order);
+            }
+        }
+        unlock_mutex(&buddy_lock);
     }
     printf("================\n\n");
 }
 
-// Cleanup allocator
+// Cleanup allocator, releasing every arena including private ones
 void allocator_cleanup(void) {
+    // Blocks cached by the calling thread go back before the heap is torn down
+    tcache_drain(&thread_cache);
+    my_trace_stop();
+    my_profile_stop();
+    my_stats_export_stop();
+    
+    pthread_mutex_lock(&init_lock);
     if (allocator_initialized) {
-        printf("Allocator cleanup: %zu bytes still allocated\n", total_allocated);
-        allocator_initialized = 0;
+        for (int i = 0; i < arena_slots; i++) {
+            if (arena_table[i] != NULL) {
+                lock_arena(arena_table[i]);
+                arena_drain_remote(arena_table[i]);
+                unlock_arena(arena_table[i]);
+            }
+        }
+        if (!quiet) {
+            printf("Allocator cleanup: %zu bytes still allocated\n", get_total_allocated());
+        }
+        __atomic_store_n(&allocator_initialized, 0, __ATOMIC_RELEASE);
+        for (int i = 0; i < arena_slots; i++) {
+            if (arena_table[i] != NULL) {
+                arena_release(arena_table[i]);
+            }
+        }
+        __atomic_store_n(&arena_slots, 0, __ATOMIC_RELEASE);
+        
+        while (huge_list != NULL) {
+            huge_free(huge_list);
+        }
+        
+        if (slab_enabled) {
+            slab_enabled = 0;
+            for (int i = 0; i < SLAB_CLASSES; i++) {
+                pthread_mutex_destroy(&slab_classes[i].lock);
+            }
+            os_unmap(slab_region, SLAB_REGION_SIZE);
+            slab_region = NULL;
+        }
+        
+        if (buddy_heap != NULL) {
+            os_unmap(buddy_heap, BUDDY_HEAP_SIZE);
+            os_unmap(buddy_maps, buddy_maps_size);
+            buddy_heap = NULL;
+            buddy_maps = NULL;
+            buddy_allocated = 0;
+        }
     }
-}
\ No newline at end of file
+    pthread_mutex_unlock(&init_lock);
+}
@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/trace_tools.h"
+
+// Fragmentation analyzer: streams an allocation trace through this
+// allocator, one chunk of records at a time, and after every record
+// measures how the heap's memory is spent:
+//   external   1 - largest free block / free bytes
+//   internal   bytes lost rounding requests up (align_size, MIN_BLOCK_SIZE,
+//              buddy orders) as a share of block bytes
+//   headers    header bytes as a share of block and header bytes
+//   peak/live  highest footprint so far over the bytes live now
+// It prints them as a time series and lists the records behind the largest
+// single-step jumps.
+//
+// Usage: allocator_analyze <trace> [segregated|tlsf|buddy] [rows]
+
+#define DEFAULT_ROWS 40
+#define SPIKES 5                    // Largest jumps kept per metric
+#define SPIKE_MIN_BLOCKS 64         // Ratios of smaller heaps jump on every call
+
+enum { METRIC_EXTERNAL, METRIC_INTERNAL, METRIC_HEADERS, METRIC_PEAK_TO_LIVE, METRICS };
+static const char* metric_names[METRICS] = {"external", "internal", "headers", "peak/live"};
+
+typedef struct {
+    double value[METRICS];
+    size_t live;                    // Requested bytes of live blocks
+    size_t held;                    // Block and header bytes the heaps hold
+} sample_t;
+
+// One record and what it did to a metric
+typedef struct {
+    unsigned long long index;
+    trace_record_t record;
+    double before;
+    double after;
+} spike_t;
+
+static spike_t spikes[METRICS][SPIKES];
+static int num_spikes[METRICS];
+
+static size_t live_requested = 0;
+static size_t live_usable = 0;
+static size_t live_blocks = 0;
+static size_t peak_held = 0;
+static size_t header_size = HEADER_SIZE;
+static size_t freed_size = 0;       // Requested size of the block the last free released
+
+// Runs after every record, so it reads only the heap counters that are kept
+// up to date as blocks come and go, not the full my_get_stats() report
+static void measure(sample_t* sample) {
+    size_t allocated = get_total_allocated();
+    size_t free_bytes = get_total_free();
+    size_t largest = get_largest_free_block();
+    size_t headers = live_blocks * header_size;
+    sample->live = live_requested;
+    sample->held = allocated + free_bytes + headers;
+    if (sample->held > peak_held) {
+        peak_held = sample->held;
+    }
+    
+    sample->value[METRIC_EXTERNAL] = free_bytes > 0 ? 1.0 - (double)largest / free_bytes : 0.0;
+    sample->value[METRIC_INTERNAL] = live_usable > 0 ? (double)(live_usable - live_requested) / live_usable : 0.0;
+    sample->value[METRIC_HEADERS] = live_usable > 0 ? (double)headers / (live_usable + headers) : 0.0;
+    sample->value[METRIC_PEAK_TO_LIVE] = live_requested > 0 ? (double)peak_held / live_requested : 0.0;
+}
+
+// Keep the record if it is among the largest jumps of a metric
+static void note_spike(int metric, unsigned long long index, const trace_record_t* record, double before,
+                       double after) {
+    double jump = after - before;
+    int slot = num_spikes[metric];
+    if (slot == SPIKES) {
+        slot = 0;
+        for (int i = 1; i < SPIKES; i++) {
+            if (spikes[metric][i].after - spikes[metric][i].before <
+                spikes[metric][slot].after - spikes[metric][slot].before) {
+                slot = i;
+            }
+        }
+        if (jump <= spikes[metric][slot].after - spikes[metric][slot].before) {
+            return;
+        }
+    } else {
+        num_spikes[metric]++;
+    }
+    spikes[metric][slot].index = index;
+    spikes[metric][slot].record = *record;
+    spikes[metric][slot].before = before;
+    spikes[metric][slot].after = after;
+}
+
+static int compare_spikes(const void* a, const void* b) {
+    const spike_t* x = (const spike_t*)a;
+    const spike_t* y = (const spike_t*)b;
+    double dx = x->after - x->before;
+    double dy = y->after - y->before;
+    return (dx < dy) - (dx > dy);
+}
+
+static void track(live_entry_t* entry, size_t requested) {
+    entry->requested = requested;
+    entry->usable = my_usable_size(entry->ptr);
+    live_requested += entry->requested;
+    live_usable += entry->usable;
+    live_blocks++;
+}
+
+static void untrack(live_map_t* live, live_entry_t* entry) {
+    live_requested -= entry->requested;
+    live_usable -= entry->usable;
+    live_blocks--;
+    live_remove(live, entry);
+}
+
+// Apply one record to the heap; returns 0 if it names no live block
+static int apply(live_map_t* live, const trace_record_t* record) {
+    live_entry_t* entry;
+    void* ptr;
+    switch (record->op) {
+        case TRACE_MALLOC:
+        case TRACE_CALLOC:
+        case TRACE_ALIGNED_ALLOC:
+            // An address still live was freed by a call made before recording
+            entry = live_find(live, record->id);
+            if (entry != NULL) {
+                my_free(entry->ptr);
+                untrack(live, entry);
+            }
+            ptr = record->op == TRACE_ALIGNED_ALLOC ? my_aligned_alloc((size_t)1 << record->align_shift, record->size)
+                                                    : my_malloc(record->size);
+            if (ptr != NULL && (entry = live_insert(live, record->id, ptr)) != NULL) {
+                track(entry, record->size);
+            }
+            return 1;
+        case TRACE_REALLOC:
+            entry = record->old_id != 0 ? live_find(live, record->old_id) : NULL;
+            if (record->old_id != 0 && entry == NULL) {
+                return 0;
+            }
+            if (record->size == 0) {
+                my_free(entry != NULL ? entry->ptr : NULL);
+                if (entry != NULL) {
+                    untrack(live, entry);
+                }
+                return 1;
+            }
+            
+            // A failed realloc leaves the old block live, so it stays tracked
+            ptr = my_realloc(entry != NULL ? entry->ptr : NULL, record->size);
+            if (ptr == NULL) {
+                return 1;
+            }
+            if (entry != NULL) {
+                untrack(live, entry);
+            }
+            if ((entry = live_insert(live, record->id, ptr)) != NULL) {
+                track(entry, record->size);
+            }
+            return 1;
+        case TRACE_FREE:
+            entry = live_find(live, record->id);
+            if (entry == NULL) {
+                return 0;
+            }
+            freed_size = entry->requested;
+            my_free(entry->ptr);
+            untrack(live, entry);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static const char* op_name(int op) {
+    switch (op) {
+        case TRACE_MALLOC:
+            return "malloc";
+        case TRACE_CALLOC:
+            return "calloc";
+        case TRACE_REALLOC:
+            return "realloc";
+        case TRACE_FREE:
+            return "free";
+        case TRACE_ALIGNED_ALLOC:
+            return "aligned_alloc";
+        default:
+            return "unknown";
+    }
+}
+
+static void print_row(unsigned long long index, const trace_record_t* record, const sample_t* sample) {
+    printf("%12llu %10.3f %14zu %14zu %8.1f%% %8.1f%% %8.1f%% %9.2f\n", index,
+           record != NULL ? record->timestamp / 1e6 : 0.0, sample->live, sample->held,
+           100.0 * sample->value[METRIC_EXTERNAL], 100.0 * sample->value[METRIC_INTERNAL],
+           100.0 * sample->value[METRIC_HEADERS], sample->value[METRIC_PEAK_TO_LIVE]);
+}
+
+int main(int argc, char** argv) {
+    const char* engine_name = argc > 2 ? argv[2] : "segregated";
+    long rows = argc > 3 ? atol(argv[3]) : DEFAULT_ROWS;
+    if (argc < 2 || argc > 4 || rows <= 0 || !start_engine(engine_name)) {
+        fprintf(stderr, "Usage: %s <trace> [segregated|tlsf|buddy] [rows]\n", argv[0]);
+        return 1;
+    }
+    if (strcmp(engine_name, "buddy") == 0) {
+        header_size = 0; // Buddy blocks carry no header
+    }
+    
+    trace_reader_t trace;
+    live_map_t live;
+    if (!trace_open(&trace, argv[1])) {
+        return 1;
+    }
+    if (!live_init(&live, 1024)) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    
+    unsigned long long interval = trace.total / rows > 0 ? trace.total / rows : 1;
+    printf("Fragmentation of %s on %s, %llu records\n\n", argv[1], engine_name, trace.total);
+    printf("%12s %10s %14s %14s %9s %9s %9s %9s\n", "record", "time (ms)", "live bytes", "held bytes", "external",
+           "internal", "headers", "peak/live");
+    
+    sample_t previous, current;
+    measure(&previous);
+    unsigned long long index = 0, skipped = 0;
+    trace_record_t last = {0};
+    size_t count;
+    while ((count = trace_read(&trace)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            trace_record_t* record = &trace.records[i];
+            if (!apply(&live, record)) {
+                skipped++;
+            }
+            if (record->op == TRACE_FREE) {
+                record->size = freed_size; // Reported with the size it had
+            }
+            measure(&current);
+            if (live_blocks >= SPIKE_MIN_BLOCKS) {
+                for (int metric = 0; metric < METRICS; metric++) {
+                    if (current.value[metric] > previous.value[metric]) {
+                        note_spike(metric, index, record, previous.value[metric], current.value[metric]);
+                    }
+                }
+            }
+            previous = current;
+            last = *record;
+            if (++index % interval == 0) {
+                print_row(index, record, &current);
+            }
+        }
+    }
+    trace_close(&trace);
+    if (index % interval != 0) {
+        print_row(index, &last, &previous);
+    }
+    
+    printf("\nPeak footprint %zu bytes", peak_held);
+    if (skipped > 0) {
+        printf("; skipped %llu records naming blocks from before recording", skipped);
+    }
+    printf("\n");
+    
+    for (int metric = 0; metric < METRICS; metric++) {
+        if (num_spikes[metric] == 0) {
+            continue;
+        }
+        qsort(spikes[metric], num_spikes[metric], sizeof(spike_t), compare_spikes);
+        printf("\nLargest %s jumps:\n", metric_names[metric]);
+        for (int i = 0; i < num_spikes[metric]; i++) {
+            const spike_t* spike = &spikes[metric][i];
+            int percent = metric != METRIC_PEAK_TO_LIVE;
+            printf("  record %llu at %.3f ms, thread %u: %s of %llu bytes, %.2f%s -> %.2f%s\n", spike->index,
+                   spike->record.timestamp / 1e6, spike->record.thread, op_name(spike->record.op),
+                   (unsigned long long)spike->record.size, percent ? 100.0 * spike->before : spike->before,
+                   percent ? "%" : "", percent ? 100.0 * spike->after : spike->after, percent ? "%" : "");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../include/allocator.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+#else
+#define CYCLE_UNIT "ns"
+#endif
+
+// Allocator benchmark harness: runs each workload against glibc malloc and
+// this allocator in a child process of its own, so peak RSS and heap state
+// never carry over, and prints the results as JSON.
+//
+// Usage: allocator_bench [threads] [scale]
+
+#define MAX_THREADS 64
+#define SAMPLE_SHIFT 2              // Time one operation in 2^SAMPLE_SHIFT
+#define PIPE_SLOTS 1024
+
+// The allocator under test
+typedef struct {
+    const char* name;
+    void (*init)(void);
+    void* (*malloc_fn)(size_t size);
+    void (*free_fn)(void* ptr);
+    void* (*realloc_fn)(void* ptr, size_t size);
+    void (*footprint)(size_t* live, size_t* held); // Bytes in use, bytes held from the OS
+} bench_allocator_t;
+
+// Single-producer single-consumer ring carrying blocks between threads
+typedef struct {
+    void* slots[PIPE_SLOTS];
+    size_t head; // Next slot the consumer reads
+    size_t tail; // Next slot the producer writes
+} pipe_t;
+
+// State of one benchmark thread
+typedef struct worker {
+    int id;
+    unsigned int seed;
+    unsigned long long ops;
+    unsigned long long items;       // Operations this thread performs
+    uint32_t* samples;              // Latency of every 2^SAMPLE_SHIFT-th operation
+    size_t num_samples;
+    size_t max_samples;
+    void** slots;                   // Live set still held when the workload stops
+    size_t num_slots;
+    pipe_t* pipe;                   // Producer/consumer only
+} worker_t;
+
+typedef struct {
+    const char* name;
+    void (*run)(worker_t* worker);
+    size_t slots;                   // Live set size per thread
+    unsigned long long items;       // Operations per thread at scale 1
+    int paired;                     // Threads work in producer/consumer pairs
+} workload_t;
+
+// One run, written by the child into memory shared with the parent
+typedef struct {
+    int done;
+    unsigned long long ops;
+    double seconds;
+    unsigned long long p50, p90, p99, p999, max;
+    long peak_rss_kb;
+    size_t live_bytes;
+    size_t held_bytes;
+} result_t;
+
+static const bench_allocator_t* allocator;
+static int num_threads = 4;
+static double scale = 1.0;
+
+// Larson rounds hand every live set to the next thread
+#define LARSON_ROUNDS 8
+static void** larson_sets[MAX_THREADS];
+static pthread_barrier_t round_barrier;
+static pthread_barrier_t phase_barrier;
+
+static unsigned long long read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int next_random(unsigned int* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+// Memory for the harness itself comes straight from the OS, so it weighs
+// the same on every allocator
+static void* bench_map(size_t size) {
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static void record(worker_t* worker, unsigned long long start) {
+    unsigned long long elapsed = read_cycles() - start;
+    if ((worker->ops++ & ((1u << SAMPLE_SHIFT) - 1)) == 0 && worker->num_samples < worker->max_samples) {
+        worker->samples[worker->num_samples++] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    }
+}
+
+// Timed allocator calls; each touches the memory it gets like a real caller
+static void* timed_malloc(worker_t* worker, size_t size) {
+    unsigned long long start = read_cycles();
+    char* ptr = (char*)allocator->malloc_fn(size);
+    record(worker, start);
+    if (ptr != NULL) {
+        ptr[0] = (char)size;
+    }
+    return ptr;
+}
+
+static void timed_free(worker_t* worker, void* ptr) {
+    unsigned long long start = read_cycles();
+    allocator->free_fn(ptr);
+    record(worker, start);
+}
+
+static void* timed_realloc(worker_t* worker, void* ptr, size_t size) {
+    unsigned long long start = read_cycles();
+    char* resized = (char*)allocator->realloc_fn(ptr, size);
+    record(worker, start);
+    if (resized != NULL) {
+        resized[size - 1] = (char)size;
+    }
+    return resized;
+}
+
+// Mostly small sizes with a tail of medium and large ones
+static size_t mixed_size(unsigned int* seed) {
+    unsigned int r = next_random(seed) % 100;
+    if (r < 80) {
+        return 16 + next_random(seed) % 113;
+    }
+    if (r < 95) {
+        return 128 + next_random(seed) % (4096 - 128);
+    }
+    return 4096 + next_random(seed) % (65536 - 4096);
+}
+
+// Replace a random slot of the live set, freeing what was there
+static void replace_slot(worker_t* worker, void** slots, size_t size) {
+    size_t index = next_random(&worker->seed) % worker->num_slots;
+    if (slots[index] != NULL) {
+        timed_free(worker, slots[index]);
+    }
+    slots[index] = timed_malloc(worker, size);
+}
+
+// Random allocations and frees over a mixed size distribution
+static void run_mixed_sizes(worker_t* worker) {
+    for (unsigned long long i = 0; i < worker->items; i++) {
+        size_t index = next_random(&worker->seed) % worker->num_slots;
+        if (worker->slots[index] != NULL) {
+            timed_free(worker, worker->slots[index]);
+            worker->slots[index] = NULL;
+        } else {
+            worker->slots[index] = timed_malloc(worker, mixed_size(&worker->seed));
+        }
+    }
+}
+
+// Larson-style server churn: each thread replaces random blocks of a live
+// set, then passes the set on, so most blocks die on another thread
+static void run_larson(worker_t* worker) {
+    larson_sets[worker->id] = worker->slots;
+    pthread_barrier_wait(&round_barrier);
+    
+    unsigned long long per_round = worker->items / LARSON_ROUNDS;
+    for (int round = 0; round < LARSON_ROUNDS; round++) {
+        void** set = larson_sets[(worker->id + round) % num_threads];
+        for (unsigned long long i = 0; i < per_round; i++) {
+            replace_slot(worker, set, 16 + next_random(&worker->seed) % 1009);
+        }
+        pthread_barrier_wait(&round_barrier);
+    }
+    worker->slots = larson_sets[(worker->id + LARSON_ROUNDS) % num_threads];
+}
+
+// Producers allocate and consumers free, across a ring per pair
+static void run_producer_consumer(worker_t* worker) {
+    pipe_t* pipe = worker->pipe;
+    for (unsigned long long i = 0; i < worker->items; i++) {
+        if (worker->id % 2 == 0) {
+            void* ptr = timed_malloc(worker, 16 + next_random(&worker->seed) % 241);
+            while (pipe->tail - __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) == PIPE_SLOTS) {
+                sched_yield();
+            }
+            pipe->slots[pipe->tail % PIPE_SLOTS] = ptr;
+            __atomic_store_n(&pipe->tail, pipe->tail + 1, __ATOMIC_RELEASE);
+        } else {
+            while (__atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) == pipe->head) {
+                sched_yield();
+            }
+            timed_free(worker, pipe->slots[pipe->head % PIPE_SLOTS]);
+            __atomic_store_n(&pipe->head, pipe->head + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+// Buffers growing by half at a time through realloc, restarting once they
+// reach a random limit of up to 64KB
+static void run_realloc_chains(worker_t* worker) {
+    size_t sizes[64] = {0};
+    size_t limits[64];
+    size_t chains = worker->num_slots < 64 ? worker->num_slots : 64;
+    for (size_t c = 0; c < chains; c++) {
+        limits[c] = 1024 + next_random(&worker->seed) % (65536 - 1024);
+    }
+    
+    for (unsigned long long i = 0; i < worker->items; i++) {
+        size_t c = next_random(&worker->seed) % chains;
+        if (sizes[c] >= limits[c]) {
+            timed_free(worker, worker->slots[c]);
+            worker->slots[c] = NULL;
+            sizes[c] = 0;
+            continue;
+        }
+        sizes[c] = sizes[c] == 0 ? 16 : sizes[c] + sizes[c] / 2;
+        void* resized = timed_realloc(worker, worker->slots[c], sizes[c]);
+        if (resized != NULL) {
+            worker->slots[c] = resized;
+        }
+    }
+}
+
+// Nine in ten blocks die within a few dozen operations; the rest join a
+// long-lived set that is only slowly replaced
+static void run_lifetime_mix(worker_t* worker) {
+    void* recent[32] = {NULL};
+    for (unsigned long long i = 0; i < worker->items; i++) {
+        if (next_random(&worker->seed) % 10 != 0) {
+            size_t index = i % 32;
+            if (recent[index] != NULL) {
+                timed_free(worker, recent[index]);
+            }
+            recent[index] = timed_malloc(worker, 16 + next_random(&worker->seed) % 497);
+        } else {
+            replace_slot(worker, worker->slots, mixed_size(&worker->seed));
+        }
+    }
+    for (int i = 0; i < 32; i++) {
+        if (recent[i] != NULL) {
+            allocator->free_fn(recent[i]);
+        }
+    }
+}
+
+static const workload_t workloads[] = {
+    {"mixed_sizes", run_mixed_sizes, 4096, 1000000, 0},
+    {"larson", run_larson, 1024, 1000000, 0},
+    {"producer_consumer", run_producer_consumer, 0, 1000000, 1},
+    {"realloc_chains", run_realloc_chains, 64, 500000, 0},
+    {"lifetime_mix", run_lifetime_mix, 2048, 1000000, 0},
+};
+#define NUM_WORKLOADS ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+static const workload_t* current_workload;
+
+// Work, then hold the live set while the main thread measures, then free it
+static void* worker_main(void* arg) {
+    worker_t* worker = (worker_t*)arg;
+    pthread_barrier_wait(&phase_barrier);
+    current_workload->run(worker);
+    pthread_barrier_wait(&phase_barrier);
+    pthread_barrier_wait(&phase_barrier);
+    
+    for (size_t i = 0; i < worker->num_slots; i++) {
+        if (worker->slots[i] != NULL) {
+            allocator->free_fn(worker->slots[i]);
+        }
+    }
+    return NULL;
+}
+
+static int compare_samples(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Run one workload on the current allocator and fill in its result
+static void run_workload(const workload_t* workload, result_t* result) {
+    int threads = num_threads;
+    if (workload->paired && threads % 2 != 0) {
+        threads++;
+    }
+    current_workload = workload;
+    
+    unsigned long long items = (unsigned long long)(workload->items * scale);
+    if (items < LARSON_ROUNDS) {
+        items = LARSON_ROUNDS;
+    }
+    size_t max_samples = (size_t)((items >> SAMPLE_SHIFT) + 1);
+    
+    worker_t* workers = (worker_t*)bench_map(threads * sizeof(worker_t));
+    pipe_t* pipes = (pipe_t*)bench_map((threads / 2 + 1) * sizeof(pipe_t));
+    uint32_t* samples = (uint32_t*)bench_map(threads * max_samples * sizeof(uint32_t));
+    for (int t = 0; t < threads; t++) {
+        workers[t].id = t;
+        workers[t].seed = 12345u + t;
+        workers[t].items = items;
+        workers[t].samples = samples + t * max_samples;
+        workers[t].max_samples = max_samples;
+        workers[t].num_slots = workload->slots;
+        workers[t].slots = workload->slots > 0 ? (void**)bench_map(workload->slots * sizeof(void*)) : NULL;
+        workers[t].pipe = &pipes[t / 2];
+    }
+    
+    pthread_barrier_init(&round_barrier, NULL, threads);
+    pthread_barrier_init(&phase_barrier, NULL, threads + 1);
+    pthread_t handles[MAX_THREADS + 1];
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&handles[t], NULL, worker_main, &workers[t]);
+    }
+    
+    pthread_barrier_wait(&phase_barrier);
+    double start = now_seconds();
+    pthread_barrier_wait(&phase_barrier);
+    result->seconds = now_seconds() - start;
+    allocator->footprint(&result->live_bytes, &result->held_bytes);
+    pthread_barrier_wait(&phase_barrier);
+    for (int t = 0; t < threads; t++) {
+        pthread_join(handles[t], NULL);
+    }
+    
+    // Percentiles over every thread's samples, packed together
+    size_t count = 0;
+    result->ops = 0;
+    for (int t = 0; t < threads; t++) {
+        memmove(samples + count, workers[t].samples, workers[t].num_samples * sizeof(uint32_t));
+        count += workers[t].num_samples;
+        result->ops += workers[t].ops;
+    }
+    qsort(samples, count, sizeof(uint32_t), compare_samples);
+    if (count > 0) {
+        result->p50 = samples[count / 2];
+        result->p90 = samples[count * 90 / 100];
+        result->p99 = samples[count * 99 / 100];
+        result->p999 = samples[count * 999 / 1000];
+        result->max = samples[count - 1];
+    }
+    
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result->peak_rss_kb = usage.ru_maxrss;
+    result->done = 1;
+}
+
+static void glibc_init(void) {
+}
+
+static void glibc_footprint(size_t* live, size_t* held) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    *live = (size_t)info.uordblks + (size_t)info.hblkhd;
+    *held = (size_t)info.arena + (size_t)info.hblkhd;
+}
+
+static void custom_init(void) {
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    options.tcache = 1;
+    options.remote_free = 1;
+    options.quiet = 1;
+    allocator_init_ex(&options);
+}
+
+static void custom_footprint(size_t* live, size_t* held) {
+    allocator_stats_t stats;
+    my_get_stats(&stats);
+    *live = stats.allocated_bytes;
+    *held = stats.allocated_bytes + stats.free_bytes;
+}
+
+static const bench_allocator_t allocators[] = {
+    {"glibc", glibc_init, malloc, free, realloc, glibc_footprint},
+    {"custom", custom_init, my_malloc, my_free, my_realloc, custom_footprint},
+};
+#define NUM_ALLOCATORS ((int)(sizeof(allocators) / sizeof(allocators[0])))
+
+static void print_result(const bench_allocator_t* bench_allocator, const workload_t* workload,
+                         const result_t* result, const result_t* baseline, int last) {
+    double ops_per_sec = result->seconds > 0 ? result->ops / result->seconds : 0;
+    double fragmentation = result->held_bytes > 0 ? 1.0 - (double)result->live_bytes / result->held_bytes : 0;
+    
+    printf("    {\"allocator\": \"%s\", \"workload\": \"%s\", \"ok\": %s,\n", bench_allocator->name, workload->name,
+           result->done ? "true" : "false");
+    printf("     \"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.0f,\n", result->ops, result->seconds, ops_per_sec);
+    printf("     \"latency\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p99_9\": %llu, \"max\": %llu},\n",
+           result->p50, result->p90, result->p99, result->p999, result->max);
+    printf("     \"peak_rss_kb\": %ld, \"live_bytes\": %zu, \"held_bytes\": %zu, \"fragmentation\": %.4f", result->peak_rss_kb,
+           result->live_bytes, result->held_bytes, fragmentation);
+    if (baseline != NULL && baseline->done && result->done && baseline->seconds > 0 && baseline->peak_rss_kb > 0) {
+        double baseline_ops = baseline->ops / baseline->seconds;
+        printf(",\n     \"vs_baseline\": {\"ops_per_sec\": %.3f, \"peak_rss\": %.3f}", ops_per_sec / baseline_ops,
+               (double)result->peak_rss_kb / baseline->peak_rss_kb);
+    }
+    printf("}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        num_threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        scale = atof(argv[2]);
+    }
+    if (num_threads < 1 || num_threads > MAX_THREADS || scale <= 0) {
+        fprintf(stderr, "Usage: %s [threads 1-%d] [scale]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+    
+    // Children report through memory shared with this process
+    result_t* results = (result_t*)mmap(NULL, sizeof(result_t) * NUM_WORKLOADS * NUM_ALLOCATORS,
+                                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(results, 0, sizeof(result_t) * NUM_WORKLOADS * NUM_ALLOCATORS);
+    
+    for (int w = 0; w < NUM_WORKLOADS; w++) {
+        for (int a = 0; a < NUM_ALLOCATORS; a++) {
+            fprintf(stderr, "%s on %s...\n", workloads[w].name, allocators[a].name);
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                allocator = &allocators[a];
+                allocator->init();
+                run_workload(&workloads[w], &results[w * NUM_ALLOCATORS + a]);
+                _exit(0);
+            }
+            if (pid > 0) {
+                waitpid(pid, NULL, 0);
+            }
+        }
+    }
+    
+    // The first allocator is the baseline the others are compared with
+    printf("{\n  \"timer\": \"%s\", \"threads\": %d, \"scale\": %g, \"baseline\": \"%s\",\n", CYCLE_UNIT, num_threads,
+           scale, allocators[0].name);
+    printf("  \"results\": [\n");
+    for (int w = 0; w < NUM_WORKLOADS; w++) {
+        for (int a = 0; a < NUM_ALLOCATORS; a++) {
+            const result_t* baseline = a > 0 ? &results[w * NUM_ALLOCATORS] : NULL;
+            print_result(&allocators[a], &workloads[w], &results[w * NUM_ALLOCATORS + a], baseline,
+                         w == NUM_WORKLOADS - 1 && a == NUM_ALLOCATORS - 1);
+        }
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
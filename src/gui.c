@@ -6,7 +6,14 @@
 
 // Global GUI state
 static gui_state_t g_gui_state = {0};
-extern char heap[];  // Reference to heap from allocator.c
+
+// Drawing state threaded through heap_walk()
+typedef struct {
+    HDC hdc;
+    int x;
+    int y;
+    double scale;
+} map_cursor_t;
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     // Initialize allocator
@@ -221,75 +228,73 @@ void DrawMemoryVisualization(HDC hdc, HWND hwnd) {
     DrawLegend(hdc);
     
     // Draw heap statistics
+    allocator_stats_t heap_stats;
+    my_get_stats(&heap_stats);
     char stats[512];
     snprintf(stats, sizeof(stats), 
-             "Heap: %dKB | Allocated: %luB | Free: %luB | Fragmentation: %d blocks",
-             HEAP_SIZE / 1024, (unsigned long)get_total_allocated(), (unsigned long)get_total_free(), get_fragmentation_count());
+             "Heap: %luKB | Allocated: %luB | Free: %luB | Fragmentation: %lu blocks",
+             (unsigned long)(heap_stats.heap_size / 1024), (unsigned long)heap_stats.allocated_bytes,
+             (unsigned long)heap_stats.free_bytes, (unsigned long)heap_stats.free_blocks);
              
     SetBkMode(hdc, TRANSPARENT);
     TextOut(hdc, CANVAS_X, CANVAS_Y + CANVAS_HEIGHT + 10, stats, strlen(stats));
 }
 
+// Draw one block and advance the cursor past it
+static void DrawBlock(const block_header_t* block, void* context) {
+    map_cursor_t* cursor = (map_cursor_t*)context;
+    HDC hdc = cursor->hdc;
+    int x = cursor->x;
+    int y = cursor->y;
+    
+    // Calculate block dimensions
+    int header_width = (int)(HEADER_SIZE * cursor->scale);
+    int data_width = (int)(BLOCK_SIZE(block) * cursor->scale);
+    
+    if (header_width < 1) header_width = 1;
+    if (data_width < 1) data_width = 1;
+    
+    // Draw header
+    RECT header_rect = {x, y, x + header_width, y + BLOCK_HEIGHT};
+    FillRect(hdc, &header_rect, g_gui_state.brush_header);
+    
+    // Draw data block
+    RECT data_rect = {x + header_width, y, x + header_width + data_width, y + BLOCK_HEIGHT};
+    if (BLOCK_IS_FREE(block)) {
+        FillRect(hdc, &data_rect, g_gui_state.brush_free);
+    } else {
+        FillRect(hdc, &data_rect, g_gui_state.brush_allocated);
+    }
+    
+    // Draw border
+    HPEN oldPen = SelectObject(hdc, g_gui_state.pen_border);
+    Rectangle(hdc, x, y, x + header_width + data_width, y + BLOCK_HEIGHT);
+    
+    // Draw size label if block is large enough
+    if (data_width > 30) {
+        char size_str[32];
+        snprintf(size_str, sizeof(size_str), "%lu", (unsigned long)BLOCK_SIZE(block));
+        SetBkMode(hdc, TRANSPARENT);
+        SetTextColor(hdc, RGB(0, 0, 0));
+        TextOut(hdc, x + header_width + 2, y + 8, size_str, strlen(size_str));
+    }
+    
+    SelectObject(hdc, oldPen);
+    
+    cursor->x += header_width + data_width;
+}
+
 void DrawMemoryMap(HDC hdc) {
     // Draw the memory as a horizontal bar
     int total_width = CANVAS_WIDTH - 100; // Leave space for labels
-    int y = CANVAS_Y + 50;
-    
-    // Calculate scale factor
-    double scale = (double)total_width / HEAP_SIZE;
     
-    // Walk through the heap and draw blocks
-    char* heap_start = heap;
-    char* current_pos = heap_start;
-    char* heap_end = heap_start + HEAP_SIZE;
-    int x = CANVAS_X + 50;
-    
-    while (current_pos < heap_end) {
-        block_header_t* block = (block_header_t*)current_pos;
-        
-        if ((char*)block + sizeof(block_header_t) > heap_end) {
-            break;
-        }
-        
-        // Calculate block dimensions
-        int header_width = (int)(sizeof(block_header_t) * scale);
-        int data_width = (int)(block->size * scale);
-        
-        if (header_width < 1) header_width = 1;
-        if (data_width < 1) data_width = 1;
-        
-        // Draw header
-        RECT header_rect = {x, y, x + header_width, y + BLOCK_HEIGHT};
-        FillRect(hdc, &header_rect, g_gui_state.brush_header);
-        
-        // Draw data block
-        RECT data_rect = {x + header_width, y, x + header_width + data_width, y + BLOCK_HEIGHT};
-        if (block->is_free) {
-            FillRect(hdc, &data_rect, g_gui_state.brush_free);
-        } else {
-            FillRect(hdc, &data_rect, g_gui_state.brush_allocated);
-        }
-        
-        // Draw border
-        HPEN oldPen = SelectObject(hdc, g_gui_state.pen_border);
-        Rectangle(hdc, x, y, x + header_width + data_width, y + BLOCK_HEIGHT);
-        
-        // Draw size label if block is large enough
-        if (data_width > 30) {
-            char size_str[32];
-            snprintf(size_str, sizeof(size_str), "%lu", (unsigned long)block->size);
-            SetBkMode(hdc, TRANSPARENT);
-            SetTextColor(hdc, RGB(0, 0, 0));
-            TextOut(hdc, x + header_width + 2, y + 8, size_str, strlen(size_str));
-        }
-        
-        SelectObject(hdc, oldPen);
-        
-        x += header_width + data_width;
-        current_pos += sizeof(block_header_t) + block->size;
-        
-        if (current_pos >= heap_end) break;
-    }
+    // Walk every heap region and draw its blocks side by side
+    map_cursor_t cursor;
+    cursor.hdc = hdc;
+    cursor.x = CANVAS_X + 50;
+    cursor.y = CANVAS_Y + 50;
+    cursor.scale = (double)total_width / get_heap_size();
+    heap_walk(DrawBlock, &cursor);
 }
 
 void DrawLegend(HDC hdc) {
@@ -451,16 +456,18 @@ int GetSizeFromEdit(HWND hwnd) {
 }
 
 void UpdateStatusBar(HWND hwnd) {
+    allocator_stats_t heap_stats;
+    my_get_stats(&heap_stats);
     char status[512];
     snprintf(status, sizeof(status),
              "Memory Status:\n"
-             "Heap Size: %d bytes\n"
+             "Heap Size: %lu bytes\n"
              "Allocated: %lu bytes\n"
              "Free: %lu bytes\n"
-             "Fragmentation: %d blocks\n"
+             "Fragmentation: %lu blocks\n"
              "Total Pointers: %d",
-             HEAP_SIZE, (unsigned long)get_total_allocated(), (unsigned long)get_total_free(), 
-             get_fragmentation_count(), g_gui_state.next_id);
+             (unsigned long)heap_stats.heap_size, (unsigned long)heap_stats.allocated_bytes,
+             (unsigned long)heap_stats.free_bytes, (unsigned long)heap_stats.free_blocks, g_gui_state.next_id);
     
     SetWindowText(g_gui_state.hStatus, status);
 }
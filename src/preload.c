@@ -0,0 +1,271 @@
+// Drop-in malloc replacement: build liballocator.so and run any program
+// under LD_PRELOAD to serve its allocations from this allocator.
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/allocator.h"
+
+// Static memory for calls made before the system allocator is resolved
+#define BOOTSTRAP_SIZE (64 * 1024)
+
+static char bootstrap_heap[BOOTSTRAP_SIZE] __attribute__((aligned(ALIGNMENT)));
+static size_t bootstrap_top = 0;
+
+// The allocator behind us, for calls made from inside our own and for
+// pointers we did not hand out
+static void* (*system_malloc)(size_t size);
+static void (*system_free)(void* ptr);
+static void* (*system_realloc)(void* ptr, size_t size);
+static void* (*system_memalign)(size_t alignment, size_t size);
+static size_t (*system_usable_size)(void* ptr);
+
+static pthread_once_t preload_once = PTHREAD_ONCE_INIT;
+static const char* profile_path = NULL;
+
+// Set while this thread is inside the allocator. Anything it allocates
+// meanwhile (stdio buffers, thread-specific data, dlsym) goes elsewhere.
+static __thread int in_allocator __attribute__((tls_model("initial-exec"))) = 0;
+
+// Carve a block from the bootstrap heap, its size in the word before it.
+// Bootstrap blocks are never reused.
+static void* bootstrap_alloc(size_t alignment, size_t size) {
+    if (alignment < ALIGNMENT) {
+        alignment = ALIGNMENT;
+    }
+    if (size > BOOTSTRAP_SIZE || alignment > BOOTSTRAP_SIZE) {
+        return NULL;
+    }
+    
+    size_t top = __atomic_load_n(&bootstrap_top, __ATOMIC_RELAXED);
+    size_t start;
+    do {
+        start = (top + sizeof(size_t) + alignment - 1) & ~(alignment - 1);
+        if (start + size > BOOTSTRAP_SIZE) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&bootstrap_top, &top, start + size, 1, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    
+    memcpy(bootstrap_heap + start - sizeof(size_t), &size, sizeof(size_t));
+    return bootstrap_heap + start;
+}
+
+static int bootstrap_owns(const void* ptr) {
+    return (const char*)ptr >= bootstrap_heap && (const char*)ptr < bootstrap_heap + BOOTSTRAP_SIZE;
+}
+
+static size_t bootstrap_size(const void* ptr) {
+    size_t size;
+    memcpy(&size, (const char*)ptr - sizeof(size_t), sizeof(size_t));
+    return size;
+}
+
+// Allocate on behalf of a call made from inside the allocator. The system
+// malloc aligns to alignof(max_align_t), our ALIGNMENT, as well.
+static void* fallback_alloc(size_t alignment, size_t size) {
+    if (alignment <= ALIGNMENT && system_malloc != NULL) {
+        return system_malloc(size);
+    }
+    if (system_memalign != NULL) {
+        return system_memalign(alignment, size);
+    }
+    return bootstrap_alloc(alignment, size);
+}
+
+static void dump_profile(void) {
+    my_profile_dump(profile_path);
+}
+
+// Resolve the system allocator, then set up ours. dlsym may itself
+// allocate; in_allocator sends that to the bootstrap heap.
+static void preload_init(void) {
+    system_malloc = (void* (*)(size_t))dlsym(RTLD_NEXT, "malloc");
+    system_free = (void (*)(void*))dlsym(RTLD_NEXT, "free");
+    system_realloc = (void* (*)(void*, size_t))dlsym(RTLD_NEXT, "realloc");
+    system_memalign = (void* (*)(size_t, size_t))dlsym(RTLD_NEXT, "memalign");
+    system_usable_size = (size_t (*)(void*))dlsym(RTLD_NEXT, "malloc_usable_size");
+    
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    options.tcache = 1;
+    options.remote_free = 1;
+    options.quiet = 1;
+    allocator_init_ex(&options);
+    
+    // A child forked while another thread held a lock would deadlock on it
+    pthread_atfork(allocator_fork_prepare, allocator_fork_release, allocator_fork_release);
+    
+    // ALLOCATOR_TRACE=<file> records the program's calls for allocator_replay
+    const char* trace_path = getenv("ALLOCATOR_TRACE");
+    if (trace_path != NULL && trace_path[0] != '\0' && my_trace_start(trace_path)) {
+        atexit(my_trace_stop);
+    }
+    
+    // ALLOCATOR_PROFILE=<file> writes a heap profile for pprof at exit,
+    // sampling once per ALLOCATOR_PROFILE_INTERVAL bytes on average
+    profile_path = getenv("ALLOCATOR_PROFILE");
+    const char* interval = getenv("ALLOCATOR_PROFILE_INTERVAL");
+    if (profile_path != NULL && profile_path[0] != '\0' &&
+        my_profile_start(interval != NULL ? (size_t)strtoull(interval, NULL, 10) : 0)) {
+        atexit(dump_profile);
+    }
+    
+    // ALLOCATOR_STATS=1 publishes live statistics to STATS_EXPORT_PREFIX<pid>
+    // for allocator_stats; any other value names the file instead
+    const char* stats_path = getenv("ALLOCATOR_STATS");
+    if (stats_path != NULL && stats_path[0] != '\0' &&
+        my_stats_export_start(strcmp(stats_path, "1") == 0 ? NULL : stats_path, 0)) {
+        atexit(my_stats_export_stop);
+    }
+}
+
+// Enter the allocator, returning 0 if this thread is already inside it
+static int enter_allocator(void) {
+    if (in_allocator) {
+        return 0;
+    }
+    in_allocator = 1;
+    pthread_once(&preload_once, preload_init);
+    return 1;
+}
+
+static void leave_allocator(void) {
+    in_allocator = 0;
+}
+
+// Allocate `size` bytes at a multiple of `alignment`, never returning NULL
+// for a size of zero
+static void* preload_alloc(size_t alignment, size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    if (!enter_allocator()) {
+        return fallback_alloc(alignment, size);
+    }
+    
+    void* ptr = alignment <= ALIGNMENT ? my_malloc(size) : my_aligned_alloc(alignment, size);
+    leave_allocator();
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* malloc(size_t size) {
+    return preload_alloc(ALIGNMENT, size);
+}
+
+void free(void* ptr) {
+    if (ptr == NULL || bootstrap_owns(ptr)) {
+        return;
+    }
+    if (!my_owns(ptr)) {
+        if (system_free != NULL) {
+            system_free(ptr);
+        }
+        return;
+    }
+    
+    // The allocator never frees our blocks from inside itself, but stay
+    // balanced if it ever does
+    int entered = enter_allocator();
+    my_free(ptr);
+    if (entered) {
+        leave_allocator();
+    }
+}
+
+void* calloc(size_t num, size_t size) {
+    if (size != 0 && num > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    
+    // Fresh bootstrap memory is already zeroed
+    size_t total = num * size;
+    if (!enter_allocator()) {
+        void* ptr = fallback_alloc(ALIGNMENT, total == 0 ? 1 : total);
+        if (ptr != NULL && !bootstrap_owns(ptr)) {
+            memset(ptr, 0, total);
+        }
+        return ptr;
+    }
+    
+    void* ptr = total == 0 ? my_malloc(1) : my_calloc(num, size);
+    leave_allocator();
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    
+    // Bootstrap blocks move out on their first resize
+    if (bootstrap_owns(ptr)) {
+        void* moved = malloc(size);
+        if (moved != NULL) {
+            size_t old_size = bootstrap_size(ptr);
+            memcpy(moved, ptr, old_size < size ? old_size : size);
+        }
+        return moved;
+    }
+    
+    if (!my_owns(ptr)) {
+        return system_realloc(ptr, size);
+    }
+    
+    int entered = enter_allocator();
+    void* resized = my_realloc(ptr, size);
+    if (entered) {
+        leave_allocator();
+    }
+    if (resized == NULL && size != 0) {
+        errno = ENOMEM;
+    }
+    return resized;
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    void* ptr = preload_alloc(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_alloc(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+size_t malloc_usable_size(void* ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    if (bootstrap_owns(ptr)) {
+        return bootstrap_size(ptr);
+    }
+    if (!my_owns(ptr)) {
+        return system_usable_size != NULL ? system_usable_size(ptr) : 0;
+    }
+    return my_usable_size(ptr);
+}
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include "../include/trace_tools.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+#else
+#define CYCLE_UNIT "ns"
+#endif
+
+// Replays an allocation trace recorded with my_trace_start() on one thread,
+// as fast as it will go, and reports throughput, latency, peak footprint
+// and final fragmentation.
+//
+// Usage: allocator_replay <trace> [segregated|tlsf|buddy|glibc]
+
+#define FOOTPRINT_INTERVAL 1024     // Records between footprint samples
+
+// Log-linear latency histogram: exact below 16, then 8 buckets per power of two
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS (16 + (64 - 4) * (1 << HIST_SUB_BITS))
+
+typedef struct {
+    unsigned long long counts[HIST_BUCKETS];
+    unsigned long long total;
+    unsigned long long max;
+} histogram_t;
+
+// Kinds of call timed separately
+enum { KIND_ALLOC, KIND_REALLOC, KIND_FREE, KINDS };
+static const char* kind_names[KINDS] = {"alloc", "realloc", "free"};
+
+static int use_glibc = 0;
+
+static unsigned long long read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t hist_bucket(unsigned long long value) {
+    if (value < 16) {
+        return (size_t)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    size_t sub = (size_t)(value >> (exponent - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return 16 + (size_t)(exponent - 4) * (1 << HIST_SUB_BITS) + sub;
+}
+
+// Smallest value falling in a bucket
+static unsigned long long hist_bucket_floor(size_t bucket) {
+    if (bucket < 16) {
+        return bucket;
+    }
+    size_t exponent = (bucket - 16) / (1 << HIST_SUB_BITS) + 4;
+    size_t sub = (bucket - 16) % (1 << HIST_SUB_BITS);
+    return (1ULL << exponent) + ((unsigned long long)sub << (exponent - HIST_SUB_BITS));
+}
+
+static void hist_add(histogram_t* hist, unsigned long long value) {
+    hist->counts[hist_bucket(value)]++;
+    hist->total++;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+static unsigned long long hist_percentile(const histogram_t* hist, double fraction) {
+    unsigned long long rank = (unsigned long long)(hist->total * fraction);
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > rank) {
+            return hist_bucket_floor(i);
+        }
+    }
+    return hist->max;
+}
+
+// Bytes in use and bytes held from the OS by the allocator replayed on
+static void footprint(size_t* live, size_t* held) {
+    if (use_glibc) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        struct mallinfo2 info = mallinfo2();
+#else
+        struct mallinfo info = mallinfo();
+#endif
+        *live = (size_t)info.uordblks + (size_t)info.hblkhd;
+        *held = (size_t)info.arena + (size_t)info.hblkhd;
+        return;
+    }
+    allocator_stats_t stats;
+    my_get_stats(&stats);
+    *live = stats.allocated_bytes;
+    *held = stats.allocated_bytes + stats.free_bytes;
+}
+
+static void* replay_malloc(size_t size) {
+    return use_glibc ? malloc(size) : my_malloc(size);
+}
+
+static void* replay_calloc(size_t size) {
+    return use_glibc ? calloc(1, size) : my_calloc(1, size);
+}
+
+static void* replay_aligned(size_t alignment, size_t size) {
+    // Sizes are rounded up for C11 aligned_alloc
+    size = (size + alignment - 1) & ~(alignment - 1);
+    return use_glibc ? aligned_alloc(alignment, size) : my_aligned_alloc(alignment, size);
+}
+
+static void* replay_realloc(void* ptr, size_t size) {
+    return use_glibc ? realloc(ptr, size) : my_realloc(ptr, size);
+}
+
+static void replay_free(void* ptr) {
+    if (use_glibc) {
+        free(ptr);
+    } else {
+        my_free(ptr);
+    }
+}
+
+// Start the allocator named on the command line; returns 0 if unknown
+static int start_allocator(const char* name) {
+    if (strcmp(name, "glibc") == 0) {
+        use_glibc = 1;
+        return 1;
+    }
+    return start_engine(name);
+}
+
+int main(int argc, char** argv) {
+    const char* engine_name = argc > 2 ? argv[2] : "segregated";
+    if (argc < 2 || argc > 3 || !start_allocator(engine_name)) {
+        fprintf(stderr, "Usage: %s <trace> [segregated|tlsf|buddy|glibc]\n", argv[0]);
+        return 1;
+    }
+    
+    trace_reader_t trace;
+    if (!trace_open(&trace, argv[1])) {
+        return 1;
+    }
+    
+    live_map_t live;
+    histogram_t* hists = (histogram_t*)tool_map(KINDS * sizeof(histogram_t));
+    if (!live_init(&live, 1024) || hists == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    
+    unsigned long long ops = 0, unknown = 0, failed = 0;
+    size_t peak_live = 0, peak_held = 0;
+    double elapsed = 0;
+    size_t count;
+    while ((count = trace_read(&trace)) > 0) {
+        double start = now_seconds();
+        for (size_t i = 0; i < count; i++) {
+            const trace_record_t* record = &trace.records[i];
+            unsigned long long begin;
+            void* ptr;
+            
+            switch (record->op) {
+                case TRACE_MALLOC:
+                case TRACE_CALLOC:
+                case TRACE_ALIGNED_ALLOC: {
+                    // An address still live was freed by a call made before recording
+                    live_entry_t* stale = live_find(&live, record->id);
+                    if (stale != NULL) {
+                        replay_free(stale->ptr);
+                        live_remove(&live, stale);
+                    }
+                    begin = read_cycles();
+                    ptr = record->op == TRACE_MALLOC   ? replay_malloc(record->size)
+                          : record->op == TRACE_CALLOC ? replay_calloc(record->size)
+                                                       : replay_aligned((size_t)1 << record->align_shift, record->size);
+                    hist_add(&hists[KIND_ALLOC], read_cycles() - begin);
+                    if (ptr == NULL || live_insert(&live, record->id, ptr) == NULL) {
+                        failed++;
+                    }
+                    break;
+                }
+                case TRACE_REALLOC: {
+                    live_entry_t* old = record->old_id != 0 ? live_find(&live, record->old_id) : NULL;
+                    if (record->old_id != 0 && old == NULL) {
+                        unknown++;
+                        break;
+                    }
+                    void* old_ptr = old != NULL ? old->ptr : NULL;
+                    begin = read_cycles();
+                    if (record->size == 0) {
+                        replay_free(old_ptr);
+                        ptr = NULL;
+                    } else {
+                        ptr = replay_realloc(old_ptr, record->size);
+                    }
+                    hist_add(&hists[KIND_REALLOC], read_cycles() - begin);
+                    
+                    // A failed realloc leaves the old block live, so it stays tracked
+                    if (old != NULL && (ptr != NULL || record->size == 0)) {
+                        live_remove(&live, old);
+                    }
+                    if (record->size != 0 && (ptr == NULL || live_insert(&live, record->id, ptr) == NULL)) {
+                        failed++;
+                    }
+                    break;
+                }
+                case TRACE_FREE: {
+                    // Blocks allocated before recording started are not ours to free
+                    live_entry_t* entry = live_find(&live, record->id);
+                    if (entry == NULL) {
+                        unknown++;
+                        break;
+                    }
+                    ptr = entry->ptr;
+                    live_remove(&live, entry);
+                    begin = read_cycles();
+                    replay_free(ptr);
+                    hist_add(&hists[KIND_FREE], read_cycles() - begin);
+                    break;
+                }
+                default:
+                    unknown++;
+                    break;
+            }
+            
+            // Sampling the footprint is not part of the replay, so the clock
+            // stops while mallinfo or the statistics are read
+            if (++ops % FOOTPRINT_INTERVAL == 0) {
+                elapsed += now_seconds() - start;
+                size_t live_bytes, held_bytes;
+                footprint(&live_bytes, &held_bytes);
+                peak_live = live_bytes > peak_live ? live_bytes : peak_live;
+                peak_held = held_bytes > peak_held ? held_bytes : peak_held;
+                start = now_seconds();
+            }
+        }
+        elapsed += now_seconds() - start;
+    }
+    trace_close(&trace);
+    
+    size_t live_bytes, held_bytes;
+    footprint(&live_bytes, &held_bytes);
+    peak_live = live_bytes > peak_live ? live_bytes : peak_live;
+    peak_held = held_bytes > peak_held ? held_bytes : peak_held;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    
+    printf("Replayed %llu records of %s on %s in %.3f s: %.2f M ops/s\n", ops, argv[1], engine_name, elapsed,
+           elapsed > 0 ? ops / elapsed / 1e6 : 0.0);
+    if (unknown > 0 || failed > 0) {
+        printf("Skipped %llu records naming blocks from before recording, %llu allocations failed\n", unknown,
+               failed);
+    }
+    
+    printf("Latency in %s:\n  %-8s %8s %8s %8s %8s %8s\n", CYCLE_UNIT, "", "p50", "p90", "p99", "p99.9", "max");
+    for (int kind = 0; kind < KINDS; kind++) {
+        const histogram_t* hist = &hists[kind];
+        if (hist->total == 0) {
+            continue;
+        }
+        printf("  %-8s %8llu %8llu %8llu %8llu %8llu  (%llu calls)\n", kind_names[kind],
+               hist_percentile(hist, 0.5), hist_percentile(hist, 0.9), hist_percentile(hist, 0.99),
+               hist_percentile(hist, 0.999), hist->max, hist->total);
+    }
+    
+    printf("Peak footprint: %zu bytes held, %zu bytes live, %ld KB resident\n", peak_held, peak_live,
+           usage.ru_maxrss);
+    printf("Final heap: %zu blocks live, %zu bytes live of %zu held (%.1f%% overhead)\n", live.live, live_bytes,
+           held_bytes, held_bytes > 0 ? 100.0 * (1.0 - (double)live_bytes / held_bytes) : 0.0);
+    if (!use_glibc) {
+        allocator_stats_t stats;
+        my_get_stats(&stats);
+        printf("Final fragmentation: %.1f%% external (largest free block %zu of %zu free bytes in %zu blocks)\n",
+               stats.free_bytes > 0 ? 100.0 * (1.0 - (double)stats.largest_free_block / stats.free_bytes) : 0.0,
+               stats.largest_free_block, stats.free_bytes, stats.free_blocks);
+    }
+    return 0;
+}
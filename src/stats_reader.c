@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/allocator.h"
+
+// Samples the statistics a process publishes with my_stats_export_start()
+// (or ALLOCATOR_STATS under the preload library) and prints one line per
+// sample: heap usage, call rates and the latency of the calls made since
+// the previous sample. Reads only the shared file, so the process being
+// watched never waits for it; a read racing an update is simply retried.
+//
+// Usage: allocator_stats <pid|file> [interval_ms] [samples]
+
+#define DEFAULT_SAMPLE_MS 100
+#define HEADER_EVERY 20             // Sample lines between column headings
+
+static const char* kind_names[LATENCY_KINDS] = {"malloc", "calloc", "realloc", "free"};
+
+static unsigned long long retries = 0; // Reads that raced an update
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+// Smallest value falling in a latency bucket
+static unsigned long long bucket_floor(size_t bucket) {
+    if (bucket < 16) {
+        return bucket;
+    }
+    size_t exponent = (bucket - 16) / (1 << PROBE_HIST_SUB_BITS) + 4;
+    size_t sub = (bucket - 16) % (1 << PROBE_HIST_SUB_BITS);
+    return (1ULL << exponent) + ((unsigned long long)sub << (exponent - PROBE_HIST_SUB_BITS));
+}
+
+// Percentile of the calls counted in `counts`
+static unsigned long long percentile(const unsigned long long counts[LATENCY_BUCKETS], double fraction) {
+    unsigned long long total = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        total += counts[i];
+    }
+    unsigned long long rank = (unsigned long long)(total * fraction);
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank) {
+            return bucket_floor(i);
+        }
+    }
+    return 0;
+}
+
+// Copy a consistent snapshot: the sequence is odd while the publisher is
+// writing and changes with every update, so retry until it is the same
+// even number before and after the copy
+static void read_snapshot(const stats_export_t* shared, stats_export_t* snapshot) {
+    for (;;) {
+        uint64_t sequence = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+        if ((sequence & 1) == 0) {
+            memcpy(snapshot, shared, sizeof(*snapshot));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) == sequence) {
+                return;
+            }
+        }
+        retries++;
+    }
+}
+
+// Map an export file and check its header; prints an error and returns NULL on failure
+static const stats_export_t* open_export(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", path);
+        return NULL;
+    }
+    struct stat info;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(stats_export_t)) {
+        map = mmap(NULL, sizeof(stats_export_t), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    
+    const stats_export_t* shared = map != MAP_FAILED ? (const stats_export_t*)map : NULL;
+    if (shared == NULL || __atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != STATS_EXPORT_MAGIC ||
+        shared->version != STATS_EXPORT_VERSION || shared->size != sizeof(stats_export_t)) {
+        fprintf(stderr, "Error: %s is not a version %d statistics export\n", path, STATS_EXPORT_VERSION);
+        return NULL;
+    }
+    return shared;
+}
+
+static void print_header(void) {
+    printf("%9s %12s %12s %12s %9s %12s %12s %15s %15s\n", "time (s)", "allocated", "free", "heap", "external",
+           "malloc/s", "free/s", "malloc p50/p99", "free p50/p99");
+}
+
+// Latency of the calls of one kind made between two snapshots
+static void print_window(const stats_export_t* previous, const stats_export_t* current, int kind) {
+    unsigned long long window[LATENCY_BUCKETS];
+    unsigned long long total = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        window[i] = current->latency[kind][i] - previous->latency[kind][i];
+        total += window[i];
+    }
+    char text[32] = "-";
+    if (total > 0) {
+        snprintf(text, sizeof(text), "%llu/%llu", percentile(window, 0.5), percentile(window, 0.99));
+    }
+    printf(" %15s", text);
+}
+
+static void print_sample(double elapsed, const stats_export_t* previous, const stats_export_t* current) {
+    const allocator_stats_t* stats = &current->stats;
+    double seconds = (current->timestamp_ns - previous->timestamp_ns) / 1e9;
+    printf("%9.3f %12zu %12zu %12zu %8.1f%% %12.0f %12.0f", elapsed, stats->allocated_bytes, stats->free_bytes,
+           stats->heap_size,
+           stats->free_bytes > 0 ? 100.0 * (1.0 - (double)stats->largest_free_block / stats->free_bytes) : 0.0,
+           seconds > 0 ? (stats->malloc_calls - previous->stats.malloc_calls) / seconds : 0.0,
+           seconds > 0 ? (stats->free_calls - previous->stats.free_calls) / seconds : 0.0);
+    print_window(previous, current, 0);
+    print_window(previous, current, 3);
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    long interval_ms = argc > 2 ? atol(argv[2]) : DEFAULT_SAMPLE_MS;
+    long samples = argc > 3 ? atol(argv[3]) : 0;
+    if (argc < 2 || argc > 4 || interval_ms <= 0 || samples < 0) {
+        fprintf(stderr, "Usage: %s <pid|file> [interval_ms] [samples]\n", argv[0]);
+        return 1;
+    }
+    
+    // A number names the default export of that process
+    char path[256];
+    if (strspn(argv[1], "0123456789") == strlen(argv[1])) {
+        snprintf(path, sizeof(path), "%s%s", STATS_EXPORT_PREFIX, argv[1]);
+    } else {
+        snprintf(path, sizeof(path), "%s", argv[1]);
+    }
+    const stats_export_t* shared = open_export(path);
+    stats_export_t* snapshots = (stats_export_t*)malloc(2 * sizeof(stats_export_t));
+    if (shared == NULL || snapshots == NULL) {
+        return 1;
+    }
+    
+    stats_export_t* previous = &snapshots[0];
+    stats_export_t* current = &snapshots[1];
+    read_snapshot(shared, previous);
+    stats_export_t first = *previous;
+    printf("Statistics of process %u from %s, published every %u ms\n\n", previous->pid, path,
+           previous->interval_ms);
+    
+    double start = now_seconds();
+    for (long sample = 0; samples == 0 || sample < samples; sample++) {
+        sleep_ms(interval_ms);
+        read_snapshot(shared, current);
+        if (sample % HEADER_EVERY == 0) {
+            print_header();
+        }
+        print_sample(now_seconds() - start, previous, current);
+        fflush(stdout);
+        
+        stats_export_t* swap = previous;
+        previous = current;
+        current = swap;
+        
+        // The file outlives a process killed before it could remove it
+        if (kill((pid_t)previous->pid, 0) != 0) {
+            printf("Process %u has exited\n", previous->pid);
+            break;
+        }
+    }
+    
+    printf("\nLatency in ns of the calls timed while watching (one of each kind in %d per thread):\n",
+           LATENCY_SAMPLE_INTERVAL);
+    printf("  %-8s %8s %8s %8s %8s\n", "", "p50", "p90", "p99", "p99.9");
+    for (int kind = 0; kind < LATENCY_KINDS; kind++) {
+        unsigned long long counts[LATENCY_BUCKETS];
+        unsigned long long total = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            counts[i] = previous->latency[kind][i] - first.latency[kind][i];
+            total += counts[i];
+        }
+        if (total == 0) {
+            continue;
+        }
+        printf("  %-8s %8llu %8llu %8llu %8llu  (%llu calls)\n", kind_names[kind], percentile(counts, 0.5),
+               percentile(counts, 0.9), percentile(counts, 0.99), percentile(counts, 0.999), total);
+    }
+    printf("%llu updates published, %llu reads retried\n", (unsigned long long)(previous->updates - first.updates),
+           retries);
+    free(snapshots);
+    return 0;
+}
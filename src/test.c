@@ -1,10 +1,28 @@
+#define _POSIX_C_SOURCE 199309L
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 #include "../include/allocator.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+#else
+#define CYCLE_UNIT "ns"
+#endif
+
 // Test function prototypes
 void test_basic_allocation(void);
 void test_free_and_reuse(void);
@@ -14,11 +32,53 @@ void test_realloc(void);
 void test_calloc(void);
 void test_edge_cases(void);
 void test_stress(void);
-void benchmark_vs_stdlib(void);
+void test_segregated_fit(void);
+void test_thread_safety(void);
+void test_thread_cache(void);
+void test_arenas(void);
+void test_slab(void);
+void test_realloc_in_place(void);
+void test_heap_growth(void);
+void test_huge_allocations(void);
+void test_purging(void);
+void test_aligned_allocation(void);
+void test_batch_allocation(void);
+void test_compact_header(void);
+void test_tlsf(void);
+void test_buddy(void);
+void test_placement_policies(void);
+void test_live_stats(void);
+void test_remote_free(void);
+void test_ownership(void);
+void test_trace(void);
+void test_heap_profile(void);
+void test_probes(void);
+#ifndef _WIN32
+void test_stats_export(void);
+void test_fork(void);
+#endif
+void benchmark_free_latency(void);
+void benchmark_fragmented_malloc(void);
+void benchmark_thread_scaling(void);
+void benchmark_thread_cache(void);
+void benchmark_slab(void);
+void benchmark_realloc_growth(void);
+void benchmark_huge_realloc(void);
+void benchmark_purge(void);
+void benchmark_batch(void);
+void benchmark_latency(void);
+void benchmark_buddy(void);
+void benchmark_placement(void);
+void benchmark_remote_free(void);
+void benchmark_heap_profile(void);
 
 // Utility functions
 void print_test_header(const char* test_name);
 void print_test_result(const char* test_name, int passed);
+long long now_ns(void);
+unsigned int next_random(unsigned int* state);
+unsigned long long read_cycles(void);
+void reinit_allocator(const allocator_options_t* options);
 
 int main(void) {
     printf("Dynamic Memory Allocator Test Suite\n");
@@ -36,12 +96,51 @@ int main(void) {
     test_calloc();
     test_edge_cases();
     test_stress();
+    test_segregated_fit();
+    test_thread_safety();
+    test_thread_cache();
+    test_arenas();
+    test_slab();
+    test_realloc_in_place();
+    test_heap_growth();
+    test_huge_allocations();
+    test_purging();
+    test_aligned_allocation();
+    test_batch_allocation();
+    test_compact_header();
+    test_tlsf();
+    test_buddy();
+    test_placement_policies();
+    test_live_stats();
+    test_remote_free();
+    test_ownership();
+    test_trace();
+    test_heap_profile();
+    test_probes();
+#ifndef _WIN32
+    test_stats_export();
+    test_fork();
+#endif
     
     // Performance benchmark
-    benchmark_vs_stdlib();
+    benchmark_free_latency();
+    benchmark_fragmented_malloc();
+    benchmark_thread_scaling();
+    benchmark_thread_cache();
+    benchmark_slab();
+    benchmark_realloc_growth();
+    benchmark_huge_realloc();
+    benchmark_purge();
+    benchmark_batch();
+    benchmark_latency();
+    benchmark_buddy();
+    benchmark_placement();
+    benchmark_remote_free();
+    benchmark_heap_profile();
     
     // Final heap status
     print_heap_status();
+    print_probe_report();
     
     // Validate heap integrity
     if (validate_heap()) {
@@ -65,6 +164,31 @@ void print_test_result(const char* test_name, int passed) {
     printf("%s: %s\n", test_name, passed ? "✓ PASSED" : "✗ FAILED");
 }
 
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+unsigned int next_random(unsigned int* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+// Read the CPU cycle counter, or the clock in nanoseconds where there is none
+unsigned long long read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (unsigned long long)now_ns();
+#endif
+}
+
+void reinit_allocator(const allocator_options_t* options) {
+    allocator_cleanup();
+    allocator_init_ex(options);
+}
+
 void test_basic_allocation(void) {
     print_test_header("Basic Allocation Test");
     
@@ -252,9 +376,14 @@ void test_edge_cases(void) {
     // Test free with NULL
     my_free(NULL); // Should not crash
     
-    // Test very large allocation
-    void* ptr2 = my_malloc(HEAP_SIZE + 1);
-    success = success && (ptr2 == NULL);
+    // Test allocation larger than a region (the heap grows to fit it)
+    void* ptr2 = my_malloc(REGION_SIZE + 1);
+    success = success && (ptr2 != NULL);
+    my_free(ptr2);
+    
+    // Test impossibly large allocation
+    void* ptr4 = my_malloc(SIZE_MAX / 2);
+    success = success && (ptr4 == NULL);
     
     // Test double free detection (should print error but not crash)
     void* ptr3 = my_malloc(100);
@@ -314,31 +443,1956 @@ void test_stress(void) {
     print_test_result("Stress Test", success);
 }
 
-void benchmark_vs_stdlib(void) {
-    print_test_header("Performance Benchmark");
+void test_segregated_fit(void) {
+    print_test_header("Segregated Fit Test");
+    
+    // Each heap region starts out as one free block
+    int initial_free_blocks = get_fragmentation_count();
+    
+    // Leave a 40-byte and a 64-byte hole, separated by live guard blocks
+    void* exact = my_malloc(40);
+    void* guard1 = my_malloc(16);
+    void* larger = my_malloc(64);
+    void* guard2 = my_malloc(16);
+    
+    my_free(exact);
+    my_free(larger);
+    
+    // A plain first-fit list would hand out the most recently freed hole;
+    // the exact-size bin must win instead
+    void* ptr = my_malloc(40);
+    int success = (ptr == exact);
+    
+    // Bin boundaries: exact small bins, then power-of-two large bins
+    success = success && (bin_index(MIN_BLOCK_SIZE) == 0) &&
+              (bin_index(SMALL_BIN_LIMIT - HEADER_SIZE) == NUM_SMALL_BINS - 1) &&
+              (bin_index(SMALL_BIN_LIMIT) == NUM_SMALL_BINS) &&
+              (bin_index(2 * SMALL_BIN_LIMIT - ALIGNMENT) == NUM_SMALL_BINS);
+    
+    my_free(ptr);
+    my_free(guard1);
+    my_free(guard2);
+    
+    success = success && validate_heap() && (get_fragmentation_count() == initial_free_blocks);
+    print_test_result("Segregated Fit", success);
+}
+
+#define CHURN_SLOTS 64
+
+typedef struct {
+    unsigned int seed;
+    int operations;
+    int ok;
+} churn_work_t;
+
+// Randomly allocate and free small blocks, checking each block's contents
+static void* churn_thread(void* arg) {
+    churn_work_t* work = (churn_work_t*)arg;
+    void* ptrs[CHURN_SLOTS] = {0};
+    size_t sizes[CHURN_SLOTS] = {0};
+    unsigned int state = work->seed;
+    
+    work->ok = 1;
+    for (int i = 0; i < work->operations; i++) {
+        int slot = next_random(&state) % CHURN_SLOTS;
+        unsigned char tag = (unsigned char)(slot ^ work->seed);
+        
+        if (ptrs[slot] != NULL) {
+            unsigned char* bytes = (unsigned char*)ptrs[slot];
+            if (bytes[0] != tag || bytes[sizes[slot] - 1] != tag) {
+                work->ok = 0;
+            }
+            my_free(ptrs[slot]);
+            ptrs[slot] = NULL;
+        } else {
+            sizes[slot] = (next_random(&state) % 256) + 1;
+            ptrs[slot] = my_malloc(sizes[slot]);
+            if (ptrs[slot] == NULL) {
+                work->ok = 0;
+                continue;
+            }
+            memset(ptrs[slot], tag, sizes[slot]);
+        }
+    }
+    
+    for (int slot = 0; slot < CHURN_SLOTS; slot++) {
+        my_free(ptrs[slot]);
+    }
+    return NULL;
+}
+
+// Run the churn workload on several threads and return the elapsed time
+static long long run_churn_threads(int num_threads, int operations, int* all_ok) {
+    pthread_t threads[16];
+    churn_work_t work[16];
+    
+    long long start = now_ns();
+    for (int t = 0; t < num_threads; t++) {
+        work[t].seed = (unsigned int)(t + 1) * 7919u;
+        work[t].operations = operations;
+        pthread_create(&threads[t], NULL, churn_thread, &work[t]);
+    }
+    *all_ok = 1;
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+        *all_ok = *all_ok && work[t].ok;
+    }
+    return now_ns() - start;
+}
+
+void test_thread_safety(void) {
+    print_test_header("Thread Safety Test");
+    
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    reinit_allocator(&options);
+    
+    int success;
+    run_churn_threads(4, 20000, &success);
+    
+    success = success && validate_heap() && (get_total_allocated() == 0) &&
+              (get_fragmentation_count() == DEFAULT_ARENAS);
+    
+    reinit_allocator(NULL);
+    print_test_result("Thread Safety", success);
+}
+
+#ifndef _WIN32
+// Fork while other threads allocate: with the fork handlers in place the
+// child always finds the heap unlocked and consistent
+void test_fork(void) {
+    print_test_header("Fork Test");
+    
+    static int registered = 0;
+    if (!registered) {
+        pthread_atfork(allocator_fork_prepare, allocator_fork_release, allocator_fork_release);
+        registered = 1;
+    }
+    
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    options.tcache = 1;
+    options.slab = 1;
+    options.remote_free = 1;
+    options.num_arenas = 2;
+    reinit_allocator(&options);
+    
+    pthread_t threads[2];
+    churn_work_t work[2];
+    for (int t = 0; t < 2; t++) {
+        work[t].seed = (unsigned int)(t + 1) * 104729u;
+        work[t].operations = 400000;
+        pthread_create(&threads[t], NULL, churn_thread, &work[t]);
+    }
+    
+    int success = 1;
+    for (int i = 0; i < 20; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // A lock left held by a parent thread would hang the child
+            alarm(10);
+            void* small = my_malloc(48);
+            void* large = my_malloc(200000);
+            my_free(small);
+            my_free(large);
+            _exit(small != NULL && large != NULL && validate_heap() ? 0 : 1);
+        }
+        int status = 0;
+        success = success && (pid > 0) && (waitpid(pid, &status, 0) == pid) && WIFEXITED(status) &&
+                  (WEXITSTATUS(status) == 0);
+        sched_yield();
+    }
+    
+    for (int t = 0; t < 2; t++) {
+        pthread_join(threads[t], NULL);
+        success = success && work[t].ok;
+    }
+    success = success && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Fork", success);
+}
+#endif
+
+void test_thread_cache(void) {
+    print_test_header("Thread Cache Test");
+    
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    options.tcache = 1;
+    reinit_allocator(&options);
+    
+    // A freed small block is handed straight back by the cache
+    void* first = my_malloc(64);
+    my_free(first);
+    void* second = my_malloc(64);
+    int success = (first == second);
+    my_free(second);
+    
+    // Overflowing a class flushes part of it back to the heap
+    void* ptrs[3 * TCACHE_CAPACITY];
+    for (int i = 0; i < 3 * TCACHE_CAPACITY; i++) {
+        ptrs[i] = my_malloc(32);
+        success = success && (ptrs[i] != NULL);
+    }
+    for (int i = 0; i < 3 * TCACHE_CAPACITY; i++) {
+        my_free(ptrs[i]);
+    }
+    
+    // Worker caches drain when the threads exit
+    int ok;
+    run_churn_threads(4, 20000, &ok);
+    allocator_flush_thread_cache();
+    
+    success = success && ok && (get_total_allocated() == 0) && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Thread Cache", success);
+}
+
+// Allocate a few blocks on a worker thread for the main thread to free
+static void* allocate_for_other_thread(void* arg) {
+    void** ptrs = (void**)arg;
+    for (int i = 0; i < 8; i++) {
+        ptrs[i] = my_malloc(1000);
+    }
+    return NULL;
+}
+
+// Leave a freed block, held apart from the heap's free space by a live
+// guard block after it, for another thread to free again
+static void* free_on_other_thread(void* arg) {
+    void** ptrs = (void**)arg;
+    ptrs[0] = my_malloc(64);
+    ptrs[1] = my_malloc(64);
+    my_free(ptrs[0]);
+    return NULL;
+}
+
+// Allocate two blocks of the size free_on_other_thread() freed
+static void* reuse_on_other_thread(void* arg) {
+    void** ptrs = (void**)arg;
+    ptrs[0] = my_malloc(64);
+    ptrs[1] = my_malloc(64);
+    return NULL;
+}
+
+void test_arenas(void) {
+    print_test_header("Arena Test");
+    
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    reinit_allocator(&options);
+    
+    size_t shared_allocated = get_total_allocated();
+    arena_t* arena = arena_create(64 * 1024);
+    int success = (arena != NULL);
+    
+    // Private arena allocations are accounted to that arena only
+    char* ptr = (char*)arena_malloc(arena, 100);
+    success = success && (ptr != NULL) && (arena_get_allocated(arena) >= 100) &&
+              (get_total_allocated() - shared_allocated == arena_get_allocated(arena));
+    
+    // Growing keeps the block inside its arena, and my_free finds the owner
+    if (success) {
+        strcpy(ptr, "private");
+        ptr = (char*)my_realloc(ptr, 4000);
+        success = (ptr != NULL) && (strcmp(ptr, "private") == 0) &&
+                  (arena_get_allocated(arena) >= 4000);
+        my_free(ptr);
+        success = success && (arena_get_allocated(arena) == 0);
+    }
+    
+    // Blocks still allocated go away with the arena
+    arena_malloc(arena, 256);
+    arena_destroy(arena);
+    success = success && (get_total_allocated() == shared_allocated);
+    
+    // Blocks from another thread's arena are freed back to that arena
+    void* ptrs[8];
+    pthread_t thread;
+    pthread_create(&thread, NULL, allocate_for_other_thread, ptrs);
+    pthread_join(thread, NULL);
+    for (int i = 0; i < 8; i++) {
+        success = success && (ptrs[i] != NULL);
+        my_free(ptrs[i]);
+    }
+    success = success && (get_total_allocated() == shared_allocated) && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Arenas", success);
+}
+
+void test_slab(void) {
+    print_test_header("Slab Test");
+    
+    allocator_options_t options = {0};
+    options.slab = 1;
+    reinit_allocator(&options);
+    
+    // Objects of one class sit back to back with no header between them
+    char* first = (char*)my_malloc(24);
+    char* second = (char*)my_malloc(24);
+    int success = (first != NULL) && (second - first == 32) && (get_total_allocated() == 64);
+    
+    // The lowest free slot is reused first
+    my_free(first);
+    char* third = (char*)my_malloc(32);
+    success = success && (third == first);
+    
+    // Growing moves the object to a larger class and keeps its contents
+    strcpy(third, "slab");
+    third = (char*)my_realloc(third, 200);
+    success = success && (third != NULL) && (strcmp(third, "slab") == 0);
+    
+    // Freeing a slab object twice is caught by its bitmap
+    my_free(second);
+    my_free(second);
+    my_free(third);
+    
+    // Fill several slabs of one class, then empty them again
+    void* ptrs[1000];
+    for (int i = 0; i < 1000; i++) {
+        ptrs[i] = my_malloc(16);
+        success = success && (ptrs[i] != NULL);
+    }
+    success = success && (get_total_allocated() == 16000) && validate_heap();
+    for (int i = 0; i < 1000; i++) {
+        my_free(ptrs[i]);
+    }
+    success = success && (get_total_allocated() == 0);
+    
+    // Concurrent small-object churn
+    options.thread_safe = 1;
+    reinit_allocator(&options);
+    int ok;
+    run_churn_threads(4, 20000, &ok);
+    success = success && ok && (get_total_allocated() == 0) && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Slab", success);
+}
+
+void test_realloc_in_place(void) {
+    print_test_header("In-Place Realloc Test");
+    
+    reinit_allocator(NULL);
+    
+    char* a = (char*)my_malloc(128);
+    char* b = (char*)my_malloc(128);
+    char* c = (char*)my_malloc(128);
+    strcpy(a, "grow me");
+    
+    // Growing absorbs the free right neighbour without moving
+    my_free(b);
+    char* grown = (char*)my_realloc(a, 256);
+    int success = (grown == a) && (strcmp(a, "grow me") == 0) && validate_heap();
+    
+    // Shrinking frees the tail back to the heap
+    char* shrunk = (char*)my_realloc(a, 40);
+    success = success && (shrunk == a) && (get_total_allocated() == align_size(40) + align_size(128)) && validate_heap();
+    
+    // Without enough room next door the block has to move
+    char* moved = (char*)my_realloc(a, 1000);
+    success = success && (moved != NULL) && (moved != a) && (strcmp(moved, "grow me") == 0);
+    
+    my_free(moved);
+    my_free(c);
+    success = success && (get_total_allocated() == 0) && (get_fragmentation_count() == 1) && validate_heap();
+    
+    print_test_result("In-Place Realloc", success);
+}
+
+// heap_walk() callback counting blocks and free blocks
+static void count_blocks(const block_header_t* block, void* context) {
+    int* counts = (int*)context;
+    counts[0]++;
+    counts[1] += BLOCK_IS_FREE(block);
+}
+
+void test_heap_growth(void) {
+    print_test_header("Heap Growth Test");
+    
+    reinit_allocator(NULL);
+    size_t initial_size = get_heap_size();
+    
+    // Hold a working set several times the size of one region
+    const int count = 4096;
+    void** ptrs = malloc(count * sizeof(void*));
+    int success = 1;
+    for (int i = 0; i < count; i++) {
+        ptrs[i] = my_malloc(1024);
+        success = success && (ptrs[i] != NULL);
+    }
+    // The last block of a region may keep a remainder too small to split off
+    size_t slack = get_total_allocated() - (size_t)count * align_size(1024);
+    success = success && (get_heap_size() > initial_size + 3 * REGION_SIZE) &&
+              (get_total_allocated() >= (size_t)count * align_size(1024)) &&
+              (slack <= get_heap_size() / REGION_SIZE * (HEADER_SIZE + MIN_BLOCK_SIZE)) && validate_heap();
+    
+    // A block larger than a region gets a region sized to fit
+    char* big = (char*)my_malloc(3 * REGION_SIZE);
+    success = success && (big != NULL);
+    if (big != NULL) {
+        memset(big, 0xAB, 3 * REGION_SIZE);
+    }
+    
+    my_free(big);
+    for (int i = 0; i < count; i++) {
+        my_free(ptrs[i]);
+    }
+    free(ptrs);
+    
+    // Every region is back to a single free block, and the walk sees them all
+    int counts[2] = {0, 0};
+    heap_walk(count_blocks, counts);
+    success = success && (get_total_allocated() == 0) && validate_heap() && (counts[0] > 1) &&
+              (counts[0] == counts[1]) && (counts[1] == get_fragmentation_count());
+    
+    reinit_allocator(NULL);
+    print_test_result("Heap Growth", success);
+}
+
+// Check that every byte of a buffer still holds its fill pattern
+static int check_pattern(const unsigned char* buffer, size_t size) {
+    for (size_t i = 0; i < size; i += 4096) {
+        if (buffer[i] != (unsigned char)(i / 4096)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void fill_pattern(unsigned char* buffer, size_t size) {
+    for (size_t i = 0; i < size; i += 4096) {
+        buffer[i] = (unsigned char)(i / 4096);
+    }
+}
+
+void test_huge_allocations(void) {
+    print_test_header("Huge Allocation Test");
+    
+    reinit_allocator(NULL);
+    size_t heap_size = get_heap_size();
+    int free_blocks = get_fragmentation_count();
+    
+    // Huge blocks live outside the heap regions
+    size_t size = 4 * REGION_SIZE;
+    unsigned char* buffer = (unsigned char*)my_malloc(size);
+    int success = (buffer != NULL) && (get_heap_size() == heap_size) &&
+                  (get_total_allocated() >= size) && validate_heap();
+    
+    // Growing and shrinking keep the contents
+    if (buffer != NULL) {
+        fill_pattern(buffer, size);
+        buffer = (unsigned char*)my_realloc(buffer, 16 * REGION_SIZE);
+        success = success && (buffer != NULL) && check_pattern(buffer, size);
+    }
+    if (buffer != NULL) {
+        buffer = (unsigned char*)my_realloc(buffer, 2 * REGION_SIZE);
+        success = success && (buffer != NULL) && check_pattern(buffer, 2 * REGION_SIZE) && validate_heap();
+    }
+    
+    // Shrinking below the threshold moves the block into the heap
+    if (buffer != NULL) {
+        buffer = (unsigned char*)my_realloc(buffer, 1000);
+        success = success && (buffer != NULL) && check_pattern(buffer, 1000) && (get_total_allocated() < 2000);
+    }
+    my_free(buffer);
+    
+    // Huge calloc memory is zeroed
+    unsigned char* zeroed = (unsigned char*)my_calloc(REGION_SIZE, 2);
+    success = success && (zeroed != NULL) && (zeroed[0] == 0) && (zeroed[2 * REGION_SIZE - 1] == 0);
+    my_free(zeroed);
+    
+    success = success && (get_total_allocated() == 0) && (get_heap_size() == heap_size) &&
+              (get_fragmentation_count() == free_blocks) && validate_heap();
+    
+    // The threshold is configurable
+    allocator_options_t options = {0};
+    options.mmap_threshold = 4096;
+    reinit_allocator(&options);
+    size_t free_bytes = get_total_free();
+    void* small = my_malloc(4096);
+    success = success && (small != NULL) && (get_total_free() == free_bytes);
+    my_free(small);
+    success = success && (get_total_allocated() == 0) && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Huge Allocations", success);
+}
+
+// Two call sites, kept apart in the heap profile
+static void* profiled_small(void) {
+    return my_malloc(100);
+}
+
+static void* profiled_large(void) {
+    return my_calloc(3, 100);
+}
+
+void test_heap_profile(void) {
+    print_test_header("Heap Profile Test");
+    
+    reinit_allocator(NULL);
+    const char* path = "allocator_test.heap";
+    
+    // A one-byte interval samples every block
+    int success = my_profile_start(1);
+    void* small[50];
+    void* large[10];
+    for (int i = 0; i < 50; i++) {
+        small[i] = profiled_small();
+    }
+    for (int i = 0; i < 10; i++) {
+        large[i] = profiled_large();
+    }
+    for (int i = 0; i < 20; i++) {
+        my_free(small[i]);
+    }
+    
+    // A failed resize leaves the block, and its sample, live
+    success = success && (my_realloc(large[0], SIZE_MAX / 2) == NULL);
+    success = success && my_profile_dump(path);
+    my_profile_stop();
+    for (int i = 20; i < 50; i++) {
+        my_free(small[i]);
+    }
+    for (int i = 0; i < 10; i++) {
+        my_free(large[i]);
+    }
+    
+    // Totals first, then one line per call stack
+    unsigned long long totals[4] = {0};
+    size_t interval = 0;
+    int small_site = 0, large_site = 0, mappings = 0;
+    char line[1024];
+    FILE* file = fopen(path, "r");
+    if (file != NULL) {
+        success = success && fgets(line, sizeof(line), file) != NULL &&
+                  sscanf(line, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu", &totals[0], &totals[1],
+                         &totals[2], &totals[3], &interval) == 5;
+        while (fgets(line, sizeof(line), file) != NULL) {
+            small_site += strncmp(line, "30: 3000 [50: 5000] @ 0x", 24) == 0;
+            large_site += strncmp(line, "10: 3000 [10: 3000] @ 0x", 24) == 0;
+            mappings += strcmp(line, "MAPPED_LIBRARIES:\n") == 0;
+        }
+        fclose(file);
+    }
+    remove(path);
+    
+    success = success && (totals[0] == 40) && (totals[1] == 6000) && (totals[2] == 60) && (totals[3] == 8000) &&
+              (interval == 1) && (small_site == 1) && (large_site == 1) && (mappings == 1);
+    
+    reinit_allocator(NULL);
+    print_test_result("Heap profile", success);
+}
+
+void test_probes(void) {
+    print_test_header("Hot Path Probes Test");
+    
+    reinit_allocator(NULL);
+    static probe_stats_t before[PROBES], after[PROBES];
+    int instrumented = my_get_probe_stats(before);
+    
+    // Splits on allocation, merges on free, and one explicit merge pass
+    void* ptrs[100];
+    for (int i = 0; i < 100; i++) {
+        ptrs[i] = my_malloc(64);
+    }
+    for (int i = 0; i < 100; i += 2) {
+        my_free(ptrs[i]);
+    }
+    for (int i = 1; i < 100; i += 2) {
+        my_free(ptrs[i]);
+    }
+    merge_free_blocks();
+    int success = my_get_probe_stats(after) == instrumented;
+    
+    // Without ALLOCATOR_INSTRUMENT everything reads zero
+    unsigned long long minimum[PROBES] = {100, 100, 100, 1, 1};
+    for (int probe = 0; probe < PROBES; probe++) {
+        unsigned long long calls = after[probe].calls - before[probe].calls;
+        unsigned long long cycle_calls = 0, node_calls = 0;
+        for (int i = 0; i < PROBE_HIST_BUCKETS; i++) {
+            cycle_calls += after[probe].cycle_hist[i] - before[probe].cycle_hist[i];
+            node_calls += after[probe].node_hist[i] - before[probe].node_hist[i];
+        }
+        success = success && (instrumented ? calls >= minimum[probe] : after[probe].calls == 0) &&
+                  (cycle_calls == calls) && (node_calls == calls);
+    }
+    if (instrumented) {
+        // Every find looks at one bin head at least
+        success = success && (after[PROBE_FIND].nodes - before[PROBE_FIND].nodes >= 100);
+    }
+    
+    reinit_allocator(NULL);
+    print_test_result(instrumented ? "Hot path probes" : "Hot path probes compiled out", success);
+}
+
+#ifndef _WIN32
+void test_stats_export(void) {
+    print_test_header("Statistics Export Test");
+    
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    reinit_allocator(&options);
+    const char* path = "allocator_test.stats";
+    
+    int success = my_stats_export_start(path, 1);
+    void* ptrs[1000];
+    for (int i = 0; i < 1000; i++) {
+        ptrs[i] = my_malloc(64);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        my_free(ptrs[i]);
+    }
+    
+    // Read the way allocator_stats does until an update shows the calls
+    int fd = open(path, O_RDONLY);
+    void* map = fd >= 0 ? mmap(NULL, sizeof(stats_export_t), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    const stats_export_t* shared = map != MAP_FAILED ? (const stats_export_t*)map : NULL;
+    static stats_export_t snapshot;
+    long long deadline = now_ns() + 5000000000LL;
+    int published = 0;
+    while (shared != NULL && !published && now_ns() < deadline) {
+        uint64_t sequence = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+        memcpy(&snapshot, shared, sizeof(snapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        published = (sequence & 1) == 0 && __atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) == sequence &&
+                    snapshot.stats.free_calls == 500;
+        if (!published) {
+            sched_yield();
+        }
+    }
     
+    // One call in LATENCY_SAMPLE_INTERVAL per thread is timed
+    unsigned long long timed[LATENCY_KINDS] = {0};
+    for (int kind = 0; kind < LATENCY_KINDS; kind++) {
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+            timed[kind] += snapshot.latency[kind][i];
+        }
+    }
+    success = success && published && (snapshot.magic == STATS_EXPORT_MAGIC) &&
+              (snapshot.version == STATS_EXPORT_VERSION) && (snapshot.size == sizeof(stats_export_t)) &&
+              (snapshot.pid == (uint32_t)getpid()) && (snapshot.interval_ms == 1) && (snapshot.updates >= 1) &&
+              (snapshot.stats.malloc_calls == 1000) && (snapshot.stats.allocated_bytes >= 500 * 64) &&
+              (timed[0] >= 1000 / LATENCY_SAMPLE_INTERVAL) && (timed[3] >= 500 / LATENCY_SAMPLE_INTERVAL) &&
+              (timed[1] == 0) && (timed[2] == 0);
+    if (shared != NULL) {
+        munmap(map, sizeof(stats_export_t));
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    
+    // Stopping removes the file
+    my_stats_export_stop();
+    FILE* file = fopen(path, "r");
+    success = success && (file == NULL);
+    if (file != NULL) {
+        fclose(file);
+    }
+    for (int i = 1; i < 1000; i += 2) {
+        my_free(ptrs[i]);
+    }
+    
+    reinit_allocator(NULL);
+    print_test_result("Statistics export", success);
+}
+#endif
+
+void benchmark_free_latency(void) {
+    print_test_header("Free Latency Benchmark");
+    
+    const int live_counts[] = {10, 100, 1000, 10000, 100000};
+    
+    for (size_t c = 0; c < sizeof(live_counts) / sizeof(live_counts[0]); c++) {
+        int count = live_counts[c];
+        
+        void** ptrs = malloc(count * sizeof(void*));
+        for (int i = 0; i < count; i++) {
+            ptrs[i] = my_malloc(MIN_BLOCK_SIZE);
+        }
+        
+        // Free every other block first (no neighbour is free yet), then the
+        // rest, which coalesce with free blocks on both sides
+        long long start = now_ns();
+        for (int i = 0; i < count; i += 2) {
+            my_free(ptrs[i]);
+        }
+        for (int i = 1; i < count; i += 2) {
+            my_free(ptrs[i]);
+        }
+        long long elapsed = now_ns() - start;
+        
+        printf("%6d live blocks: %.1f ns per free\n", count, (double)elapsed / count);
+        free(ptrs);
+    }
+}
+
+void benchmark_fragmented_malloc(void) {
+    print_test_header("Fragmented Malloc Benchmark");
+    
+    const int hole_counts[] = {10, 100, 1000, 5000};
     const int NUM_OPERATIONS = 10000;
-    clock_t start, end;
     
-    // Benchmark custom allocator
-    start = clock();
-    for (int i = 0; i < NUM_OPERATIONS; i++) {
+    for (size_t c = 0; c < sizeof(hole_counts) / sizeof(hole_counts[0]); c++) {
+        int count = hole_counts[c];
+        void** holes = malloc(count * sizeof(void*));
+        void** guards = malloc(count * sizeof(void*));
+        
+        // Punch small holes that can never satisfy the timed requests
+        for (int i = 0; i < count; i++) {
+            holes[i] = my_malloc(MIN_BLOCK_SIZE);
+            guards[i] = my_malloc(MIN_BLOCK_SIZE);
+        }
+        for (int i = 0; i < count; i++) {
+            my_free(holes[i]);
+        }
+        
+        long long start = now_ns();
+        for (int i = 0; i < NUM_OPERATIONS; i++) {
+            void* ptr = my_malloc(256);
+            if (ptr) my_free(ptr);
+        }
+        long long elapsed = now_ns() - start;
+        
+        printf("%5d free holes: %.1f ns per malloc/free pair\n", count, (double)elapsed / NUM_OPERATIONS);
+        
+        for (int i = 0; i < count; i++) {
+            my_free(guards[i]);
+        }
+        free(holes);
+        free(guards);
+    }
+}
+
+void benchmark_thread_scaling(void) {
+    print_test_header("Thread Scaling Benchmark");
+    
+    const int OPERATIONS_PER_THREAD = 200000;
+    const int arena_counts[] = {1, DEFAULT_ARENAS};
+    
+    for (size_t c = 0; c < sizeof(arena_counts) / sizeof(arena_counts[0]); c++) {
+        allocator_options_t options = {0};
+        options.thread_safe = 1;
+        options.num_arenas = arena_counts[c];
+        reinit_allocator(&options);
+        
+        for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+            int ok;
+            long long elapsed = run_churn_threads(num_threads, OPERATIONS_PER_THREAD, &ok);
+            double total_ops = (double)num_threads * OPERATIONS_PER_THREAD;
+            printf("%d arena(s), %d thread(s): %.2f Mops/s%s\n",
+                   arena_counts[c], num_threads, total_ops / elapsed * 1000.0,
+                   ok ? "" : " (errors)");
+        }
+    }
+    
+    reinit_allocator(NULL);
+}
+
+// Repeatedly allocate and free one hot size
+static void* hot_pair_thread(void* arg) {
+    int operations = *(int*)arg;
+    for (int i = 0; i < operations; i++) {
         void* ptr = my_malloc(64);
-        if (ptr) my_free(ptr);
+        my_free(ptr);
+    }
+    return NULL;
+}
+
+void benchmark_thread_cache(void) {
+    print_test_header("Thread Cache Benchmark");
+    
+    int operations = 1000000;
+    
+    for (int tcache = 0; tcache <= 1; tcache++) {
+        allocator_options_t options = {0};
+        options.thread_safe = 1;
+        options.tcache = tcache;
+        reinit_allocator(&options);
+        
+        for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+            pthread_t threads[8];
+            long long start = now_ns();
+            for (int t = 0; t < num_threads; t++) {
+                pthread_create(&threads[t], NULL, hot_pair_thread, &operations);
+            }
+            for (int t = 0; t < num_threads; t++) {
+                pthread_join(threads[t], NULL);
+            }
+            long long elapsed = now_ns() - start;
+            
+            double pairs = (double)operations * num_threads;
+            printf("%s, %d thread(s): %.1f ns per malloc/free pair, %.2f M pairs/s\n",
+                   tcache ? "tcache on " : "tcache off", num_threads,
+                   (double)elapsed / pairs, pairs / elapsed * 1000.0);
+        }
+    }
+    
+    reinit_allocator(NULL);
+}
+
+void benchmark_slab(void) {
+    print_test_header("Slab Benchmark");
+    
+    const int count = 1000;
+    const int rounds = 1000;
+    void* ptrs[1000];
+    
+    for (int slab = 0; slab <= 1; slab++) {
+        allocator_options_t options = {0};
+        options.slab = slab;
+        reinit_allocator(&options);
+        
+        // A fresh heap hands out consecutive addresses, so the span of the
+        // objects is their footprint including all metadata
+        for (int i = 0; i < count; i++) {
+            ptrs[i] = my_malloc(32);
+        }
+        size_t footprint = (size_t)((char*)ptrs[count - 1] - (char*)ptrs[0]) + 32;
+        for (int i = 0; i < count; i++) {
+            my_free(ptrs[i]);
+        }
+        
+        long long start = now_ns();
+        for (int round = 0; round < rounds; round++) {
+            for (int i = 0; i < count; i++) {
+                ptrs[i] = my_malloc(16 + (i % 8) * 16);
+            }
+            for (int i = 0; i < count; i++) {
+                my_free(ptrs[i]);
+            }
+        }
+        long long elapsed = now_ns() - start;
+        
+        printf("%s: %.1f ns per malloc/free pair, ~%zu bytes per 32-byte object\n",
+               slab ? "slab on " : "slab off", (double)elapsed / ((double)count * rounds),
+               footprint / count);
+    }
+    
+    reinit_allocator(NULL);
+}
+
+void benchmark_realloc_growth(void) {
+    print_test_header("Realloc Growth Benchmark");
+    
+    reinit_allocator(NULL);
+    
+    // Grow a buffer 16 bytes at a time, like a vector or string builder
+    const int rounds = 100;
+    const size_t limit = 64 * 1024;
+    long long reallocs = 0;
+    long long moves = 0;
+    
+    long long start = now_ns();
+    for (int round = 0; round < rounds; round++) {
+        char* buffer = (char*)my_malloc(16);
+        for (size_t size = 32; size <= limit; size += 16) {
+            char* grown = (char*)my_realloc(buffer, size);
+            moves += (grown != buffer);
+            reallocs++;
+            buffer = grown;
+        }
+        my_free(buffer);
+    }
+    long long elapsed = now_ns() - start;
+    
+    printf("%lld reallocs up to %zu bytes: %.1f ns each, %lld moved\n",
+           reallocs, limit, (double)elapsed / reallocs, moves);
+}
+
+void benchmark_huge_realloc(void) {
+    print_test_header("Huge Realloc Benchmark");
+    
+    const size_t step = REGION_SIZE;
+    const size_t limit = 16 * REGION_SIZE;
+    
+    // Grow a buffer one megabyte at a time through the heap and through mremap
+    for (int direct = 0; direct <= 1; direct++) {
+        allocator_options_t options = {0};
+        options.mmap_threshold = direct ? DEFAULT_MMAP_THRESHOLD : SIZE_MAX;
+        reinit_allocator(&options);
+        
+        unsigned char* buffer = (unsigned char*)my_malloc(step);
+        fill_pattern(buffer, step);
+        
+        int steps = 0;
+        long long start = now_ns();
+        for (size_t size = 2 * step; size <= limit && buffer != NULL; size += step) {
+            buffer = (unsigned char*)my_realloc(buffer, size);
+            steps++;
+        }
+        long long elapsed = now_ns() - start;
+        
+        int intact = (buffer != NULL) && check_pattern(buffer, step);
+        printf("%s: %d reallocs up to %zu MB, %.1f us each%s\n",
+               direct ? "mmap/mremap" : "heap       ", steps, limit / REGION_SIZE,
+               (double)elapsed / steps / 1000.0, intact ? "" : " (data lost!)");
+        my_free(buffer);
+    }
+    
+    reinit_allocator(NULL);
+}
+
+void test_purging(void) {
+    print_test_header("Purging Test");
+    
+    // Immediate purging returns a large free span as soon as it is freed
+    allocator_options_t options = {0};
+    options.purge_decay_ms = PURGE_IMMEDIATE;
+    reinit_allocator(&options);
+    void* block = my_malloc(100 * 1024);
+    memset(block, 0xAB, 100 * 1024);
+    size_t purged = get_purged_bytes();
+    size_t dirty = get_dirty_bytes();
+    my_free(block);
+    int success = (get_purged_bytes() > purged) && (get_dirty_bytes() < dirty + 4096) && validate_heap();
+    
+    // Purged memory stays usable
+    block = my_malloc(100 * 1024);
+    success = success && (block != NULL);
+    if (block != NULL) {
+        memset(block, 0x5A, 100 * 1024);
+    }
+    my_free(block);
+    
+    // With purging disabled only my_trim() returns pages
+    options.purge_decay_ms = PURGE_NEVER;
+    reinit_allocator(&options);
+    block = my_malloc(100 * 1024);
+    memset(block, 0xAB, 100 * 1024);
+    purged = get_purged_bytes();
+    dirty = get_dirty_bytes();
+    my_free(block);
+    success = success && (get_purged_bytes() <= purged) && (get_dirty_bytes() > dirty);
+    success = success && (my_trim() > 0) && (get_purged_bytes() > purged) && validate_heap();
+    
+    // my_trim() unmaps regions that became completely free
+    options.mmap_threshold = SIZE_MAX;
+    reinit_allocator(&options);
+    void* blocks[6];
+    for (int i = 0; i < 6; i++) {
+        blocks[i] = my_malloc(REGION_SIZE / 2);
+        success = success && (blocks[i] != NULL);
+    }
+    success = success && (get_heap_size() > REGION_SIZE);
+    for (int i = 0; i < 6; i++) {
+        my_free(blocks[i]);
+    }
+    my_trim();
+    success = success && (get_heap_size() == REGION_SIZE) && (get_fragmentation_count() == 1) && validate_heap();
+    
+    // With a decay, dirty spans are purged once they have waited long enough
+    options.mmap_threshold = 0;
+    options.purge_decay_ms = 50;
+    reinit_allocator(&options);
+    block = my_malloc(100 * 1024);
+    memset(block, 0xAB, 100 * 1024);
+    my_free(block);
+    purged = get_purged_bytes();
+    success = success && (get_dirty_bytes() > 64 * 1024);
+    struct timespec pause = {0, 60 * 1000000L};
+    nanosleep(&pause, NULL);
+    for (int i = 0; i < 64; i++) {
+        my_free(my_malloc(100 * 1024));
+    }
+    success = success && (get_purged_bytes() > purged) && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Purging", success);
+}
+
+// Resident set size of this process in bytes, or 0 if unknown
+static size_t resident_set_size(void) {
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    unsigned long pages = 0;
+    unsigned long resident = 0;
+    if (fscanf(statm, "%lu %lu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return (size_t)resident * 4096;
+}
+
+void benchmark_purge(void) {
+    print_test_header("Purge Benchmark");
+    
+    const int num_blocks = 256;
+    const size_t size = 64 * 1024;
+    static void* blocks[256];
+    static const char* names[] = {"never    ", "immediate", "trim     "};
+    
+    // Touch a burst of blocks, free them all and see how much stays resident
+    for (int mode = 0; mode < 3; mode++) {
+        allocator_options_t options = {0};
+        options.purge_decay_ms = (mode == 1) ? PURGE_IMMEDIATE : PURGE_NEVER;
+        reinit_allocator(&options);
+        
+        size_t before = resident_set_size();
+        for (int i = 0; i < num_blocks; i++) {
+            blocks[i] = my_malloc(size);
+            if (blocks[i] != NULL) {
+                memset(blocks[i], 0xAB, size);
+            }
+        }
+        size_t peak = resident_set_size();
+        
+        long long start = now_ns();
+        for (int i = 0; i < num_blocks; i++) {
+            my_free(blocks[i]);
+        }
+        if (mode == 2) {
+            my_trim();
+        }
+        long long elapsed = now_ns() - start;
+        size_t after = resident_set_size();
+        
+        printf("%s: RSS +%zu KB after malloc, +%zu KB after free, %.1f us to free\n", names[mode],
+               peak > before ? (peak - before) / 1024 : 0, after > before ? (after - before) / 1024 : 0,
+               (double)elapsed / 1000.0);
+    }
+    
+    reinit_allocator(NULL);
+}
+
+void test_aligned_allocation(void) {
+    print_test_header("Aligned Allocation Test");
+    
+    static const size_t sizes[] = {1, 100, 5000, 200000};
+    int success = 1;
+    
+    // Every alignment from 16 bytes to 2MB, through the heap and huge paths,
+    // with and without the small-object front ends
+    for (int front_ends = 0; front_ends <= 1; front_ends++) {
+        allocator_options_t options = {0};
+        options.thread_safe = front_ends;
+        options.tcache = front_ends;
+        options.slab = front_ends;
+        reinit_allocator(&options);
+        
+        for (size_t alignment = 16; alignment <= 2 * REGION_SIZE; alignment *= 2) {
+            void* blocks[4];
+            for (int i = 0; i < 4; i++) {
+                blocks[i] = my_aligned_alloc(alignment, sizes[i]);
+                success = success && (blocks[i] != NULL) && ((uintptr_t)blocks[i] % alignment == 0);
+                if (blocks[i] != NULL) {
+                    fill_pattern((unsigned char*)blocks[i], sizes[i]);
+                }
+            }
+            success = success && validate_heap();
+            
+            // Aligned blocks resize and free like any other, and keep their
+            // alignment through my_aligned_realloc even when they move
+            blocks[1] = my_realloc(blocks[1], 3000);
+            success = success && (blocks[1] != NULL) && check_pattern((unsigned char*)blocks[1], 100);
+            blocks[0] = my_aligned_realloc(blocks[0], alignment, 200);
+            blocks[2] = my_aligned_realloc(blocks[2], alignment, 300000);
+            success = success && (blocks[0] != NULL) && ((uintptr_t)blocks[0] % alignment == 0) &&
+                      check_pattern((unsigned char*)blocks[0], 1);
+            success = success && (blocks[2] != NULL) && ((uintptr_t)blocks[2] % alignment == 0) &&
+                      check_pattern((unsigned char*)blocks[2], 5000);
+            for (int i = 0; i < 4; i++) {
+                if (i == 3) {
+                    success = success && check_pattern((unsigned char*)blocks[i], sizes[i]);
+                }
+                my_free(blocks[i]);
+            }
+            allocator_flush_thread_cache();
+            success = success && (get_total_allocated() == 0) && validate_heap();
+        }
+    }
+    
+    // The POSIX and legacy entry points
+    void* ptr = NULL;
+    success = success && (my_posix_memalign(&ptr, 64, 256) == 0) && (ptr != NULL) && ((uintptr_t)ptr % 64 == 0);
+    my_free(ptr);
+    success = success && (my_posix_memalign(&ptr, 48, 256) == EINVAL);
+    success = success && (my_posix_memalign(&ptr, 4, 256) == EINVAL);
+    ptr = my_memalign(4096, 10);
+    success = success && (ptr != NULL) && ((uintptr_t)ptr % 4096 == 0);
+    my_free(ptr);
+    success = success && (my_aligned_alloc(24, 100) == NULL);
+    success = success && (my_aligned_realloc(NULL, 24, 100) == NULL);
+    
+    // The slack around aligned blocks goes back to the free list
+    reinit_allocator(NULL);
+    int free_blocks = get_fragmentation_count();
+    size_t free_bytes = get_total_free();
+    void* page = my_aligned_alloc(4096, 4096);
+    success = success && (page != NULL) && (get_total_free() + align_size(4096) + 2 * HEADER_SIZE >= free_bytes);
+    my_free(page);
+    success = success && (get_fragmentation_count() == free_blocks) && (get_total_free() == free_bytes) &&
+              validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Aligned Allocation", success);
+}
+
+void test_batch_allocation(void) {
+    print_test_header("Batch Allocation Test");
+    
+    reinit_allocator(NULL);
+    int free_blocks = get_fragmentation_count();
+    size_t free_bytes = get_total_free();
+    
+    // A batch is carved from one free block: the blocks are consecutive
+    void* ptrs[100];
+    size_t count = my_malloc_batch(48, 100, ptrs);
+    int success = (count == 100) && (get_total_allocated() == 100 * align_size(48)) && validate_heap();
+    for (size_t i = 0; i < count; i++) {
+        memset(ptrs[i], (int)i, 48);
+        if (i > 0) {
+            success = success && ((char*)ptrs[i] == (char*)ptrs[i - 1] + align_size(48) + HEADER_SIZE);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        success = success && (((unsigned char*)ptrs[i])[47] == (unsigned char)i);
+    }
+    
+    // Freeing in any order merges everything back into one block
+    unsigned int seed = 12345;
+    for (int i = 99; i > 0; i--) {
+        int j = (int)(next_random(&seed) % (unsigned int)(i + 1));
+        void* tmp = ptrs[i];
+        ptrs[i] = ptrs[j];
+        ptrs[j] = tmp;
+    }
+    void* skipped = ptrs[10];
+    ptrs[10] = NULL;
+    my_free_batch(ptrs, 100);
+    success = success && (get_total_allocated() == align_size(48)) && validate_heap();
+    
+    // Batches mix with single calls, including blocks from other paths
+    void* mixed[3] = {skipped, my_malloc(300 * 1024), my_malloc(64)};
+    my_free_batch(mixed, 3);
+    success = success && (get_total_allocated() == 0) && (get_fragmentation_count() == free_blocks) &&
+              (get_total_free() == free_bytes) && validate_heap();
+    
+    // Huge batches get one mapping per block
+    void* huge[3];
+    count = my_malloc_batch(200 * 1024, 3, huge);
+    success = success && (count == 3) && (get_heap_size() == REGION_SIZE);
+    my_free_batch(huge, 3);
+    
+    // A batch larger than a region grows the heap once
+    void* many[5000];
+    count = my_malloc_batch(1000, 5000, many);
+    success = success && (count == 5000) && validate_heap();
+    my_free_batch(many, 5000);
+    success = success && (get_total_allocated() == 0) && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Batch Allocation", success);
+}
+
+void benchmark_batch(void) {
+    print_test_header("Batch Benchmark");
+    
+    const int rounds = 2000;
+    const int batch = 64;
+    static const size_t sizes[] = {32, 256, 2048};
+    void* ptrs[64];
+    
+    reinit_allocator(NULL);
+    
+    // Allocate and free a handler's worth of nodes, one call each vs one call per batch
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        long long start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < batch; i++) {
+                ptrs[i] = my_malloc(sizes[s]);
+            }
+            for (int i = 0; i < batch; i++) {
+                my_free(ptrs[i]);
+            }
+        }
+        long long single = now_ns() - start;
+        
+        start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            my_malloc_batch(sizes[s], (size_t)batch, ptrs);
+            my_free_batch(ptrs, (size_t)batch);
+        }
+        long long batched = now_ns() - start;
+        
+        printf("%4zu bytes x %d: single %.1f ns/block, batch %.1f ns/block (%.2fx)\n", sizes[s], batch,
+               (double)single / (rounds * batch), (double)batched / (rounds * batch),
+               batched > 0 ? (double)single / batched : 0.0);
+    }
+    
+    reinit_allocator(NULL);
+}
+
+void test_compact_header(void) {
+    print_test_header("Compact Header Test");
+    
+    reinit_allocator(NULL);
+    int free_blocks = get_fragmentation_count();
+    size_t free_bytes = get_total_free();
+    
+    // Allocated blocks carry one size word; small requests round up to the minimum
+    char* a = (char*)my_malloc(16);
+    char* b = (char*)my_malloc(16);
+    char* c = (char*)my_malloc(100);
+    char* d = (char*)my_malloc(16);
+    int success = (HEADER_SIZE == sizeof(size_t)) && (b - a == (ptrdiff_t)(HEADER_SIZE + MIN_BLOCK_SIZE)) &&
+                  (c - b == (ptrdiff_t)(HEADER_SIZE + MIN_BLOCK_SIZE)) &&
+                  (get_total_allocated() == 3 * MIN_BLOCK_SIZE + 104);
+    
+    // The payload is all the caller's, right up to the next header
+    memset(a, 0xFF, MIN_BLOCK_SIZE);
+    memset(c, 0xFF, 104);
+    success = success && validate_heap();
+    
+    // Freeing in every order coalesces through the boundary tags
+    my_free(b);
+    my_free(c);
+    success = success && validate_heap() && (get_fragmentation_count() == free_blocks + 1);
+    my_free(a);
+    success = success && validate_heap() && (get_fragmentation_count() == free_blocks + 1);
+    my_free(d);
+    success = success && (get_fragmentation_count() == free_blocks) && (get_total_free() == free_bytes) &&
+              validate_heap();
+    
+    // A region holds one 16-byte object per 32 bytes
+    size_t heap_size = get_heap_size();
+    size_t fits = (REGION_SIZE - 4096) / (HEADER_SIZE + MIN_BLOCK_SIZE);
+    void** ptrs = malloc(fits * sizeof(void*));
+    for (size_t i = 0; i < fits; i++) {
+        ptrs[i] = my_malloc(16);
+    }
+    success = success && (get_heap_size() == heap_size) && validate_heap();
+    for (size_t i = 0; i < fits; i++) {
+        my_free(ptrs[i]);
+    }
+    free(ptrs);
+    success = success && (get_total_allocated() == 0) && (get_fragmentation_count() == free_blocks) &&
+              validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Compact Header", success);
+}
+
+void test_tlsf(void) {
+    print_test_header("TLSF Engine Test");
+    
+    allocator_options_t options = {0};
+    options.engine = ENGINE_TLSF;
+    reinit_allocator(&options);
+    size_t initial_free = get_total_free();
+    int initial_blocks = get_fragmentation_count();
+    
+    // A hole is reused by a request of its own size class
+    void* hole = my_malloc(1000);
+    void* guard1 = my_malloc(16);
+    my_free(hole);
+    void* ptr = my_malloc(1000);
+    int success = (ptr == hole);
+    
+    // A hole too small for the request is skipped without searching its class
+    void* small = my_malloc(1030);
+    void* guard2 = my_malloc(16);
+    my_free(small);
+    void* larger = my_malloc(1040);
+    success = success && (larger != NULL) && (larger != small) && validate_heap();
+    my_free(larger);
+    my_free(guard2);
+    my_free(ptr);
+    my_free(guard1);
+    
+    // Random sizes, reallocations and frees keep the heap consistent
+    void* ptrs[256] = {0};
+    unsigned int seed = 7;
+    for (int i = 0; i < 20000; i++) {
+        int slot = (int)(next_random(&seed) % 256);
+        size_t size = 1 + next_random(&seed) % 8192;
+        if (ptrs[slot] == NULL) {
+            ptrs[slot] = my_malloc(size);
+            success = success && (ptrs[slot] != NULL);
+        } else if (i % 3 == 0) {
+            ptrs[slot] = my_realloc(ptrs[slot], size);
+            success = success && (ptrs[slot] != NULL);
+        } else {
+            my_free(ptrs[slot]);
+            ptrs[slot] = NULL;
+        }
+    }
+    success = success && validate_heap();
+    for (int i = 0; i < 256; i++) {
+        my_free(ptrs[i]);
+    }
+    
+    // Immediate coalescing leaves the heap as it started
+    success = success && (get_total_allocated() == 0) && (get_fragmentation_count() == initial_blocks) &&
+              (get_total_free() == initial_free) && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("TLSF engine", success);
+}
+
+static int compare_cycles(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latency(const char* engine, const char* op, unsigned long long* samples, size_t count) {
+    qsort(samples, count, sizeof(samples[0]), compare_cycles);
+    size_t p9999 = (count * 9999 + 9999) / 10000 - 1;
+    printf("%-10s %-6s median %6llu, p99.99 %6llu, max %7llu %s\n", engine, op, samples[count / 2], samples[p9999],
+           samples[count - 1], CYCLE_UNIT);
+}
+
+void benchmark_latency(void) {
+    print_test_header("Allocation Latency Benchmark");
+    
+    enum { ROUNDS = 1000, FITS = 16, MAX_DECOYS = 1024 };
+    const size_t fit_size = 4088;
+    const size_t decoy_size = 2048;
+    static const int engines[] = {ENGINE_SEGREGATED, ENGINE_TLSF};
+    static const char* names[] = {"segregated", "TLSF"};
+    static void* fits[FITS];
+    static void* decoys[MAX_DECOYS];
+    static void* guards[FITS + MAX_DECOYS];
+    unsigned long long* malloc_cycles = (unsigned long long*)malloc(ROUNDS * FITS * sizeof(unsigned long long));
+    unsigned long long* free_cycles = (unsigned long long*)malloc(ROUNDS * FITS * sizeof(unsigned long long));
+    
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        allocator_options_t options = {0};
+        options.engine = engines[e];
+        reinit_allocator(&options);
+        
+        // Adversarial layout: a few blocks that fit the request, then as many
+        // smaller decoys from the same power-of-two range as the region holds,
+        // each pinned by a guard, and nothing larger left free
+        size_t room = get_total_free() - FITS * (fit_size + 64) - 64 * 1024;
+        int decoy_count = (int)(room / (decoy_size + 64));
+        if (decoy_count > MAX_DECOYS) {
+            decoy_count = MAX_DECOYS;
+        }
+        for (int i = 0; i < FITS; i++) {
+            fits[i] = my_malloc(fit_size);
+            guards[i] = my_malloc(16);
+        }
+        for (int i = 0; i < decoy_count; i++) {
+            decoys[i] = my_malloc(decoy_size);
+            guards[FITS + i] = my_malloc(16);
+        }
+        void* rest = my_malloc(get_total_free());
+        
+        // Freed last, the decoys sit in front of the fitting blocks
+        for (int r = 0; r < ROUNDS; r++) {
+            for (int i = 0; i < FITS; i++) {
+                my_free(fits[i]);
+            }
+            for (int i = 0; i < decoy_count; i++) {
+                my_free(decoys[i]);
+            }
+            
+            for (int i = 0; i < FITS; i++) {
+                unsigned long long start = read_cycles();
+                fits[i] = my_malloc(fit_size);
+                malloc_cycles[r * FITS + i] = read_cycles() - start;
+            }
+            for (int i = 0; i < FITS; i++) {
+                unsigned long long start = read_cycles();
+                my_free(fits[i]);
+                free_cycles[r * FITS + i] = read_cycles() - start;
+            }
+            
+            // Take everything back so the next round rebuilds the same lists
+            for (int i = 0; i < FITS; i++) {
+                fits[i] = my_malloc(fit_size);
+            }
+            for (int i = 0; i < decoy_count; i++) {
+                decoys[i] = my_malloc(decoy_size);
+            }
+        }
+        
+        print_latency(names[e], "malloc", malloc_cycles, ROUNDS * FITS);
+        print_latency(names[e], "free", free_cycles, ROUNDS * FITS);
+        printf("%-10s %d decoys, heap %zu bytes\n", names[e], decoy_count, get_heap_size());
+        
+        my_free(rest);
+        for (int i = 0; i < FITS; i++) {
+            my_free(fits[i]);
+        }
+        for (int i = 0; i < decoy_count; i++) {
+            my_free(decoys[i]);
+        }
+        for (int i = 0; i < FITS + decoy_count; i++) {
+            my_free(guards[i]);
+        }
+    }
+    
+    free(malloc_cycles);
+    free(free_cycles);
+    reinit_allocator(NULL);
+}
+
+void test_buddy(void) {
+    print_test_header("Buddy Engine Test");
+    
+    allocator_options_t options = {0};
+    options.engine = ENGINE_BUDDY;
+    reinit_allocator(&options);
+    size_t initial_free = get_total_free();
+    int initial_blocks = get_fragmentation_count();
+    
+    // Power-of-two requests get exactly their size, aligned to it
+    char* page = (char*)my_malloc(4096);
+    int success = (page != NULL) && ((uintptr_t)page % 4096 == 0) && (get_total_allocated() == 4096);
+    
+    // Other sizes round up to the next power of two; the two halves of a
+    // split block are buddies and sit side by side
+    char* a = (char*)my_malloc(10);
+    char* b = (char*)my_malloc(16);
+    char* c = (char*)my_malloc(100);
+    success = success && (b - a == 16) && ((uintptr_t)c % 128 == 0) && (get_total_allocated() == 4096 + 32 + 128);
+    
+    // Growing within the block keeps it; growing past it moves the data
+    memset(c, 0x5A, 100);
+    success = success && (my_realloc(c, 128) == c);
+    char* grown = (char*)my_realloc(c, 1000);
+    success = success && (grown != NULL) && (grown[0] == 0x5A) && (grown[99] == 0x5A);
+    
+    // Aligned requests take a block of at least the alignment
+    void* aligned = my_aligned_alloc(512, 40);
+    success = success && ((uintptr_t)aligned % 512 == 0) && validate_heap();
+    
+    my_free(aligned);
+    my_free(grown);
+    my_free(b);
+    my_free(a);
+    my_free(page);
+    
+    // Random sizes, reallocations and frees keep the bitmaps and lists in step
+    void* ptrs[256] = {0};
+    unsigned int seed = 11;
+    for (int i = 0; i < 20000; i++) {
+        int slot = (int)(next_random(&seed) % 256);
+        size_t size = 1 + next_random(&seed) % 8192;
+        if (ptrs[slot] == NULL) {
+            ptrs[slot] = my_malloc(size);
+            success = success && (ptrs[slot] != NULL);
+        } else if (i % 3 == 0) {
+            ptrs[slot] = my_realloc(ptrs[slot], size);
+            success = success && (ptrs[slot] != NULL);
+        } else {
+            my_free(ptrs[slot]);
+            ptrs[slot] = NULL;
+        }
     }
-    end = clock();
-    double custom_time = ((double)(end - start)) / CLOCKS_PER_SEC;
+    success = success && validate_heap();
+    my_free_batch(ptrs, 256);
+    
+    // Every buddy pair has merged back into the single top block
+    success = success && (get_total_allocated() == 0) && (get_fragmentation_count() == initial_blocks) &&
+              (get_total_free() == initial_free) && validate_heap();
     
-    // Benchmark standard allocator
-    start = clock();
-    for (int i = 0; i < NUM_OPERATIONS; i++) {
-        void* ptr = malloc(64);
-        if (ptr) free(ptr);
+    reinit_allocator(NULL);
+    print_test_result("Buddy engine", success);
+}
+
+void benchmark_buddy(void) {
+    print_test_header("Buddy Engine Benchmark");
+    
+    enum { SLOTS = 1024, OPS = 400000 };
+    static const int engines[] = {ENGINE_SEGREGATED, ENGINE_BUDDY};
+    static const char* names[] = {"segregated", "buddy"};
+    static const char* workloads[] = {"power-of-two", "mixed"};
+    static void* ptrs[SLOTS];
+    static size_t sizes[SLOTS];
+    
+    // Random churn over a fixed number of live slots. Internal fragmentation
+    // is the share of the blocks' footprint (size plus any header) the
+    // caller did not ask for, measured with every slot live.
+    for (int w = 0; w < 2; w++) {
+        for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+            allocator_options_t options = {0};
+            options.engine = engines[e];
+            reinit_allocator(&options);
+            memset(ptrs, 0, sizeof(ptrs));
+            unsigned int seed = 3;
+            
+            long long start = now_ns();
+            for (int i = 0; i < OPS; i++) {
+                int slot = (int)(next_random(&seed) % SLOTS);
+                if (ptrs[slot] != NULL) {
+                    my_free(ptrs[slot]);
+                }
+                unsigned int r = next_random(&seed);
+                sizes[slot] = w == 0 ? (size_t)16 << (r % 9) : 16 + r % 4081;
+                ptrs[slot] = my_malloc(sizes[slot]);
+            }
+            long long elapsed = now_ns() - start;
+            
+            size_t requested = 0;
+            for (int i = 0; i < SLOTS; i++) {
+                requested += sizes[i];
+            }
+            size_t footprint = get_total_allocated() + (engines[e] == ENGINE_BUDDY ? 0 : SLOTS * HEADER_SIZE);
+            
+            printf("%-12s %-10s %6.1f Mops/s, internal fragmentation %5.1f%%\n", workloads[w], names[e],
+                   OPS * 1000.0 / (double)elapsed, 100.0 * (double)(footprint - requested) / (double)footprint);
+            
+            my_free_batch(ptrs, SLOTS);
+        }
     }
-    end = clock();
-    double stdlib_time = ((double)(end - start)) / CLOCKS_PER_SEC;
     
-    printf("Custom allocator time: %.6f seconds\n", custom_time);
-    printf("Standard allocator time: %.6f seconds\n", stdlib_time);
-    printf("Performance ratio: %.2fx\n", custom_time / stdlib_time);
-}
\ No newline at end of file
+    reinit_allocator(NULL);
+}
+
+void test_placement_policies(void) {
+    print_test_header("Placement Policy Test");
+    
+    reinit_allocator(NULL);
+    int success = (my_get_placement_policy() == PLACEMENT_GOOD_FIT);
+    
+    // Three holes in one large bin, lowest address first: x (1900), y (1200)
+    // and z (1600). Freed in address order, the bin lists them z, y, x.
+    void* x = my_malloc(1900);
+    void* guard1 = my_malloc(16);
+    void* y = my_malloc(1200);
+    void* guard2 = my_malloc(16);
+    void* z = my_malloc(1600);
+    void* guard3 = my_malloc(16);
+    my_free(x);
+    my_free(y);
+    my_free(z);
+    
+    // First fit takes the head, z; next fit then resumes after it at y
+    success = success && my_set_placement_policy(PLACEMENT_FIRST_FIT);
+    void* ptr = my_malloc(1150);
+    success = success && (ptr == z);
+    my_free(ptr);
+    
+    success = success && my_set_placement_policy(PLACEMENT_NEXT_FIT);
+    ptr = my_malloc(1150);
+    success = success && (ptr == z);
+    my_free(ptr);
+    ptr = my_malloc(1150);
+    success = success && (ptr == y);
+    my_free(ptr);
+    
+    // Best fit takes the smallest hole and address-ordered fit the lowest
+    success = success && my_set_placement_policy(PLACEMENT_BEST_FIT);
+    ptr = my_malloc(1150);
+    success = success && (ptr == y);
+    my_free(ptr);
+    
+    success = success && my_set_placement_policy(PLACEMENT_ADDRESS_FIT);
+    ptr = my_malloc(1150);
+    success = success && (ptr == x);
+    my_free(ptr);
+    
+    // Unknown policies are rejected and leave the current one in place
+    success = success && !my_set_placement_policy(42) && (my_get_placement_policy() == PLACEMENT_ADDRESS_FIT);
+    
+    my_free(guard1);
+    my_free(guard2);
+    my_free(guard3);
+    success = success && (get_total_allocated() == 0) && validate_heap();
+    
+    // The policy can also be chosen at initialization
+    allocator_options_t options = {0};
+    options.placement = PLACEMENT_BEST_FIT;
+    reinit_allocator(&options);
+    success = success && (my_get_placement_policy() == PLACEMENT_BEST_FIT);
+    
+    reinit_allocator(NULL);
+    print_test_result("Placement policies", success);
+}
+
+// Sum the free blocks and find the largest, for external fragmentation
+static void measure_free_block(const block_header_t* block, void* context) {
+    size_t* totals = (size_t*)context;
+    if (BLOCK_IS_FREE(block)) {
+        totals[0] += BLOCK_SIZE(block);
+        if (BLOCK_SIZE(block) > totals[1]) {
+            totals[1] = BLOCK_SIZE(block);
+        }
+    }
+}
+
+void benchmark_placement(void) {
+    print_test_header("Placement Policy Benchmark");
+    
+    enum { SLOTS = 4096, OPS = 200000 };
+    static const char* names[] = {"good fit", "first fit", "next fit", "best fit", "address fit"};
+    static void* ptrs[SLOTS];
+    
+    // The same seeded workload under every policy: mostly small blocks, some
+    // medium and a few large ones, replacing a random live block each step
+    for (int policy = PLACEMENT_GOOD_FIT; policy <= PLACEMENT_ADDRESS_FIT; policy++) {
+        allocator_options_t options = {0};
+        options.placement = policy;
+        reinit_allocator(&options);
+        memset(ptrs, 0, sizeof(ptrs));
+        unsigned int seed = 5;
+        size_t peak_heap = 0;
+        
+        long long start = now_ns();
+        for (int i = 0; i < OPS; i++) {
+            int slot = (int)(next_random(&seed) % SLOTS);
+            my_free(ptrs[slot]);
+            unsigned int r = next_random(&seed);
+            size_t size = r % 100 < 70 ? 16 + r % 241 : r % 100 < 95 ? 256 + r % 3841 : 4096 + r % 61441;
+            ptrs[slot] = my_malloc(size);
+            if (get_heap_size() > peak_heap) {
+                peak_heap = get_heap_size();
+            }
+        }
+        long long elapsed = now_ns() - start;
+        
+        size_t totals[2] = {0, 0};
+        heap_walk(measure_free_block, totals);
+        printf("%-12s %6.2f Mops/s, peak heap %5zu KB, %5d free blocks, external fragmentation %4.1f%%\n",
+               names[policy], OPS * 1000.0 / (double)elapsed, peak_heap / 1024, get_fragmentation_count(),
+               totals[0] > 0 ? 100.0 * (1.0 - (double)totals[1] / (double)totals[0]) : 0.0);
+        
+        my_free_batch(ptrs, SLOTS);
+    }
+    
+    reinit_allocator(NULL);
+}
+
+// Allocate and free from another thread, which then exits
+static void* stats_worker(void* arg) {
+    (void)arg;
+    for (int i = 0; i < 100; i++) {
+        my_free(my_malloc(64));
+    }
+    return NULL;
+}
+
+// Find the largest free block by walking the heap
+static void find_largest_free(const block_header_t* block, void* context) {
+    size_t* largest = (size_t*)context;
+    if (BLOCK_IS_FREE(block) && BLOCK_SIZE(block) > *largest) {
+        *largest = BLOCK_SIZE(block);
+    }
+}
+
+void test_live_stats(void) {
+    print_test_header("Live Statistics Test");
+    
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    options.num_arenas = 1;
+    reinit_allocator(&options);
+    
+    allocator_stats_t stats;
+    my_get_stats(&stats);
+    int success = (stats.allocated_blocks == 0) && (stats.malloc_calls == 0) && (stats.free_calls == 0) &&
+                  (stats.free_blocks == (size_t)get_fragmentation_count()) && (stats.heap_size == get_heap_size());
+    
+    // Blocks land in the power-of-two class of their size; the two
+    // smallest round up to MIN_BLOCK_SIZE
+    void* ptrs[8];
+    for (int i = 0; i < 8; i++) {
+        ptrs[i] = my_malloc((size_t)1024 >> i);
+    }
+    void* zeroed = my_calloc(10, 100);
+    ptrs[3] = my_realloc(ptrs[3], 3000);
+    void* huge = my_malloc(1 << 20);
+    
+    my_get_stats(&stats);
+    size_t largest = 0;
+    heap_walk(find_largest_free, &largest);
+    success = success && (stats.allocated_blocks == 10) && (stats.size_classes[10] == 1) &&
+              (stats.size_classes[11] == 1) && (stats.size_classes[4] == 2) && (stats.size_classes[9] == 2) &&
+              (stats.size_classes[20] == 1) && (stats.allocated_bytes == get_total_allocated()) &&
+              (stats.free_bytes == get_total_free()) && (stats.largest_free_block == largest) &&
+              (stats.peak_allocated >= stats.allocated_bytes);
+    success = success && (stats.malloc_calls == 9) && (stats.calloc_calls == 1) && (stats.realloc_calls == 1) &&
+              (stats.free_calls == 0);
+    
+    // Freeing lowers the live figures but not the peak
+    size_t peak = stats.peak_allocated;
+    my_free(huge);
+    my_free(zeroed);
+    my_free_batch(ptrs, 8);
+    my_get_stats(&stats);
+    success = success && (stats.allocated_blocks == 0) && (stats.allocated_bytes == 0) &&
+              (stats.peak_allocated == peak) && (stats.free_calls == 10) &&
+              (stats.free_blocks == (size_t)get_fragmentation_count()) && validate_heap();
+    
+    // Calls made by threads that have exited still count
+    pthread_t thread;
+    pthread_create(&thread, NULL, stats_worker, NULL);
+    pthread_join(thread, NULL);
+    my_get_stats(&stats);
+    success = success && (stats.malloc_calls == 109) && (stats.free_calls == 110);
+    
+    // The peak is the allocator's high-water mark, not a sum of each heap's:
+    // a huge block freed before an arena block is allocated never overlaps it
+    reinit_allocator(&options);
+    void* mapped = my_malloc(1 << 20);
+    my_free(mapped);
+    void* arena_block = my_malloc(100 * 1024);
+    my_get_stats(&stats);
+    success = success && (stats.peak_allocated >= (1 << 20)) && (stats.peak_allocated < (1 << 20) + 100 * 1024) &&
+              (stats.allocated_bytes >= 100 * 1024);
+    my_free(arena_block);
+    
+    reinit_allocator(NULL);
+    print_test_result("Live statistics", success);
+}
+
+void test_remote_free(void) {
+    print_test_header("Remote Free Test");
+    
+    allocator_options_t options = {0};
+    options.thread_safe = 1;
+    options.num_arenas = 2;
+    options.remote_free = 1;
+    reinit_allocator(&options);
+    
+    // Threads are bound round-robin, so of two workers exactly one shares
+    // the main thread's arena
+    void* ptrs[16];
+    pthread_t thread;
+    for (int t = 0; t < 2; t++) {
+        pthread_create(&thread, NULL, allocate_for_other_thread, &ptrs[t * 8]);
+        pthread_join(thread, NULL);
+    }
+    int success = 1;
+    for (int i = 0; i < 16; i++) {
+        success = success && (ptrs[i] != NULL);
+        my_free(ptrs[i]);
+    }
+    
+    // The other worker's blocks wait for its arena to be drained
+    allocator_stats_t stats;
+    my_get_stats(&stats);
+    success = success && (stats.allocated_blocks == 8) && (stats.free_calls == 16) && validate_heap();
+    
+    // Trimming drains every arena, after which the heap is empty again
+    my_trim();
+    my_get_stats(&stats);
+    success = success && (stats.allocated_blocks == 0) && (stats.allocated_bytes == 0) &&
+              (stats.free_blocks == (size_t)get_fragmentation_count()) && validate_heap();
+    print_test_result("Remote free", success);
+    
+    // Freeing again a block its own arena already binned is refused, from
+    // the foreign thread as from the local one, and leaves the bins intact
+    void* freed[2][2];
+    for (int t = 0; t < 2; t++) {
+        pthread_create(&thread, NULL, free_on_other_thread, freed[t]);
+        pthread_join(thread, NULL);
+    }
+    for (int t = 0; t < 2; t++) {
+        my_free(freed[t][0]);
+    }
+    my_trim();
+    int refused = validate_heap();
+    void* reused[2][2];
+    for (int t = 0; t < 2; t++) {
+        pthread_create(&thread, NULL, reuse_on_other_thread, reused[t]);
+        pthread_join(thread, NULL);
+        refused = refused && (reused[t][0] != NULL) && (reused[t][1] != NULL) && (reused[t][0] != reused[t][1]);
+    }
+    for (int t = 0; t < 2; t++) {
+        my_free(reused[t][0]);
+        my_free(reused[t][1]);
+        my_free(freed[t][1]);
+    }
+    my_trim();
+    my_get_stats(&stats);
+    refused = refused && (stats.allocated_blocks == 0) && validate_heap();
+    
+    reinit_allocator(NULL);
+    print_test_result("Remote double free", refused);
+}
+
+
+void test_ownership(void) {
+    print_test_header("Ownership Test");
+    
+    allocator_options_t options = {0};
+    options.slab = 1;
+    reinit_allocator(&options);
+    
+    // Every kind of block is recognised and reports at least its request
+    void* small = my_malloc(40);
+    void* block = my_malloc(1000);
+    void* aligned = my_aligned_alloc(256, 300);
+    void* huge = my_malloc(1 << 20);
+    int success = my_owns(small) && my_owns(block) && my_owns(aligned) && my_owns(huge) &&
+                  (my_usable_size(small) >= 40) && (my_usable_size(block) >= 1000) &&
+                  (my_usable_size(aligned) >= 300) && (my_usable_size(huge) >= (1 << 20));
+    
+    // Memory from elsewhere is not ours
+    int local = 0;
+    void* foreign = malloc(64);
+    success = success && !my_owns(NULL) && !my_owns(&local) && !my_owns(foreign) && (my_usable_size(foreign) == 0);
+    free(foreign);
+    
+    my_free(small);
+    my_free(block);
+    my_free(aligned);
+    my_free(huge);
+    success = success && (get_total_allocated() == 0);
+    
+    reinit_allocator(NULL);
+    print_test_result("Ownership", success);
+}
+
+void test_trace(void) {
+    print_test_header("Allocation Trace Test");
+    
+    reinit_allocator(NULL);
+    const char* path = "allocator_test.trace";
+    int success = my_trace_start(path);
+    
+    // One record per block allocated or freed, none once recording stops
+    void* a = my_malloc(100);
+    void* b = my_calloc(4, 50);
+    void* moved = my_realloc(a, 5000);
+    void* aligned = my_aligned_alloc(64, 200);
+    void* batch[3];
+    my_malloc_batch(32, 3, batch);
+    my_free_batch(batch, 3);
+    my_free(b);
+    my_free(aligned);
+    my_trace_stop();
+    my_free(moved);
+    
+    trace_header_t header;
+    trace_record_t records[16];
+    size_t count = 0;
+    FILE* file = fopen(path, "rb");
+    if (file != NULL) {
+        success = success && (fread(&header, sizeof(header), 1, file) == 1) && (header.magic == TRACE_MAGIC) &&
+                  (header.version == TRACE_VERSION) && (header.record_size == sizeof(trace_record_t));
+        count = fread(records, sizeof(trace_record_t), 16, file);
+        fclose(file);
+    }
+    remove(path);
+    
+    success = success && (count == 12);
+    if (success) {
+        int ops[12] = {TRACE_MALLOC, TRACE_CALLOC, TRACE_REALLOC, TRACE_ALIGNED_ALLOC, TRACE_MALLOC, TRACE_MALLOC,
+                       TRACE_MALLOC, TRACE_FREE, TRACE_FREE, TRACE_FREE, TRACE_FREE, TRACE_FREE};
+        for (size_t i = 0; i < count; i++) {
+            success = success && (records[i].op == ops[i]) && (records[i].thread == 0) &&
+                      (i == 0 || records[i].timestamp >= records[i - 1].timestamp);
+        }
+        success = success && (records[0].size == 100) && (records[0].id == (uintptr_t)a) &&
+                  (records[1].size == 200) && (records[2].old_id == (uintptr_t)a) &&
+                  (records[2].id == (uintptr_t)moved) && (records[3].align_shift == 6) &&
+                  (records[4].size == 32) && (records[10].id == (uintptr_t)b) &&
+                  (records[11].id == (uintptr_t)aligned);
+    }
+    
+    reinit_allocator(NULL);
+    print_test_result("Allocation trace", success);
+}
+
+#define PIPE_SLOTS 1024
+
+// Single-producer single-consumer ring carrying blocks between threads
+typedef struct {
+    void* slots[PIPE_SLOTS];
+    size_t head; // Next slot the consumer reads
+    size_t tail; // Next slot the producer writes
+    int items;
+} pipe_t;
+
+// Allocate blocks and hand them down the pipe
+static void* pipe_producer(void* arg) {
+    pipe_t* pipe = (pipe_t*)arg;
+    for (int i = 0; i < pipe->items; i++) {
+        void* ptr = my_malloc(64 + (size_t)(i & 7) * 16);
+        while (pipe->tail - __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) == PIPE_SLOTS) {
+            sched_yield();
+        }
+        pipe->slots[pipe->tail % PIPE_SLOTS] = ptr;
+        __atomic_store_n(&pipe->tail, pipe->tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Free every block arriving from the producer
+static void* pipe_consumer(void* arg) {
+    pipe_t* pipe = (pipe_t*)arg;
+    for (int i = 0; i < pipe->items; i++) {
+        while (__atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) == pipe->head) {
+            sched_yield();
+        }
+        my_free(pipe->slots[pipe->head % PIPE_SLOTS]);
+        __atomic_store_n(&pipe->head, pipe->head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void benchmark_remote_free(void) {
+    print_test_header("Remote Free Benchmark");
+    
+    int items = 200000;
+    
+    for (int remote = 0; remote <= 1; remote++) {
+        for (int width = 1; width <= 4; width *= 2) {
+            // Every thread gets an arena of its own, so each free is remote
+            allocator_options_t options = {0};
+            options.thread_safe = 1;
+            options.num_arenas = 2 * width;
+            options.remote_free = remote;
+            reinit_allocator(&options);
+            
+            pipe_t* pipes = (pipe_t*)calloc(width, sizeof(pipe_t));
+            pthread_t threads[8];
+            long long start = now_ns();
+            for (int p = 0; p < width; p++) {
+                pipes[p].items = items;
+                pthread_create(&threads[2 * p], NULL, pipe_producer, &pipes[p]);
+                pthread_create(&threads[2 * p + 1], NULL, pipe_consumer, &pipes[p]);
+            }
+            for (int t = 0; t < 2 * width; t++) {
+                pthread_join(threads[t], NULL);
+            }
+            long long elapsed = now_ns() - start;
+            free(pipes);
+            
+            double transfers = (double)items * width;
+            printf("remote free %s, %d pipeline(s): %.1f ns per block, %.2f M blocks/s\n",
+                   remote ? "on " : "off", width, (double)elapsed / transfers, transfers / elapsed * 1000.0);
+        }
+    }
+    
+    reinit_allocator(NULL);
+}
+
+void benchmark_heap_profile(void) {
+    print_test_header("Heap Profile Overhead Benchmark");
+    
+    reinit_allocator(NULL);
+    const int pairs = 1000000;
+    for (int i = 0; i < pairs; i++) {
+        my_free(my_malloc(64 + (i & 255)));
+    }
+    
+    // Unsampled calls pay a countdown decrement and a filter check
+    for (int profiled = 0; profiled <= 1; profiled++) {
+        if (profiled) {
+            my_profile_start(0);
+        }
+        long long start = now_ns();
+        for (int i = 0; i < pairs; i++) {
+            void* ptr = my_malloc(64 + (i & 255));
+            my_free(ptr);
+        }
+        long long elapsed = now_ns() - start;
+        printf("%-9s %.1f ns per malloc/free pair\n", profiled ? "profiled:" : "plain:", (double)elapsed / pairs);
+    }
+    my_profile_stop();
+    
+    reinit_allocator(NULL);
+}
@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include "../include/trace_tools.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define KEY_EMPTY 0
+#define KEY_DELETED 1
+
+void* tool_map(size_t size) {
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+int trace_open(trace_reader_t* reader, const char* path) {
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        fprintf(stderr, "Error: Cannot open trace %s\n", path);
+        return 0;
+    }
+    
+    trace_header_t header;
+    if (fread(&header, sizeof(header), 1, reader->file) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "Error: %s is not a version %d allocation trace\n", path, TRACE_VERSION);
+        fclose(reader->file);
+        return 0;
+    }
+    
+    struct stat info;
+    reader->total = fstat(fileno(reader->file), &info) == 0
+                        ? (unsigned long long)(info.st_size - sizeof(header)) / sizeof(trace_record_t)
+                        : 0;
+    reader->records = (trace_record_t*)tool_map(TRACE_READ_RECORDS * sizeof(trace_record_t));
+    if (reader->records == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        fclose(reader->file);
+        return 0;
+    }
+    return 1;
+}
+
+size_t trace_read(trace_reader_t* reader) {
+    return fread(reader->records, sizeof(trace_record_t), TRACE_READ_RECORDS, reader->file);
+}
+
+void trace_close(trace_reader_t* reader) {
+    fclose(reader->file);
+    munmap(reader->records, TRACE_READ_RECORDS * sizeof(trace_record_t));
+}
+
+static size_t live_slot(const live_map_t* map, uint64_t key) {
+    uint64_t hash = key * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(hash >> 20) & (map->capacity - 1);
+}
+
+int live_init(live_map_t* map, size_t capacity) {
+    map->entries = (live_entry_t*)tool_map(capacity * sizeof(live_entry_t));
+    map->capacity = capacity;
+    map->used = 0;
+    map->live = 0;
+    return map->entries != NULL;
+}
+
+live_entry_t* live_find(live_map_t* map, uint64_t key) {
+    for (size_t i = live_slot(map, key);; i = (i + 1) & (map->capacity - 1)) {
+        if (map->entries[i].key == key) {
+            return &map->entries[i];
+        }
+        if (map->entries[i].key == KEY_EMPTY) {
+            return NULL;
+        }
+    }
+}
+
+// Rebuild at a size fitting the live entries, dropping deleted ones
+static int live_rehash(live_map_t* map) {
+    live_map_t old = *map;
+    size_t capacity = old.capacity;
+    while (old.live * 2 >= capacity) {
+        capacity *= 2;
+    }
+    if (!live_init(map, capacity)) {
+        *map = old;
+        return 0;
+    }
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.entries[i].key > KEY_DELETED) {
+            *live_insert(map, old.entries[i].key, old.entries[i].ptr) = old.entries[i];
+        }
+    }
+    munmap(old.entries, old.capacity * sizeof(live_entry_t));
+    return 1;
+}
+
+live_entry_t* live_insert(live_map_t* map, uint64_t key, void* ptr) {
+    if ((map->used + 1) * 4 >= map->capacity * 3 && !live_rehash(map)) {
+        return NULL;
+    }
+    size_t i = live_slot(map, key);
+    while (map->entries[i].key > KEY_DELETED) {
+        i = (i + 1) & (map->capacity - 1);
+    }
+    if (map->entries[i].key == KEY_EMPTY) {
+        map->used++;
+    }
+    live_entry_t* entry = &map->entries[i];
+    entry->key = key;
+    entry->ptr = ptr;
+    entry->requested = 0;
+    entry->usable = 0;
+    map->live++;
+    return entry;
+}
+
+void live_remove(live_map_t* map, live_entry_t* entry) {
+    entry->key = KEY_DELETED;
+    entry->ptr = NULL;
+    map->live--;
+}
+
+int start_engine(const char* name) {
+    allocator_options_t options = {0};
+    options.quiet = 1;
+    if (strcmp(name, "segregated") == 0) {
+        options.engine = ENGINE_SEGREGATED;
+    } else if (strcmp(name, "tlsf") == 0) {
+        options.engine = ENGINE_TLSF;
+    } else if (strcmp(name, "buddy") == 0) {
+        options.engine = ENGINE_BUDDY;
+    } else {
+        return 0;
+    }
+    allocator_init_ex(&options);
+    return 1;
+}